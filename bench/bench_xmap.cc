@@ -0,0 +1,257 @@
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include "xmap.h"
+
+/*
+ * xmap microbenchmarks. Every result is one CSV row (or one JSON object per
+ * line with --json):
+ *
+ *     op,size,threads,ops,ns,ns_per_op
+ *
+ * `size' is the number of entries in the map, `ops' the operations timed,
+ * `ns' the best wall time over --reps runs.
+ *
+ * Options:
+ *     --min N      smallest map size (default 1000)
+ *     --max N      largest map size, sizes go up by 10x (default 10000000)
+ *     --threads N  threads for the mixed workload (default 4)
+ *     --reps N     runs per measurement, the fastest is reported (default 3)
+ *     --json       JSON lines instead of CSV
+ */
+
+#define SHIFT_OPS	1000 /* shifting erases are O(n): time a fixed number */
+#define MIXED_OPS	200000 /* operations per thread in the mixed workload */
+
+static int json = 0;
+static unsigned reps = 3;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static unsigned long long elapsed_ns(bench_clock::time_point t0) {
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0).count();
+}
+
+static void report(const char *op, size_t size, unsigned threads, size_t ops, unsigned long long ns) {
+	double per = ops ? (double)ns / (double)ops : 0.0;
+	if (json)
+		printf("{\"op\":\"%s\",\"size\":%zu,\"threads\":%u,\"ops\":%zu,\"ns\":%llu,\"ns_per_op\":%.2f}\n",
+			   op, size, threads, ops, ns, per);
+	else
+		printf("%s,%zu,%u,%zu,%llu,%.2f\n", op, size, threads, ops, ns, per);
+	fflush(stdout);
+}
+
+/* Values are tagged integers in a non-owning map, so the numbers measure
+   the map and not the allocator. */
+static void *value(size_t i) {
+	return (void *)(uintptr_t)(i + 1);
+}
+
+static void fill(xmap_t *xm, size_t n) {
+	for (size_t i = 0; i < n; i++) xmap_insert(xm, value(i));
+}
+
+static void fill_strings(xmap_t *xm, size_t n) {
+	char buf[32];
+	for (size_t i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "key-%zu", i);
+		xmap_strinsert(xm, buf);
+	}
+}
+
+/* Pseudo-random index sequence, the same for every run */
+static std::vector<size_t> indices(size_t n, size_t count) {
+	std::vector<size_t> v(count);
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	for (size_t i = 0; i < count; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		v[i] = (size_t)(x % n);
+	}
+	return v;
+}
+
+static volatile uintptr_t sink;
+
+static void bench_insert(size_t n, unsigned flags, const char *op) {
+	unsigned long long best = ~0ULL;
+	for (unsigned r = 0; r < reps; r++) {
+		xmap_t xm;
+		xmap_init_flags(&xm, XMAP_NONOWNING | flags);
+		bench_clock::time_point t0 = bench_clock::now();
+		fill(&xm, n);
+		best = std::min(best, elapsed_ns(t0));
+		xmap_destroy(&xm);
+	}
+	report(op, n, 1, n, best);
+}
+
+static void bench_get(size_t n, unsigned flags, const char *op) {
+	xmap_t xm;
+	xmap_init_flags(&xm, XMAP_NONOWNING | flags);
+	fill(&xm, n);
+	std::vector<size_t> idx = indices(n, n);
+	unsigned long long best = ~0ULL;
+	for (unsigned r = 0; r < reps; r++) {
+		uintptr_t acc = 0;
+		bench_clock::time_point t0 = bench_clock::now();
+		for (size_t i = 0; i < n; i++) acc += (uintptr_t)xmap_get(&xm, idx[i]);
+		best = std::min(best, elapsed_ns(t0));
+		sink = acc;
+	}
+	report(op, n, 1, n, best);
+	xmap_destroy(&xm);
+}
+
+static void bench_strings(size_t n) {
+	unsigned long long best_insert = ~0ULL, best_get = ~0ULL, best_destroy = ~0ULL;
+	std::vector<size_t> idx = indices(n, n);
+	for (unsigned r = 0; r < reps; r++) {
+		xmap_t xm;
+		xmap_init(&xm);
+		bench_clock::time_point t0 = bench_clock::now();
+		fill_strings(&xm, n);
+		best_insert = std::min(best_insert, elapsed_ns(t0));
+
+		uintptr_t acc = 0;
+		t0 = bench_clock::now();
+		for (size_t i = 0; i < n; i++) acc += (uintptr_t)xmap_strget(&xm, idx[i])[4];
+		best_get = std::min(best_get, elapsed_ns(t0));
+		sink = acc;
+
+		t0 = bench_clock::now();
+		xmap_destroy(&xm);
+		best_destroy = std::min(best_destroy, elapsed_ns(t0));
+	}
+	report("strinsert", n, 1, n, best_insert);
+	report("strget", n, 1, n, best_get);
+	report("destroy", n, 1, n, best_destroy);
+}
+
+/* Shifting erases from the middle move n/2 slots each */
+static void bench_erase(size_t n) {
+	size_t ops = std::min(n / 2, (size_t)SHIFT_OPS);
+	unsigned long long best = ~0ULL;
+	for (unsigned r = 0; r < reps; r++) {
+		xmap_t xm;
+		xmap_init_flags(&xm, XMAP_NONOWNING);
+		fill(&xm, n);
+		bench_clock::time_point t0 = bench_clock::now();
+		for (size_t i = 0; i < ops; i++) xmap_erase(&xm, (n - i) / 2);
+		best = std::min(best, elapsed_ns(t0));
+		xmap_destroy(&xm);
+	}
+	report("erase", n, 1, ops, best);
+}
+
+static void bench_erase_no_shift(size_t n) {
+	std::vector<size_t> idx = indices(n, n);
+	unsigned long long best = ~0ULL;
+	for (unsigned r = 0; r < reps; r++) {
+		xmap_t xm;
+		xmap_init_flags(&xm, XMAP_NONOWNING);
+		fill(&xm, n);
+		bench_clock::time_point t0 = bench_clock::now();
+		for (size_t i = 0; i < n; i++) xmap_erase_no_shift(&xm, idx[i]);
+		best = std::min(best, elapsed_ns(t0));
+		xmap_destroy(&xm);
+	}
+	report("erase_no_shift", n, 1, n, best);
+}
+
+typedef struct {
+	xmap_t *xm;
+	size_t n;
+	size_t seed;
+} mixed_arg_t;
+
+/* 90% gets, 5% inserts, 5% no-shift erases */
+static void *mixed_worker(void *p) {
+	mixed_arg_t *a = (mixed_arg_t *)p;
+	uint64_t x = 0x9e3779b97f4a7c15ULL * (a->seed + 1);
+	uintptr_t acc = 0;
+	for (size_t i = 0; i < MIXED_OPS; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		size_t k = (size_t)(x % a->n);
+		unsigned op = (unsigned)(x >> 32) % 20;
+		if (op == 0) xmap_insert(a->xm, value(k));
+		else if (op == 1) xmap_erase_no_shift(a->xm, k);
+		else acc += (uintptr_t)xmap_get(a->xm, k);
+	}
+	sink = acc;
+	return NULL;
+}
+
+static void bench_mixed(size_t n, unsigned threads, unsigned flags, const char *op) {
+	unsigned long long best = ~0ULL;
+	std::vector<pthread_t> tid(threads);
+	std::vector<mixed_arg_t> args(threads);
+	for (unsigned r = 0; r < reps; r++) {
+		xmap_t xm;
+		xmap_init_flags(&xm, XMAP_NONOWNING | flags);
+		fill(&xm, n);
+		bench_clock::time_point t0 = bench_clock::now();
+		for (unsigned t = 0; t < threads; t++) {
+			args[t].xm = &xm;
+			args[t].n = n;
+			args[t].seed = t;
+			pthread_create(&tid[t], NULL, mixed_worker, &args[t]);
+		}
+		for (unsigned t = 0; t < threads; t++) pthread_join(tid[t], NULL);
+		best = std::min(best, elapsed_ns(t0));
+		xmap_destroy(&xm);
+	}
+	report(op, n, threads, (size_t)threads * MIXED_OPS, best);
+}
+
+static size_t parse_size(const char *s) {
+	/* accepts 1e7 as well as 10000000 */
+	return (size_t)strtod(s, NULL);
+}
+
+int main(int argc, char **argv) {
+	size_t min = 1000, max = 10000000;
+	unsigned threads = 4;
+	for (int i = 1; i < argc; i++) {
+		std::string a = argv[i];
+		if (a == "--json") json = 1;
+		else if (a == "--min" && i + 1 < argc) min = parse_size(argv[++i]);
+		else if (a == "--max" && i + 1 < argc) max = parse_size(argv[++i]);
+		else if (a == "--threads" && i + 1 < argc) threads = (unsigned)atoi(argv[++i]);
+		else if (a == "--reps" && i + 1 < argc) reps = (unsigned)atoi(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--min N] [--max N] [--threads N] [--reps N] [--json]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (min == 0 || max < min || threads == 0 || reps == 0) {
+		fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+		return 2;
+	}
+
+	if (!json) printf("op,size,threads,ops,ns,ns_per_op\n");
+	for (size_t n = min; n <= max; n *= 10) {
+		bench_insert(n, 0, "insert");
+		bench_insert(n, XMAP_SINGLE, "insert_single");
+		bench_get(n, 0, "get");
+		bench_get(n, XMAP_SINGLE, "get_single");
+		bench_strings(n);
+		bench_erase(n);
+		bench_erase_no_shift(n);
+		bench_mixed(n, threads, 0, "mixed");
+		bench_mixed(n, threads, XMAP_READMOSTLY, "mixed_readmostly");
+		if (n > max / 10) break;
+	}
+	return 0;
+}
@@ -28,10 +28,120 @@
 
 #ifdef __cplusplus
 #include <string>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <string_view>
 #endif
+#endif
+
+/* Key kinds for slots of the hashed (associative) store */
+#define XMAP_KEY_EMPTY  0
+#define XMAP_KEY_INT    1
+#define XMAP_KEY_STR    2
+#define XMAP_KEY_WCS    3
+#define XMAP_KEY_DEAD   4 /* tombstone left behind by a removal */
+
+/* Positional entry tags (xmap_t.tags): the entry type in the low two bits,
+   the inline, shared and dead bits, and for strings and binary entries
+   the length above */
+#define XMAP_ENTRY_VALUE    0 /* caller-supplied pointer */
+#define XMAP_ENTRY_STR      1 /* char* copy listed in str */
+#define XMAP_ENTRY_WCS      2 /* wchar_t* copy listed in wstr */
+#define XMAP_ENTRY_MEM      3 /* binary copy, length in the tag (xmap_meminsert) */
+#define XMAP_ENTRY_INLINE   4 /* string stored in the slot's cell (XMAP_INLINE) */
+#define XMAP_ENTRY_SHARED   8 /* copy owned by the arena or a loaded image, never released per slot */
+#define XMAP_ENTRY_DEAD     16 /* tombstone left by a _no_shift erase (xmap_compact drops it) */
+#define XMAP_ENTRY_NOLEN    (SIZE_MAX >> 5) /* length not measured yet */
+#define XMAP_ENTRY_TAG(type,len)    (((size_t)(len) << 5) | (size_t)(type))
+#define XMAP_ENTRY_TYPE(tag)        ((int)((tag) & 3))
+#define XMAP_ENTRY_LEN(tag)         ((size_t)(tag) >> 5)
+
+/* Inline string cell, one per map slot in XMAP_INLINE maps */
+#define XMAP_INLINE_SIZE    24
+typedef union {
+    char str[XMAP_INLINE_SIZE];
+    wchar_t wcs[XMAP_INLINE_SIZE / sizeof(wchar_t)];
+} xmap_cell_t;
+
+typedef struct {
+    size_t hash;
+    int kind;
+    uintptr_t ikey; /* integer key (XMAP_KEY_INT) */
+    void *pkey; /* owned char* / wchar_t* copy (XMAP_KEY_STR/WCS) */
+    void *value;
+} xmap_slot_t;
+
+/* Open-addressing hash table (linear probing, power-of-two capacity) */
+typedef struct {
+    xmap_slot_t *slots;
+    size_t count; /* live keys */
+    size_t used; /* live keys + tombstones */
+    size_t capacity;
+} xmap_hash_t;
+
+/* Map flags (xmap_init_flags) */
+#define XMAP_READMOSTLY 0x1u /* lock-free positional reads (seqlock); writers still lock */
+#define XMAP_ARENA      0x2u /* string copies are bump-allocated from map-owned chunks */
+#define XMAP_INTERN     0x4u /* string inserts share one copy per distinct string */
+#define XMAP_NONOWNING  0x8u /* erase/destroy never release stored values */
+#define XMAP_INLINE     0x10u /* short strings live in per-slot cells (not with XMAP_READMOSTLY) */
+#define XMAP_STATS      0x20u /* count lock contention, resizes and shifts (xmap_stats) */
+#define XMAP_SINGLE     0x40u /* thread-confined: no operation takes the mutex */
+
+/* Element allocator (xmap_init_alloc): serves the string and key copies
+   the map makes and its arena chunks, and releases stored values when no
+   destructor is set. NULL callbacks fall back to malloc()/free(). */
+typedef struct {
+    void *(*allocate)(size_t size, void *ctx);
+    void (*deallocate)(void *ptr, void *ctx);
+    void *ctx;
+} xmap_allocator_t;
+
+/* Value destructor: called instead of free() for every stored value */
+typedef void (*xmap_dtor_t)(void *data, void *ctx);
+
+/* Arrays replaced while lock-free readers may still be looking at them,
+   and element releases postponed while views are open */
+typedef struct xmap_retired {
+    struct xmap_retired *next;
+    void *ptr;
+    int value; /* deferred element: 1 = stored value, 0 = string copy */
+} xmap_retired_t;
+
+/* Ordered index over one string list: string indices sorted by string */
+typedef struct {
+    size_t *idx;
+    size_t count; /* indexed entries */
+    size_t capacity;
+    size_t covered; /* list entries already merged in; the rest are pending */
+} xmap_order_t;
+
+/* Operation counters of an XMAP_STATS map (xmap_stats). Updated under
+   the mutex; lock-free reads are not counted. */
+typedef struct {
+    unsigned long long locks; /* mutex acquisitions */
+    unsigned long long contended; /* acquisitions that found the mutex held */
+    unsigned long long wait_ns; /* time spent waiting for the mutex */
+    unsigned long long reallocs; /* map and str/wstr array resizes */
+    unsigned long long bytes_moved; /* bytes copied by resizes that moved */
+    unsigned long long erases; /* shifting erases */
+    unsigned long long shifted; /* slots moved left by shifting erases */
+} xmap_stats_t;
+
+/* Arena chunk header; string data follows it */
+typedef struct xmap_chunk {
+    struct xmap_chunk *next;
+    size_t size; /* usable bytes after the header */
+    size_t used;
+} xmap_chunk_t;
 
 typedef struct {
     void **map;
+    size_t *tags; /* XMAP_ENTRY_TAG per map slot (mutex only) */
+    xmap_cell_t *cells; /* inline strings per map slot (XMAP_INLINE) */
     size_t count;
     size_t capacity;
 
@@ -44,9 +154,199 @@ typedef struct {
     size_t cwstr;
     size_t cwstr_capacity;
 
+    size_t dead; /* XMAP_ENTRY_DEAD (erased, not shifted) slots in map[0..count) */
+
+    xmap_order_t order; /* sorted view of str (built on first query) */
+    xmap_order_t worder; /* sorted view of wstr */
+
+    xmap_hash_t hash; /* keyed entries (xmap_put/xmap_find/xmap_remove) */
+    xmap_hash_t intern; /* interned strings (keys live in the arena) */
+
+    unsigned flags;
+    unsigned growth; /* capacity growth in percent, 0 = double (xmap_set_growth) */
+    unsigned long seq; /* odd while a writer is modifying (XMAP_READMOSTLY) */
+    xmap_retired_t *retired; /* freed on xmap_reclaim()/xmap_destroy() */
+    size_t views; /* open xmap_view_t snapshots, leases and xmap_snapshot_t */
+    struct xmap_snapshot *snapshots; /* open copy-on-write snapshots */
+    xmap_retired_t *deferred; /* element releases waiting for views to close */
+    xmap_chunk_t *arena; /* current chunk first (XMAP_ARENA) */
+
+    void *mapped; /* xmap_load() image; its strings are never freed */
+    size_t mapped_size;
+
+    xmap_allocator_t allocator;
+    xmap_dtor_t dtor; /* releases values instead of the allocator */
+    void *dtor_ctx;
+
+    xmap_stats_t stats; /* XMAP_STATS only */
+
     pthread_mutex_t mutex;
 } xmap_t;
 
+/* Stable snapshot of the live positional entries (xmap_view_begin).
+   While any view is open, erased elements are released only once the
+   last view ends, so every pointer in `items' stays valid. Inline
+   strings, which move with their slots, are copied into cells kept in
+   the same block as `items'. */
+typedef struct {
+    xmap_t *xm;
+    void **items; /* non-NULL entries in map order */
+    size_t count;
+} xmap_view_t;
+
+#define XMAP_PAGE_SHIFT 9
+#define XMAP_PAGE_SLOTS ((size_t)1 << XMAP_PAGE_SHIFT) /* map slots per copy-on-write page */
+
+/* Map slots [k << XMAP_PAGE_SHIFT, ...) as they were before a writer
+   (or a snapshot reader) first touched them; shared by every snapshot
+   that still saw the live slots at that moment. Immutable once made. */
+typedef struct {
+    size_t refs;
+    void *map[XMAP_PAGE_SLOTS];
+    size_t tags[XMAP_PAGE_SLOTS];
+    xmap_cell_t *cells; /* inline strings (XMAP_INLINE maps only) */
+} xmap_page_t;
+
+/* Copy-on-write snapshot of the positional entries (xmap_snapshot).
+   pages[k] is NULL while page k of the live map is unchanged since the
+   snapshot was taken, and the preserved page afterwards. */
+typedef struct xmap_snapshot {
+    xmap_t *xm;
+    size_t count; /* map entries when taken */
+    xmap_page_t **pages; /* one per XMAP_PAGE_SLOTS slots of count */
+    int error; /* ENOMEM once a page could not be preserved */
+    struct xmap_snapshot *next; /* open snapshots of xm */
+    struct xmap_snapshot *prev;
+} xmap_snapshot_t;
+
+/* Pinned string (xmap_lease_str): `str' holds `len' characters plus the
+   terminator and stays readable until xmap_lease_end(), like the entries
+   of an open view. Inline strings are copied into `buf', so a lease must
+   not be copied while it is open. */
+typedef struct {
+    xmap_t *xm; /* NULL unless the lease holds a view */
+    const void *str;
+    size_t len; /* characters, without the terminator */
+    xmap_cell_t buf;
+} xmap_lease_t;
+
+/* One worker's chunk of a parallel pass (xmap_parallel_foreach/_reduce) */
+typedef struct {
+    void **items;
+    size_t count;
+    void (*fn)(void *data, void *arg);
+    void (*reduce)(void *data, void *acc, void *arg);
+    void *acc;
+    void *arg;
+} xmap_task_t;
+
+/* Image file header (xmap_save/xmap_load), followed by uint64_t offsets
+   [count], str[cstr], wstr[cwstr] and a blob of blob_size bytes. A
+   tombstoned string slot is kept, with offset XMAP_IMAGE_DEAD, so string
+   indices survive a save and load. */
+#define XMAP_IMAGE_MAGIC "XMAPIMG1"
+#define XMAP_IMAGE_DEAD UINT64_MAX
+typedef struct {
+    char magic[8];
+    uint32_t wchar_size;
+    uint32_t reserved;
+    uint64_t count; /* entries, all strings or their tombstones, in map order */
+    uint64_t cstr;
+    uint64_t cwstr;
+    uint64_t blob_size;
+} xmap_image_header_t;
+
+/* Smallest chunk handed to a separate thread by the parallel passes */
+#ifndef XMAP_PARALLEL_MIN
+#define XMAP_PARALLEL_MIN 4096
+#endif
+
+/* Sharded map: independently locked shards, padded so that neighbouring
+   shards never share a cache line */
+typedef struct {
+    xmap_t xm;
+    unsigned char pad[64];
+} xmap_shard_t;
+
+typedef struct {
+    xmap_shard_t *shards;
+    size_t nshards; /* power of two */
+} xmap_sharded_t;
+
+/* Resident entry of a bounded cache. `pkey' is the key copy owned by the
+   key table slot, kept here to find that slot again on eviction. */
+typedef struct {
+    void *value;
+    void *pkey;
+    uintptr_t ikey;
+    size_t hash;
+    size_t size; /* bytes charged against max_bytes */
+    int kind; /* XMAP_KEY_STR or XMAP_KEY_INT */
+    int ref; /* CLOCK reference bit, set on every hit */
+} xmap_cache_entry_t;
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} xmap_cache_stats_t;
+
+/* Bounded cache with CLOCK eviction (xmap_cache_init). The embedded map
+   supplies the mutex, the allocator and destructor, and the key table,
+   whose slot values are entry indices + 1. Entries are kept dense. */
+typedef struct {
+    xmap_t xm;
+    xmap_cache_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    size_t hand; /* next entry the CLOCK sweep looks at */
+    size_t bytes;
+    size_t max_entries; /* 0 = unlimited */
+    size_t max_bytes; /* 0 = unlimited */
+    xmap_cache_stats_t stats;
+} xmap_cache_t;
+
+#define XMAP_TTL_BITS   6
+#define XMAP_TTL_SLOTS  (1 << XMAP_TTL_BITS) /* slots per wheel level */
+#define XMAP_TTL_LEVELS 4 /* level k slots span 64^k ticks; 64^4 ticks in all */
+#define XMAP_TTL_NONE   ((size_t)-1) /* end of a slot list */
+#define XMAP_TTL_UNARMED    (~0u) /* node slot: no timer */
+
+/* Timer of the entry at the same map index, linked into one wheel slot */
+typedef struct {
+    uint64_t expires;
+    size_t next;
+    size_t prev;
+    unsigned slot; /* level * XMAP_TTL_SLOTS + slot, or XMAP_TTL_UNARMED */
+    size_t gen; /* bumped each time the index is retired */
+} xmap_ttl_node_t;
+
+/* Handle of an expiring entry (xmap_ttl_insert): its map index and the
+   generation of that index, so a handle to an expired or erased entry
+   never reaches the entry that reuses the index */
+typedef struct {
+    size_t index; /* XMAP_TTL_NONE if the insert failed */
+    size_t gen;
+} xmap_ttl_id_t;
+
+/* Expiring map (xmap_ttl_init): positional entries with a deadline, kept
+   in a hierarchical timer wheel. Level 0 holds timers due in the next 64
+   ticks, one slot per tick; each higher level slot covers a whole turn
+   of the level below and is cascaded into it when that turn starts.
+   Indices of expired and erased entries are reused by later inserts, so
+   memory follows the live set rather than the total inserted; handles
+   carry a generation that tells them apart. */
+typedef struct {
+    xmap_t xm;
+    xmap_ttl_node_t *nodes; /* parallel to xm.map */
+    size_t capacity;
+    size_t pending; /* armed timers */
+    size_t spare; /* tombstoned indices, linked through nodes[].next */
+    uint64_t now; /* next tick xmap_ttl_expire() processes */
+    uint64_t occupied[XMAP_TTL_LEVELS]; /* bit s: slot s of that level is not empty */
+    size_t heads[XMAP_TTL_LEVELS * XMAP_TTL_SLOTS];
+} xmap_ttl_t;
+
 /* Types for `void *' pointers.  */
 #define xmap_intptr(p)      ((intptr_t)(p))
 #define xmap_uintptr(p)     ((uintptr_t)(p))
@@ -78,6 +378,114 @@ extern "C" {
 /* Initialize */
 XSTDDEF_IMPORT_API void xmap_init(xmap_t *xm);
 
+/* Initialize with flags, an element allocator and a value destructor.
+   Either may be NULL. With a destructor, every stored value (not the
+   string copies the map makes itself) is passed to dtor(data, dtor_ctx)
+   on erase, replace and destroy instead of being freed; XMAP_NONOWNING
+   skips releasing values altogether. */
+XSTDDEF_IMPORT_API void xmap_init_alloc(xmap_t *xm, unsigned flags, const xmap_allocator_t *allocator, xmap_dtor_t dtor, void *dtor_ctx);
+
+/* Helpers: element memory through the map's allocator. The allocator is
+   fixed at init, so these need no lock. */
+XSTDDEF_IMPORT_API void* xmap_elem_alloc(xmap_t *xm, size_t size);
+
+XSTDDEF_IMPORT_API void xmap_elem_free(xmap_t *xm, void *ptr);
+
+XSTDDEF_IMPORT_API void* xmap_elem_dup(xmap_t *xm, const void *src, size_t size);
+
+/* Initialize with flags (XMAP_READMOSTLY, ...) */
+XSTDDEF_IMPORT_API void xmap_init_flags(xmap_t *xm, unsigned flags);
+
+/* Helper: monotonic clock in nanoseconds (XMAP_STATS wait times) */
+XSTDDEF_IMPORT_API unsigned long long xmap_now_ns(void);
+
+/* Take the mutex. XMAP_SINGLE maps skip it, but still count the elided
+   acquisition under XMAP_STATS; XMAP_STATS maps try it first and time
+   the wait when another thread holds it. */
+XSTDDEF_IMPORT_API void xmap_mutex_lock(xmap_t *xm);
+XSTDDEF_IMPORT_API void xmap_mutex_unlock(xmap_t *xm);
+
+/* Writer lock: takes the mutex and, in XMAP_READMOSTLY mode, makes the
+   sequence counter odd so lock-free readers retry until xmap_unlock(). */
+XSTDDEF_IMPORT_API void xmap_lock(xmap_t *xm);
+XSTDDEF_IMPORT_API void xmap_unlock(xmap_t *xm);
+
+/* Lock-free read section (XMAP_READMOSTLY): returns an even sequence
+   number to pass to xmap_read_retry() once the reads are done. */
+XSTDDEF_IMPORT_API unsigned long xmap_read_begin(xmap_t *xm);
+XSTDDEF_IMPORT_API int xmap_read_retry(xmap_t *xm, unsigned long s);
+
+/* Store to a map slot, list entry or count that lock-free readers load
+   (caller inside the write section). Relaxed is enough: the sequence
+   counter orders the section as a whole, the atomic just keeps each
+   store race-free. */
+#define xmap_store(lhs,v)   __atomic_store_n(&(lhs), (v), __ATOMIC_RELAXED)
+
+/* Helpers: memmove() for the map slots and the str/wstr indices. In
+   XMAP_READMOSTLY mode each element is copied with xmap_store(), lowest
+   first, so `dst' must lie below `src' or not overlap it. */
+XSTDDEF_IMPORT_API void xmap_move_slots_nolock(xmap_t *xm, void **dst, void *const *src, size_t n);
+XSTDDEF_IMPORT_API void xmap_move_indices_nolock(xmap_t *xm, size_t *dst, const size_t *src, size_t n);
+
+/* Helper: defer freeing an array until no lock-free reader can see it
+   (caller must hold mutex). Returns 1 on success, 0 on failure. */
+XSTDDEF_IMPORT_API int xmap_retire_nolock(xmap_t *xm, void *ptr);
+
+/* Helper: resize an internal array (caller must hold mutex). In
+   XMAP_READMOSTLY mode the old block is retired instead of freed. */
+XSTDDEF_IMPORT_API void* xmap_resize_nolock(xmap_t *xm, void *ptr, size_t oldsize, size_t newsize);
+
+/* Free retired arrays (thread-safe). The caller guarantees that no
+   lock-free reader is still running against this map. */
+XSTDDEF_IMPORT_API void xmap_reclaim(xmap_t *xm);
+
+/* Helper: next capacity >= mincap under the map's growth policy. Empty
+   arrays start at 4 slots; each step grows by xm->growth percent. */
+XSTDDEF_IMPORT_API size_t xmap_grow_capacity(xmap_t *xm, size_t cap, size_t mincap);
+
+/* Helper: drop an internal array (caller must hold mutex). In
+   XMAP_READMOSTLY mode the block is retired instead of freed. */
+XSTDDEF_IMPORT_API int xmap_drop_array_nolock(xmap_t *xm, void *ptr);
+
+/* Helper: point the inline slots of map[from..count) back at their cells
+   after the cell array moved or slots shifted (caller must hold mutex) */
+XSTDDEF_IMPORT_API void xmap_cells_repoint_nolock(xmap_t *xm, size_t from);
+
+/* Helper: resize the inline cell array of an XMAP_INLINE map to `newcap'
+   cells (caller must hold mutex). Returns 1 on success. */
+XSTDDEF_IMPORT_API int xmap_cells_resize_nolock(xmap_t *xm, size_t newcap);
+
+/* Helper: count one map or list resize (XMAP_STATS, caller must hold
+   mutex). `bytes' of old contents were copied if the array moved. */
+XSTDDEF_IMPORT_API void xmap_stats_resize_nolock(xmap_t *xm, const void *from, const void *to, size_t bytes);
+
+/* Helper: set map capacity to exactly `newcap' >= count slots (caller
+   must hold mutex). Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_set_capacity_nolock(xmap_t *xm, size_t newcap);
+
+/* Helper: set str (wide == 0) or wstr (wide != 0) list capacity to
+   exactly `newcap' (caller must hold mutex). Returns 1 on success. */
+XSTDDEF_IMPORT_API int xmap_set_list_capacity_locked(xmap_t *xm, int wide, size_t newcap);
+
+/* Helper: copy live page `k' of the map into a new page (caller must
+   hold mutex). Slots past count are left unset; no snapshot reads them.
+   Inline entries point into the page's own cells. Returns NULL on
+   failure. */
+XSTDDEF_IMPORT_API xmap_page_t* xmap_page_copy_nolock(xmap_t *xm, size_t k);
+
+/* Helper: drop a snapshot's reference to a page (caller must hold mutex) */
+XSTDDEF_IMPORT_API void xmap_page_unref_nolock(xmap_page_t *page);
+
+/* Helper: give every open snapshot that still reads page `k' from the
+   live map one shared copy of it (caller must hold mutex). The live
+   page is unchanged since each of those snapshots was taken, so one
+   copy serves them all. A failed copy marks them ENOMEM. */
+XSTDDEF_IMPORT_API void xmap_snapshot_preserve_nolock(xmap_t *xm, size_t k);
+
+/* Helper: copy-on-write hook, called before map slots [first, end) are
+   changed (caller must hold mutex). Free unless a snapshot is open. */
+XSTDDEF_IMPORT_API void xmap_cow_nolock(xmap_t *xm, size_t first, size_t end);
+
 /* Helper: ensure map capacity (holds/assumes caller has not locked mutex:
    this routine will not lock. Returns 1 on success, 0 on failure).
    It updates xm->map and xm->capacity atomically (no mutex) — caller
@@ -90,6 +498,117 @@ XSTDDEF_IMPORT_API int xmap_ensure_str_capacity_locked(xmap_t *xm, size_t mincap
 
 XSTDDEF_IMPORT_API int xmap_ensure_wstr_capacity_locked(xmap_t *xm, size_t mincap);
 
+/* Set the growth factor in percent used when an array runs out of room
+   (thread-safe). 0 restores the default of 200 (doubling); other values
+   must exceed 100. Returns 1 on success, 0 on EINVAL. */
+XSTDDEF_IMPORT_API int xmap_set_growth(xmap_t *xm, unsigned percent);
+
+/* Pre-size the map and the str/wstr lists for at least the given number
+   of entries (thread-safe). Never shrinks. Returns 1 on success, 0 on
+   failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_reserve(xmap_t *xm, size_t entries, size_t strs, size_t wstrs);
+
+/* Hash functions for the keyed store (FNV-1a / splitmix finalizer) */
+XSTDDEF_IMPORT_API size_t xmap_hash_str(const char *key);
+
+XSTDDEF_IMPORT_API size_t xmap_hash_wcs(const wchar_t *key);
+
+XSTDDEF_IMPORT_API size_t xmap_hash_int(uintptr_t key);
+
+/* Helper: locate the slot holding a key (caller must hold mutex).
+   Returns the slot index, or (size_t)-1 if the key is not present. */
+XSTDDEF_IMPORT_API size_t xmap_hash_lookup_locked(xmap_hash_t *h, int kind, size_t hash, uintptr_t ikey, const void *pkey);
+
+/* Helper: rehash into `newcap' slots, a power of two with room for every
+   live key, dropping tombstones (caller must hold mutex). `newcap' 0
+   frees the table. Returns 1 on success, 0 on failure. */
+XSTDDEF_IMPORT_API int xmap_hash_rehash_locked(xmap_hash_t *h, size_t newcap);
+
+/* Helper: make room for `extra' more keys (caller must hold mutex). Grows
+   or rehashes in place to drop tombstones once the table is 3/4 used.
+   Returns 1 on success, 0 on failure. */
+XSTDDEF_IMPORT_API int xmap_hash_reserve_locked(xmap_hash_t *h, size_t extra);
+
+/* Helper: store a key known to be absent into a table that has room
+   (caller must hold mutex and have called xmap_hash_reserve_locked).
+   Reuses the first tombstone on the probe path. */
+XSTDDEF_IMPORT_API void xmap_hash_insert_locked(xmap_hash_t *h, int kind, size_t hash, uintptr_t ikey, void *pkey, void *value);
+
+/* Helper: bump-allocate `size' bytes aligned to `align' from the map's
+   arena (caller must hold mutex). Chunks start at 4 KiB and double up to
+   8 MiB; requests larger than a chunk get a dedicated chunk behind the
+   current one. Returns NULL on failure (errno set). */
+XSTDDEF_IMPORT_API void* xmap_arena_alloc_nolock(xmap_t *xm, size_t size, size_t align);
+
+/* Helper: copy `size' bytes into the arena (caller must hold mutex) */
+XSTDDEF_IMPORT_API void* xmap_arena_dup_nolock(xmap_t *xm, const void *src, size_t size, size_t align);
+
+/* Helper: postpone an element release until the last view ends (caller
+   must hold mutex). On allocation failure the element is leaked rather
+   than freed under a reader. */
+XSTDDEF_IMPORT_API void xmap_defer_nolock(xmap_t *xm, void *ptr, int value);
+
+/* Helper: release a heap string copy made by the map (caller must hold
+   mutex). Arena and image copies are tagged XMAP_ENTRY_SHARED and are
+   reclaimed with their chunk or mapping instead; they never get here. */
+XSTDDEF_IMPORT_API void xmap_release_nolock(xmap_t *xm, void *ptr);
+
+/* Helper: release a caller-supplied value (caller must hold mutex):
+   destructor if set, nothing for XMAP_NONOWNING maps, else the allocator. */
+XSTDDEF_IMPORT_API void xmap_release_value_nolock(xmap_t *xm, void *ptr);
+
+/* Helper: run the releases postponed by open views (caller must hold
+   mutex and no view may be open) */
+XSTDDEF_IMPORT_API void xmap_flush_deferred_nolock(xmap_t *xm);
+
+/* Helper: is map index `i' referenced by the str or wstr list? Read from
+   the slot's tag (caller must hold mutex, i < count). */
+XSTDDEF_IMPORT_API int xmap_is_string_slot_nolock(xmap_t *xm, size_t i);
+
+/* Helper: length in characters of the string in map slot `i', measured
+   once and cached in its tag (caller must hold mutex, slot non-NULL) */
+XSTDDEF_IMPORT_API size_t xmap_entry_len_nolock(xmap_t *xm, size_t i);
+
+/* Helper: position of the first entry of the str (wide == 0) or wstr
+   list whose map index is >= i. Binary search, both lists being sorted
+   by map index (caller must hold mutex). */
+XSTDDEF_IMPORT_API size_t xmap_list_lower_nolock(xmap_t *xm, int wide, size_t i);
+
+/* Helper: does a string of `len' characters of `csize' bytes go in an
+   inline cell? Interned strings never do: their handles are shared. */
+XSTDDEF_IMPORT_API int xmap_inline_fits(xmap_t *xm, size_t len, size_t csize);
+
+/* Helper: copy a string of `size' bytes into the cell of map slot `i'
+   (caller must hold mutex, i < capacity) */
+XSTDDEF_IMPORT_API void* xmap_inline_put_nolock(xmap_t *xm, size_t i, const void *str, size_t size);
+
+/* Helper: release whatever map[i] holds (caller must hold mutex) */
+XSTDDEF_IMPORT_API void xmap_release_slot_nolock(xmap_t *xm, size_t i);
+
+/* Helper: return the interned copy of a string, creating it in the arena
+   if needed (caller must hold mutex). `kind' is XMAP_KEY_STR or
+   XMAP_KEY_WCS and `hash' its xmap_hash_str/xmap_hash_wcs value.
+   Returns NULL on failure (errno set). */
+XSTDDEF_IMPORT_API void* xmap_intern_nolock(xmap_t *xm, int kind, size_t hash, const void *str);
+
+/* Intern a string (thread-safe): returns a stable handle shared by every
+   identical string interned in this map, valid until xmap_destroy(). Two
+   handles are equal iff the strings are equal. Does not add a positional
+   entry. Returns NULL on failure (errno set). */
+XSTDDEF_IMPORT_API const char* xmap_strintern(xmap_t *xm, const char *str);
+
+XSTDDEF_IMPORT_API const wchar_t* xmap_wcsintern(xmap_t *xm, const wchar_t *str);
+
+/* Number of distinct interned strings (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_interncount(xmap_t *xm);
+
+/* Lock-free positional get (XMAP_READMOSTLY maps only) */
+XSTDDEF_IMPORT_API void* xmap_get_lockfree(xmap_t *xm, size_t i);
+
+/* Lock-free get by string-index (XMAP_READMOSTLY maps only).
+   `wide' selects the wstr list instead of the str list. */
+XSTDDEF_IMPORT_API void* xmap_listget_lockfree(xmap_t *xm, int wide, size_t i);
+
 /* Exists? (thread-safe) */
 XSTDDEF_IMPORT_API int xmap_exists(xmap_t *xm, size_t i);
 
@@ -104,24 +623,229 @@ XSTDDEF_IMPORT_API void xmap_insert(xmap_t *xm, void *data);
 /* Non-locking insert (caller must hold mutex) */
 XSTDDEF_IMPORT_API int xmap_insert_nolock(xmap_t *xm, void *data);
 
+/* Helper: copy `len' characters of `csize' bytes from `src' to `dst' and
+   terminate them. Returns dst. */
+XSTDDEF_IMPORT_API void* xmap_termcpy(void *dst, const void *src, size_t len, size_t csize);
+
+/* Helper: append a string entry whose heap, interned or adopted copy is
+   `copy' (NULL for an inline or arena copy of `str', made here). `shared'
+   says the arena owns `copy' (interned). Caller must hold mutex. On
+   failure a heap `copy' is released. Returns 1 on success. */
+XSTDDEF_IMPORT_API int xmap_listinsert_nolock(xmap_t *xm, int wide, const void *str, size_t len, int inl, void *copy, int shared);
+
+/* Helper shared by the string inserts: append the `len' characters of
+   `str' (wchar_t if wide) as a string entry. `str' need not be
+   terminated unless `terminated' says so. `adopt', if not NULL, is a
+   terminated copy of it from the element allocator that the map keeps
+   instead of copying again; it is released on failure. Returns 1 on
+   success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_listinsert_impl(xmap_t *xm, int wide, const void *str, size_t len, int terminated, void *adopt);
+
 /* String Insert data pointer (thread-safe) */
 XSTDDEF_IMPORT_API void xmap_strinsert(xmap_t *xm, const char* str);
 
+/* Length-aware string insert (thread-safe): copies the first `len'
+   characters of `str', which need not be terminated, without measuring
+   it again. Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_strninsert(xmap_t *xm, const char *str, size_t len);
+
+/* Adopting string insert (thread-safe): the map takes over `str', a
+   terminated string of `len' characters allocated with the map's element
+   allocator (malloc() unless xmap_init_alloc() installed one), instead of
+   copying it. Arena and interning maps copy it into the arena and release
+   it. On failure `str' is released too. Returns 1 on success, 0 on
+   failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_stradopt(xmap_t *xm, char *str, size_t len);
+
 /* Non-locking variant: caller must hold mutex */
 XSTDDEF_IMPORT_API int xmap_strinsert_nolock(xmap_t *xm, const char* str);
 
-/* String getter (thread-safe) */
+/* String getter (thread-safe, except for XMAP_INLINE entries: their
+   pointer is into the cell array, which any later write may move or
+   reallocate; use xmap_lease_str() or a view to read those) */
 XSTDDEF_IMPORT_API char* xmap_strget(xmap_t *xm, size_t i);
 
 /* Wchar Insert data pointer (thread-safe) */
 XSTDDEF_IMPORT_API void xmap_wcsinsert(xmap_t *xm, const wchar_t *str);
 
-/* Wchar getter (thread-safe) */
+/* Wide counterparts of xmap_strninsert() and xmap_stradopt() */
+XSTDDEF_IMPORT_API int xmap_wcsninsert(xmap_t *xm, const wchar_t *str, size_t len);
+
+XSTDDEF_IMPORT_API int xmap_wcsadopt(xmap_t *xm, wchar_t *str, size_t len);
+
+/* Wchar getter (thread-safe, except for XMAP_INLINE entries, as for
+   xmap_strget(); use xmap_lease_wcs() or a view to read those) */
 XSTDDEF_IMPORT_API wchar_t* xmap_wcsget(xmap_t *xm, size_t i);
 
-/* Generic get (thread-safe) - avoids nested locking by checking directly */
+/* Helper shared by xmap_strlen/xmap_wcslen */
+XSTDDEF_IMPORT_API size_t xmap_listlen_impl(xmap_t *xm, int wide, size_t i);
+
+/* String length by string-index (thread-safe): the length in characters
+   without the terminator, cached in the entry tag when the string was
+   inserted. Returns (size_t)-1 if there is no such string. */
+XSTDDEF_IMPORT_API size_t xmap_strlen(xmap_t *xm, size_t i);
+
+XSTDDEF_IMPORT_API size_t xmap_wcslen(xmap_t *xm, size_t i);
+
+/* Helper shared by xmap_lease_str/xmap_lease_wcs */
+XSTDDEF_IMPORT_API int xmap_lease_impl(xmap_t *xm, int wide, size_t i, xmap_lease_t *l);
+
+/* Lease string `i' (thread-safe): points l->str at the string and sets
+   l->len to its cached length, without copying it. Erases and
+   replacements postpone releasing it until xmap_lease_end(). Returns 1
+   on success, 0 if there is no such string (errno ENOENT). */
+XSTDDEF_IMPORT_API int xmap_lease_str(xmap_t *xm, size_t i, xmap_lease_t *l);
+
+XSTDDEF_IMPORT_API int xmap_lease_wcs(xmap_t *xm, size_t i, xmap_lease_t *l);
+
+/* End a lease (thread-safe). Safe on a lease that failed. */
+XSTDDEF_IMPORT_API void xmap_lease_end(xmap_lease_t *l);
+
+/* Binary-safe insert (thread-safe): appends a copy of the `len' bytes at
+   `data', embedded NULs included, as a positional entry of type
+   XMAP_ENTRY_MEM with its length in the tag. The copy is followed by a
+   NUL byte that is not counted, so text payloads still read as C strings.
+   Returns the new map index, or (size_t)-1 on failure (errno set). */
+XSTDDEF_IMPORT_API size_t xmap_meminsert(xmap_t *xm, const void *data, size_t len);
+
+/* Binary entry at map index `i' (thread-safe): returns the data and
+   stores its length in *len (if not NULL) in O(1), or returns NULL if
+   slot `i' is missing, erased or not an XMAP_ENTRY_MEM entry. Like
+   xmap_get(), the pointer is valid until the entry is erased; an inline
+   entry's pointer only until the next write (not thread-safe). */
+XSTDDEF_IMPORT_API void* xmap_memget(xmap_t *xm, size_t i, size_t *len);
+
+/* Entry type of map index `i' (thread-safe): XMAP_ENTRY_VALUE,
+   XMAP_ENTRY_STR, XMAP_ENTRY_WCS or XMAP_ENTRY_MEM, or -1 if i >= count.
+   Tombstoned slots keep their type until compaction. */
+XSTDDEF_IMPORT_API int xmap_entry_type(xmap_t *xm, size_t i);
+
+/* Copy the counters of an XMAP_STATS map into *out (thread-safe: taken
+   under the map lock like every other accessor, whose acquisition is
+   itself counted in `locks'). Returns 1 on success, 0 if the map was not
+   initialized with XMAP_STATS (errno EINVAL, *out zeroed). */
+XSTDDEF_IMPORT_API int xmap_stats(xmap_t *xm, xmap_stats_t *out);
+
+/* Zero the counters of an XMAP_STATS map (thread-safe) */
+XSTDDEF_IMPORT_API void xmap_stats_reset(xmap_t *xm);
+
+/* Generic get (thread-safe) - avoids nested locking by checking directly.
+   Not thread-safe for XMAP_INLINE string entries, as for xmap_strget(). */
 XSTDDEF_IMPORT_API void* xmap_get(xmap_t* xm, size_t i);
 
+/* Batch insert (thread-safe): appends `n' pointers with a single lock and
+   at most one reallocation. All-or-nothing: returns n on success, 0 on
+   failure (errno set, map unchanged). */
+XSTDDEF_IMPORT_API size_t xmap_insert_many(xmap_t *xm, void *const *data, size_t n);
+
+/* Helper shared by the batch string inserts. `wide' selects wchar_t
+   strings and the wstr list. Plain maps duplicate every string before
+   taking the lock; arena/intern maps copy under it once capacity for the
+   whole batch has been reserved. Strings that fit an inline cell keep
+   their source pointer in `copies' until they are copied into place. */
+XSTDDEF_IMPORT_API size_t xmap_strinsert_many_impl(xmap_t *xm, int wide, const void *const *strs, size_t n);
+
+/* Batch string inserts (thread-safe): copy every non-NULL string of
+   `strs[0..n)' and append them under a single lock. All-or-nothing:
+   returns the number of strings inserted, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API size_t xmap_strinsert_many(xmap_t *xm, const char *const *strs, size_t n);
+
+XSTDDEF_IMPORT_API size_t xmap_wcsinsert_many(xmap_t *xm, const wchar_t *const *strs, size_t n);
+
+/* Batch get (thread-safe): copies up to `n' pointers starting at map
+   index `first' into `out'. Returns the number of pointers copied. */
+XSTDDEF_IMPORT_API size_t xmap_get_many(xmap_t *xm, size_t first, void **out, size_t n);
+
+/* Open a view (thread-safe): copies the live (non-NULL) positional
+   entries into v->items under the lock, then lets writers proceed. The
+   pointers stay valid until xmap_view_end(), because erases postpone
+   element releases while a view is open. Tombstones are skipped.
+   Returns 1 on success, 0 on failure (errno set, v empty). */
+XSTDDEF_IMPORT_API int xmap_view_begin(xmap_t *xm, xmap_view_t *v);
+
+/* Close a view (thread-safe). The last view to close runs the releases
+   postponed while it was open. */
+XSTDDEF_IMPORT_API void xmap_view_end(xmap_view_t *v);
+
+/* Take a copy-on-write snapshot of the positional entries (thread-safe).
+   Copies no entry: the snapshot shares the live map until a writer is
+   about to change a page of XMAP_PAGE_SLOTS slots, which is then
+   preserved once for every open snapshot. Its only O(n) cost is the
+   directory of count / XMAP_PAGE_SLOTS page pointers, allocated outside
+   the lock, which is held in O(1). Like a view, it postpones
+   element releases until xmap_snapshot_release(). Returns 1 on success,
+   0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_snapshot(xmap_t *xm, xmap_snapshot_t *s);
+
+/* Helper: page holding slot `i' of a snapshot (thread-safe). Preserved
+   pages are read without the lock; a page nobody wrote yet is preserved
+   here, under the lock, for every snapshot that shares it. Returns NULL
+   with errno ENOMEM if the snapshot lost a page. */
+XSTDDEF_IMPORT_API xmap_page_t* xmap_snapshot_page(xmap_snapshot_t *s, size_t i);
+
+/* Entry at map index `i' when the snapshot was taken (thread-safe), or
+   NULL for a tombstone, i >= count or a failed snapshot (errno ENOMEM).
+   The pointer stays valid until xmap_snapshot_release(). */
+XSTDDEF_IMPORT_API void* xmap_snapshot_get(xmap_snapshot_t *s, size_t i);
+
+/* Entry type at map index `i' as for xmap_entry_type(), or -1 */
+XSTDDEF_IMPORT_API int xmap_snapshot_type(xmap_snapshot_t *s, size_t i);
+
+/* Length of the string or binary entry at map index `i' (characters
+   for strings, bytes for XMAP_ENTRY_MEM), 0 for values and tombstones */
+XSTDDEF_IMPORT_API size_t xmap_snapshot_len(xmap_snapshot_t *s, size_t i);
+
+/* Number of map slots the snapshot covers, tombstones included */
+XSTDDEF_IMPORT_API size_t xmap_snapshot_count(xmap_snapshot_t *s);
+
+/* Release a snapshot (thread-safe): drops its pages and, if it was the
+   last view or snapshot, runs the element releases it postponed. Must
+   happen before xmap_destroy(). */
+XSTDDEF_IMPORT_API void xmap_snapshot_release(xmap_snapshot_t *s);
+
+/* Helper: number of online processors (at least 1) */
+XSTDDEF_IMPORT_API size_t xmap_ncpu(void);
+
+/* Helper: one worker's share of a parallel pass */
+XSTDDEF_IMPORT_API void* xmap_parallel_worker(void *p);
+
+/* Helper: split a view into `ntasks' contiguous chunks, one per thread
+   with the caller running the first. Each task must already carry its
+   callback, argument and accumulator. Chunks whose thread cannot be
+   created run inline. */
+XSTDDEF_IMPORT_API void xmap_parallel_run(xmap_view_t *v, xmap_task_t *tasks, size_t ntasks);
+
+/* Helper: worker count for `n' entries. 0 requests one per processor;
+   chunks smaller than XMAP_PARALLEL_MIN entries are not worth a thread. */
+XSTDDEF_IMPORT_API size_t xmap_parallel_threads(size_t nthreads, size_t n);
+
+/* Parallel for-each (thread-safe): calls fn(data, arg) for every live
+   positional entry, splitting a snapshot (xmap_view_begin) of the map
+   into contiguous chunks run on `nthreads' threads (0 = one per
+   processor). fn runs concurrently with itself and with writers, but
+   every entry it sees stays valid for the whole pass.
+   Returns the number of entries visited, or (size_t)-1 on failure. */
+XSTDDEF_IMPORT_API size_t xmap_parallel_foreach(xmap_t *xm, size_t nthreads, void (*fn)(void *data, void *arg), void *arg);
+
+/* Parallel reduce (thread-safe): like xmap_parallel_foreach, but every
+   thread folds its chunk into a private accumulator of `acc_size' bytes
+   with fn(data, acc, arg). Accumulators start as copies of *result, which
+   must hold the identity of `combine'; the partials are then merged into
+   *result in chunk order with combine(result, partial, arg).
+   Returns the number of entries visited, or (size_t)-1 on failure. */
+XSTDDEF_IMPORT_API size_t xmap_parallel_reduce(xmap_t *xm, size_t nthreads, void *result, size_t acc_size,
+    void (*fn)(void *data, void *acc, void *arg),
+    void (*combine)(void *result, const void *partial, void *arg), void *arg);
+
+/* Helper: drop the ordered index of the str (wide == 0) or wstr list
+   after its string indices changed; the next query rebuilds it */
+XSTDDEF_IMPORT_API void xmap_order_reset_nolock(xmap_t *xm, int wide);
+
+/* Helper: drop map slot `i' (already released) and shift the slots after
+   it left (caller must hold mutex). The slot's tag tells which list, if
+   any, references it; only the tail of each list past `i' is renumbered. */
+XSTDDEF_IMPORT_API void xmap_shift_out_nolock(xmap_t *xm, size_t i);
+
 /* Erase entry and shift (thread-safe). Frees stored pointer. */
 XSTDDEF_IMPORT_API void xmap_erase(xmap_t *xm, size_t i);
 
@@ -131,6 +855,10 @@ XSTDDEF_IMPORT_API void xmap_strerase(xmap_t *xm, size_t i);
 /* String erase by string-index (thread-safe): removes mapping and frees stored string, shifts arrays */
 XSTDDEF_IMPORT_API void xmap_wcserase(xmap_t *xm, size_t i);
 
+/* Helper: release live entry `i' and leave a tombstone (caller must hold
+   the writer lock) */
+XSTDDEF_IMPORT_API void xmap_erase_no_shift_nolock(xmap_t *xm, size_t i);
+
 /* Erase entry but do not shift map (thread-safe). Frees pointer and sets slot NULL. */
 XSTDDEF_IMPORT_API void xmap_erase_no_shift(xmap_t *xm, size_t i);
 
@@ -140,24 +868,367 @@ XSTDDEF_IMPORT_API void xmap_strerase_no_shift(xmap_t *xm, size_t i);
 /* Wchar erase no shift (thread-safe) */
 XSTDDEF_IMPORT_API void xmap_wcserase_no_shift(xmap_t *xm, size_t i);
 
+/* Compaction (caller must hold mutex): drops every tombstone (tagged
+   XMAP_ENTRY_DEAD) left by the _no_shift erase variants, keeping NULL
+   values the caller stored, and rebuilds map, str and wstr in one linear
+   pass, the slot tags saying which list a live slot belongs to. Both
+   lists stay sorted by map index because entries are only ever appended
+   and shifting erases preserve order. Map and string indices change;
+   returns the number of slots dropped. */
+XSTDDEF_IMPORT_API size_t xmap_compact_nolock(xmap_t *xm);
+
+/* Compaction (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_compact(xmap_t *xm);
+
+/* Number of tombstoned slots awaiting compaction (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_dead(xmap_t *xm);
+
+/* Give unused capacity back (thread-safe): trims the map and str/wstr
+   lists to their element counts and rehashes the keyed store into the
+   smallest table that holds its keys. Indices do not change; call
+   xmap_compact() first to drop tombstones as well. In XMAP_READMOSTLY
+   mode the old arrays are retired until xmap_reclaim().
+   Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_shrink_to_fit(xmap_t *xm);
+
+/* Helper: string at string-index k of the str (wide == 0) or wstr list */
+XSTDDEF_IMPORT_API const void* xmap_order_str_nolock(xmap_t *xm, int wide, size_t k);
+
+XSTDDEF_IMPORT_API int xmap_order_cmp(int wide, const void *a, const void *b);
+
+/* Helper: stable merge of two sorted runs of string indices into `out' */
+XSTDDEF_IMPORT_API void xmap_order_merge_nolock(xmap_t *xm, int wide, const size_t *a, size_t na, const size_t *b, size_t nb, size_t *out);
+
+/* Helper: bring the ordered index up to date (caller must hold mutex).
+   String indices appended since the last query are merge-sorted on their
+   own and merged into the index in one pass, so steady appends cost
+   O(k log k + n) rather than a full re-sort. Returns 1 on success. */
+XSTDDEF_IMPORT_API int xmap_order_sync_nolock(xmap_t *xm, int wide);
+
+/* Helper: first rank whose string is >= key (caller must hold mutex and
+   have synced the index) */
+XSTDDEF_IMPORT_API size_t xmap_order_lower_nolock(xmap_t *xm, int wide, const void *key);
+
+/* Helper: lower_bound shared by the str and wcs variants (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_order_lower_bound(xmap_t *xm, int wide, const void *key);
+
+/* Helper: prefix range shared by the str and wcs variants (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_order_prefix(xmap_t *xm, int wide, const void *prefix, size_t *first);
+
+/* Helper: rank lookup shared by the str and wcs variants (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_order_rank(xmap_t *xm, int wide, size_t rank);
+
+/* Helper: ordered scan shared by the str (sfn) and wcs (wfn) variants
+   (thread-safe). Exactly one callback is non-NULL. */
+XSTDDEF_IMPORT_API size_t xmap_order_scan(xmap_t *xm, const void *from, int (*sfn)(const char *str, size_t i, void *arg), int (*wfn)(const wchar_t *str, size_t i, void *arg), void *arg);
+
+/* Ordered index over the string entries. It is built on the first query,
+   extended incrementally as strings are appended and rebuilt after
+   string erases or compaction; maps never queried pay nothing. Ranks
+   count positions in ascending strcmp()/wcscmp() order (ties in insertion
+   order) and are valid until the next modification. */
+
+/* First rank whose string is >= key (count of strings if none) */
+XSTDDEF_IMPORT_API size_t xmap_strlower_bound(xmap_t *xm, const char *key);
+
+XSTDDEF_IMPORT_API size_t xmap_wcslower_bound(xmap_t *xm, const wchar_t *key);
+
+/* Number of strings starting with `prefix'; *first receives the rank of
+   the first one (their ranks are contiguous) */
+XSTDDEF_IMPORT_API size_t xmap_strprefix(xmap_t *xm, const char *prefix, size_t *first);
+
+XSTDDEF_IMPORT_API size_t xmap_wcsprefix(xmap_t *xm, const wchar_t *prefix, size_t *first);
+
+/* String index (for xmap_strget) at `rank', or (size_t)-1 */
+XSTDDEF_IMPORT_API size_t xmap_strrank(xmap_t *xm, size_t rank);
+
+XSTDDEF_IMPORT_API size_t xmap_wcsrank(xmap_t *xm, size_t rank);
+
+/* Ordered iteration: calls fn(str, string-index, arg) in ascending order
+   starting at the first string >= from (NULL = from the start), under
+   the lock. fn must not call back into the map; returning non-zero stops
+   the scan. Returns the number of calls. */
+XSTDDEF_IMPORT_API size_t xmap_strscan(xmap_t *xm, const char *from, int (*fn)(const char *str, size_t i, void *arg), void *arg);
+
+XSTDDEF_IMPORT_API size_t xmap_wcsscan(xmap_t *xm, const wchar_t *from, int (*fn)(const wchar_t *str, size_t i, void *arg), void *arg);
+
+/* Keyed-store helpers (caller must hold mutex) */
+XSTDDEF_IMPORT_API int xmap_hash_put_locked(xmap_t *xm, int kind, size_t hash, uintptr_t ikey, const void *pkey, void *value);
+XSTDDEF_IMPORT_API int xmap_hash_remove_locked(xmap_t *xm, int kind, size_t hash, uintptr_t ikey, const void *pkey);
+
+/* Keyed put (thread-safe): associates a copy of `key' with `value'.
+   The map takes ownership of `value' (freed on remove/replace/destroy).
+   Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_put(xmap_t *xm, const char *key, void *value);
+
+/* Keyed lookup (thread-safe): returns the value stored under `key' or NULL */
+XSTDDEF_IMPORT_API void* xmap_find(xmap_t *xm, const char *key);
+
+/* Keyed removal (thread-safe): frees the value. Returns 1 if the key existed. */
+XSTDDEF_IMPORT_API int xmap_remove(xmap_t *xm, const char *key);
+
+/* Wide-string keyed variants (thread-safe) */
+XSTDDEF_IMPORT_API int xmap_wcsput(xmap_t *xm, const wchar_t *key, void *value);
+XSTDDEF_IMPORT_API void* xmap_wcsfind(xmap_t *xm, const wchar_t *key);
+XSTDDEF_IMPORT_API int xmap_wcsremove(xmap_t *xm, const wchar_t *key);
+
+/* Integer keyed variants (thread-safe) */
+XSTDDEF_IMPORT_API int xmap_intput(xmap_t *xm, uintptr_t key, void *value);
+XSTDDEF_IMPORT_API void* xmap_intfind(xmap_t *xm, uintptr_t key);
+XSTDDEF_IMPORT_API int xmap_intremove(xmap_t *xm, uintptr_t key);
+
+/* Number of keyed entries (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_keycount(xmap_t *xm);
+
+/* Helper: map a file read-only. Falls back to reading it into a heap
+   buffer where mmap() is unavailable. Returns NULL on failure (errno set). */
+XSTDDEF_IMPORT_API void* xmap_map_file(const char *path, size_t *size);
+
+XSTDDEF_IMPORT_API void xmap_unmap_file(void *base, size_t size);
+
+/* Helper: write the image of xm's string entries and string tombstones
+   to `f' (caller must hold mutex). `tmp' holds 5 * (cstr + cwstr + 1) 64-bit scratch
+   slots. Returns 1 on success, 0 on failure. */
+XSTDDEF_IMPORT_API int xmap_write_image_nolock(xmap_t *xm, FILE *f, uint64_t *tmp);
+
+/* Save the string entries (thread-safe) as an image for xmap_load():
+   header, entry offsets, the str and wstr lists, then a blob of
+   NUL-terminated strings. Non-string and keyed entries are not saved,
+   so map indices are renumbered; string tombstones are saved as
+   placeholders, so string indices are kept and load as tombstones.
+   Native byte order. Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_save(xmap_t *xm, const char *path);
+
+/* Helper: check that an image's str/wstr lists are strictly increasing,
+   disjoint and cover every entry, and that wide entries are aligned.
+   Tombstone placeholders have no blob bytes. */
+XSTDDEF_IMPORT_API int xmap_image_valid(const xmap_image_header_t *h, const uint64_t *off, const uint64_t *sidx, const uint64_t *widx);
+
+/* Load an image written by xmap_save() (initializes xm). The file is
+   memory-mapped read-only and the strings are served from the mapping
+   without copying: start-up cost is the page faults plus one pass over
+   the offset table. The map stays fully writable; image strings are never
+   freed, and the mapping is released by xmap_destroy(). Returned strings
+   must not be modified. On failure xm is still initialized (and empty).
+   Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_load(xmap_t *xm, const char *path, unsigned flags);
+
 /* Destroy: free elements and arrays (thread-safe). After this call xm is unusable. */
 XSTDDEF_IMPORT_API void xmap_destroy(xmap_t *xm);
 
+/* Initialize a sharded map with `nshards' independently locked shards
+   (rounded up to a power of two; 0 selects 16). Each shard is initialized
+   with `flags'. Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_IMPORT_API int xmap_sharded_init(xmap_sharded_t *xs, size_t nshards, unsigned flags);
+
+/* Shard owning the calling thread (used for positional inserts) */
+XSTDDEF_IMPORT_API xmap_t* xmap_sharded_self(xmap_sharded_t *xs);
+
+/* Shard owning a key hash. The hash is remixed so the shard choice does
+   not correlate with the probe position inside the shard's table. */
+XSTDDEF_IMPORT_API xmap_t* xmap_sharded_keyshard(xmap_sharded_t *xs, size_t hash);
+
+/* Direct access to shard `s' (no locking) */
+XSTDDEF_IMPORT_API xmap_t* xmap_sharded_shard(xmap_sharded_t *xs, size_t s);
+
+/* Positional inserts into the calling thread's shard (thread-safe) */
+XSTDDEF_IMPORT_API void xmap_sharded_insert(xmap_sharded_t *xs, void *data);
+
+XSTDDEF_IMPORT_API void xmap_sharded_strinsert(xmap_sharded_t *xs, const char *str);
+
+XSTDDEF_IMPORT_API void xmap_sharded_wcsinsert(xmap_sharded_t *xs, const wchar_t *str);
+
+/* Keyed operations routed to the shard owning the key (thread-safe) */
+XSTDDEF_IMPORT_API int xmap_sharded_put(xmap_sharded_t *xs, const char *key, void *value);
+
+XSTDDEF_IMPORT_API void* xmap_sharded_find(xmap_sharded_t *xs, const char *key);
+
+XSTDDEF_IMPORT_API int xmap_sharded_remove(xmap_sharded_t *xs, const char *key);
+
+XSTDDEF_IMPORT_API int xmap_sharded_intput(xmap_sharded_t *xs, uintptr_t key, void *value);
+
+XSTDDEF_IMPORT_API void* xmap_sharded_intfind(xmap_sharded_t *xs, uintptr_t key);
+
+XSTDDEF_IMPORT_API int xmap_sharded_intremove(xmap_sharded_t *xs, uintptr_t key);
+
+/* Aggregate sizes (thread-safe; each shard is sampled under its own lock) */
+XSTDDEF_IMPORT_API size_t xmap_sharded_count(xmap_sharded_t *xs);
+
+XSTDDEF_IMPORT_API size_t xmap_sharded_keycount(xmap_sharded_t *xs);
+
+/* Aggregate iteration (thread-safe): calls fn(data, arg) for every
+   non-NULL positional entry, one shard at a time under that shard's lock.
+   Stops early when fn returns non-zero. Returns the number of calls. */
+XSTDDEF_IMPORT_API size_t xmap_sharded_foreach(xmap_sharded_t *xs, int (*fn)(void *data, void *arg), void *arg);
+
+/* Destroy every shard and the shard array (thread-safe per shard) */
+XSTDDEF_IMPORT_API void xmap_sharded_destroy(xmap_sharded_t *xs);
+
+/* Initialize a bounded cache holding at most `max_entries' entries and
+   `max_bytes' bytes of charged size (0 = no limit on that budget; at
+   least one must be set). `flags' may include XMAP_NONOWNING,
+   XMAP_SINGLE and XMAP_STATS; the allocator and destructor work as for
+   xmap_init_alloc() and release evicted values. Returns 1 on success, 0
+   on failure (errno EINVAL). */
+XSTDDEF_IMPORT_API int xmap_cache_init_alloc(xmap_cache_t *c, size_t max_entries, size_t max_bytes, unsigned flags, const xmap_allocator_t *allocator, xmap_dtor_t dtor, void *dtor_ctx);
+
+XSTDDEF_IMPORT_API int xmap_cache_init(xmap_cache_t *c, size_t max_entries, size_t max_bytes, unsigned flags);
+
+/* Helper: key table slot of entry `e' (caller must hold mutex) */
+XSTDDEF_IMPORT_API xmap_slot_t* xmap_cache_slot_nolock(xmap_cache_t *c, xmap_cache_entry_t *e);
+
+/* Helper: drop entry `i' and release its value (caller must hold mutex).
+   The last entry moves into the hole, so eviction never scans. */
+XSTDDEF_IMPORT_API void xmap_cache_unlink_nolock(xmap_cache_t *c, size_t i);
+
+/* Helper: evict one entry with the CLOCK sweep (caller must hold mutex,
+   count > 0). Referenced entries lose their bit and are passed over, so
+   an entry survives as long as it is hit between two sweeps; every
+   entry is looked at at most twice. */
+XSTDDEF_IMPORT_API void xmap_cache_evict_nolock(xmap_cache_t *c);
+
+/* Helper: insert or replace a key charged `size' bytes (caller must hold
+   mutex). Evicts until the new entry fits. Returns 1 on success. */
+XSTDDEF_IMPORT_API int xmap_cache_put_nolock(xmap_cache_t *c, int kind, size_t hash, uintptr_t ikey, const char *pkey, void *value, size_t size);
+
+/* Helper: look a key up and mark it referenced (caller must hold mutex) */
+XSTDDEF_IMPORT_API void* xmap_cache_get_nolock(xmap_cache_t *c, int kind, size_t hash, uintptr_t ikey, const char *pkey);
+
+/* Helper: remove a key and release its value (caller must hold mutex) */
+XSTDDEF_IMPORT_API int xmap_cache_remove_nolock(xmap_cache_t *c, int kind, size_t hash, uintptr_t ikey, const char *pkey);
+
+/* Cache `value' under a copy of `key' (thread-safe), charged `size'
+   bytes against max_bytes. Replaces and releases an older value. Evicts
+   least recently referenced entries (CLOCK) until the new one fits.
+   Returns 1 on success, 0 on failure (errno set: EINVAL if `size' alone
+   exceeds max_bytes); the caller keeps `value' on failure. */
+XSTDDEF_IMPORT_API int xmap_cache_put(xmap_cache_t *c, const char *key, void *value, size_t size);
+
+/* Cached value for `key' (thread-safe), or NULL on a miss. A hit marks
+   the entry referenced in O(1). The value stays valid until it is
+   replaced, removed or evicted. */
+XSTDDEF_IMPORT_API void* xmap_cache_get(xmap_cache_t *c, const char *key);
+
+/* Remove `key' and release its value (thread-safe). Returns 1 if the key
+   was cached. */
+XSTDDEF_IMPORT_API int xmap_cache_remove(xmap_cache_t *c, const char *key);
+
+/* Integer keyed variants (thread-safe) */
+XSTDDEF_IMPORT_API int xmap_cache_intput(xmap_cache_t *c, uintptr_t key, void *value, size_t size);
+
+XSTDDEF_IMPORT_API void* xmap_cache_intget(xmap_cache_t *c, uintptr_t key);
+
+XSTDDEF_IMPORT_API int xmap_cache_intremove(xmap_cache_t *c, uintptr_t key);
+
+/* Number of cached entries and their charged bytes (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_cache_count(xmap_cache_t *c);
+
+XSTDDEF_IMPORT_API size_t xmap_cache_bytes(xmap_cache_t *c);
+
+/* Copy the hit, miss and eviction counters into *out (thread-safe) */
+XSTDDEF_IMPORT_API void xmap_cache_stats(xmap_cache_t *c, xmap_cache_stats_t *out);
+
+/* Destroy: releases every cached value and key, then the embedded map.
+   No thread may be using the cache. */
+XSTDDEF_IMPORT_API void xmap_cache_destroy(xmap_cache_t *c);
+
+/* Initialize an expiring map whose clock starts at tick `now'. Ticks
+   are caller-defined units (seconds, milliseconds, ...), one wheel slot
+   each. `flags' may include XMAP_NONOWNING, XMAP_SINGLE and XMAP_STATS;
+   the allocator and destructor work as for xmap_init_alloc() and release
+   expired values. Returns 1. */
+XSTDDEF_IMPORT_API int xmap_ttl_init_alloc(xmap_ttl_t *t, uint64_t now, unsigned flags, const xmap_allocator_t *allocator, xmap_dtor_t dtor, void *dtor_ctx);
+
+XSTDDEF_IMPORT_API int xmap_ttl_init(xmap_ttl_t *t, uint64_t now, unsigned flags);
+
+/* Helper: arm the timer of entry `i' (caller must hold mutex). Timers
+   already due go to the slot processed next; timers beyond the last
+   level are parked at its far end and re-placed when cascaded. */
+XSTDDEF_IMPORT_API void xmap_ttl_link_nolock(xmap_ttl_t *t, size_t i);
+
+/* Helper: disarm the timer of entry `i' in O(1) (caller must hold mutex) */
+XSTDDEF_IMPORT_API void xmap_ttl_unlink_nolock(xmap_ttl_t *t, size_t i);
+
+/* Helper: at the start of a level 0 turn, move the current slot of each
+   higher level one level down (caller must hold mutex). A level is only
+   cascaded when the one below it starts a turn too. */
+XSTDDEF_IMPORT_API void xmap_ttl_cascade_nolock(xmap_ttl_t *t);
+
+/* Helper: erase entry `i', whose timer is disarmed, and keep its index
+   for the next insert under a new generation (caller must hold the
+   writer lock). The map tags the slot XMAP_ENTRY_DEAD, so liveness does
+   not depend on the value being non-NULL. */
+XSTDDEF_IMPORT_API void xmap_ttl_retire_nolock(xmap_ttl_t *t, size_t i);
+
+/* Helper: erase the entries of level 0 slot `idx', due at tick t->now
+   (caller must hold the writer lock). Returns how many were erased. */
+XSTDDEF_IMPORT_API size_t xmap_ttl_fire_nolock(xmap_ttl_t *t, unsigned idx);
+
+/* Helper: the tick after t->now at which a slot fires or a non-empty
+   slot is cascaded, when level 0 has nothing due in its current turn
+   (caller must hold mutex). Levels with nothing ahead in their turn are
+   skipped whole. */
+XSTDDEF_IMPORT_API uint64_t xmap_ttl_next_nolock(xmap_ttl_t *t);
+
+/* Helper: does `id' name a live entry? (caller must hold mutex) */
+XSTDDEF_IMPORT_API int xmap_ttl_live_nolock(xmap_ttl_t *t, xmap_ttl_id_t id);
+
+/* Helper: grow the timer array to `need' nodes (caller must hold mutex) */
+XSTDDEF_IMPORT_API int xmap_ttl_reserve_nolock(xmap_ttl_t *t, size_t need);
+
+/* Insert `data' expiring at tick `expires' (thread-safe), in the slot of
+   an expired or erased entry if there is one, else appended. Ownership
+   of `data' passes to the map as for xmap_insert(); NULL is a valid
+   value. Returns the entry's handle, whose index is XMAP_TTL_NONE on
+   failure (errno set). */
+XSTDDEF_IMPORT_API xmap_ttl_id_t xmap_ttl_insert(xmap_ttl_t *t, void *data, uint64_t expires);
+
+/* Value of the entry `id' names (thread-safe), NULL once it has expired
+   or been erased */
+XSTDDEF_IMPORT_API void* xmap_ttl_get(xmap_ttl_t *t, xmap_ttl_id_t id);
+
+/* Move the deadline of a live entry to `expires' in O(1) (thread-safe).
+   Returns 1, or 0 if the entry is gone (its index may have been reused). */
+XSTDDEF_IMPORT_API int xmap_ttl_touch(xmap_ttl_t *t, xmap_ttl_id_t id, uint64_t expires);
+
+/* Erase an entry before its deadline (thread-safe): disarms the timer,
+   releases the value and frees the index. Returns 1, or 0 if the entry
+   is already gone. */
+XSTDDEF_IMPORT_API int xmap_ttl_erase(xmap_ttl_t *t, xmap_ttl_id_t id);
+
+/* Advance the clock to tick `now' and erase every entry due at or before
+   it (thread-safe), releasing values as xmap_erase_no_shift() does.
+   Empty slots are skipped with bit scans, so the cost is the expirations
+   plus the cascades of non-empty slots, not a pass over the map.
+   Returns how many entries expired. */
+XSTDDEF_IMPORT_API size_t xmap_ttl_expire(xmap_ttl_t *t, uint64_t now);
+
+/* Number of entries waiting to expire (thread-safe) */
+XSTDDEF_IMPORT_API size_t xmap_ttl_pending(xmap_ttl_t *t);
+
+/* Destroy: releases every remaining value, the timers and the map. No
+   thread may be using the map. */
+XSTDDEF_IMPORT_API void xmap_ttl_destroy(xmap_ttl_t *t);
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef __cplusplus
 
+/* Unsynchronized iterator over xm->map that skips tombstones. The caller
+   must rule out concurrent writers; use xmap_view<T> otherwise. */
 template<typename T>
 class xmap_iterator {
 public:
-    xmap_iterator(xmap_t *map, size_t idx) : xm(map), index(idx) {}
+    xmap_iterator(xmap_t *map, size_t idx) : xm(map), index(idx) { skip(); }
     T& operator*() { return *reinterpret_cast<T*>(xm->map[index]); }
-    xmap_iterator& operator++() { ++index; return *this; }
+    xmap_iterator& operator++() { ++index; skip(); return *this; }
     bool operator!=(const xmap_iterator& other) const { return index != other.index; }
 
 private:
+    void skip() { while (index < xm->count && !xm->map[index]) ++index; }
+
     xmap_t *xm;
     size_t index;
 };
@@ -168,16 +1239,92 @@ xmap_iterator<T> xmap_begin(xmap_t* xm) { return xmap_iterator<T>(xm, 0); }
 template<typename T>
 xmap_iterator<T> xmap_end(xmap_t* xm) { return xmap_iterator<T>(xm, xm->count); }
 
+/* RAII snapshot iteration (xmap_view_begin/xmap_view_end): safe against
+   concurrent inserts and erases, and holds the lock only while copying. */
+template<typename T>
+class xmap_view {
+public:
+    class iterator {
+    public:
+        explicit iterator(void **p) : pos(p) {}
+        T& operator*() { return *reinterpret_cast<T*>(*pos); }
+        iterator& operator++() { ++pos; return *this; }
+        bool operator!=(const iterator& other) const { return pos != other.pos; }
+
+    private:
+        void **pos;
+    };
+
+    explicit xmap_view(xmap_t *xm) { ok_ = xmap_view_begin(xm, &v_); }
+    ~xmap_view() { xmap_view_end(&v_); }
+    xmap_view(const xmap_view&) = delete;
+    xmap_view& operator=(const xmap_view&) = delete;
+
+    bool ok() const { return ok_ != 0; }
+    size_t size() const { return v_.count; }
+    iterator begin() { return iterator(v_.items); }
+    iterator end() { return iterator(v_.items + v_.count); }
+
+private:
+    xmap_view_t v_;
+    int ok_;
+};
+
 /* C++ convenience wrappers */
 
+/* The std::string overloads copy size() characters without measuring
+   the string again */
 XSTDDEF_IMPORT_API void xxmap_strinsert(xmap_t *xm, const std::string& str);
+XSTDDEF_IMPORT_API void xxmap_strinsert(xmap_t *xm, const char *str);
+XSTDDEF_IMPORT_API int xxmap_strinsert(xmap_t *xm, const char *str, size_t len);
 XSTDDEF_IMPORT_API int xxmap_strinsert_safe(xmap_t *xm, const std::string& str);
+/* Copy of string `i' (thread-safe, inline entries included): the lease
+   copies an inline string under the lock and pins any other */
 XSTDDEF_IMPORT_API std::string xxmap_strget(xmap_t *xm, size_t i);
 
 XSTDDEF_IMPORT_API void xxmap_wcsinsert(xmap_t *xm, const std::wstring& str);
+XSTDDEF_IMPORT_API void xxmap_wcsinsert(xmap_t *xm, const wchar_t *str);
+XSTDDEF_IMPORT_API int xxmap_wcsinsert(xmap_t *xm, const wchar_t *str, size_t len);
 XSTDDEF_IMPORT_API int xxmap_wcsinsert_safe(xmap_t *xm, const std::wstring& str);
 XSTDDEF_IMPORT_API std::wstring xxmap_wcsget(xmap_t *xm, size_t i);
 
+#if __cplusplus >= 201703L
+/* RAII string lease (xmap_lease_str/xmap_lease_wcs) for C++17: view()
+   reads the string in place with its cached length, no allocation, until
+   the lease goes out of scope. Header-only: the library builds as C++11. */
+template<class C>
+class xmap_basic_lease {
+public:
+    xmap_basic_lease(xmap_t *xm, size_t i) {
+        ok_ = std::is_same<C, wchar_t>::value ? xmap_lease_wcs(xm, i, &l_) : xmap_lease_str(xm, i, &l_);
+    }
+    ~xmap_basic_lease() { xmap_lease_end(&l_); }
+    xmap_basic_lease(const xmap_basic_lease&) = delete;
+    xmap_basic_lease& operator=(const xmap_basic_lease&) = delete;
+
+    bool ok() const { return ok_ != 0; }
+    std::basic_string_view<C> view() const {
+        return ok_ ? std::basic_string_view<C>(static_cast<const C*>(l_.str), l_.len) : std::basic_string_view<C>();
+    }
+    operator std::basic_string_view<C>() const { return view(); }
+
+private:
+    xmap_lease_t l_;
+    int ok_;
+};
+
+typedef xmap_basic_lease<char> xmap_strlease;
+typedef xmap_basic_lease<wchar_t> xmap_wcslease;
+
+inline int xxmap_strinsert(xmap_t *xm, std::string_view str) {
+    return xmap_strninsert(xm, str.data(), str.size());
+}
+
+inline int xxmap_wcsinsert(xmap_t *xm, std::wstring_view str) {
+    return xmap_wcsninsert(xm, str.data(), str.size());
+}
+#endif
+
 template<typename T>
 T* xxmap_get(xmap_t* xm, size_t i) {
     return reinterpret_cast<T*>(xmap_get(xm, i)); /* calls C version */
@@ -189,6 +1336,162 @@ T xxmap_intget(xmap_t* xm, size_t i) {
     if (!p) return T();
     return *reinterpret_cast<T*>(p);
 }
+
+/* Typed map: stores T inline in one contiguous array, with no per-element
+   allocation and no pointer chase on reads. Locking and the growth policy
+   come from an embedded xmap_t. Trivially copyable payloads grow with
+   realloc(); other types are move-constructed into the new block.
+   Failed allocations report errno = ENOMEM rather than throwing. */
+template<class T>
+class xmap {
+public:
+    explicit xmap(unsigned growth = 0) : data_(NULL), count_(0), capacity_(0) {
+        xmap_init(&xm_);
+        if (growth) xmap_set_growth(&xm_, growth);
+    }
+    ~xmap() {
+        clear();
+        free(data_);
+        xmap_destroy(&xm_);
+    }
+    xmap(const xmap&) = delete;
+    xmap& operator=(const xmap&) = delete;
+
+    /* Append (thread-safe). Returns the new index, or (size_t)-1 on failure. */
+    size_t push_back(const T& v) { return emplace_back(v); }
+    size_t push_back(T&& v) { return emplace_back(std::move(v)); }
+
+    template<class... Args>
+    size_t emplace_back(Args&&... args) {
+        guard g(&xm_);
+        if (!grow_locked(count_ + 1)) return (size_t)-1;
+        new (data_ + count_) T(std::forward<Args>(args)...);
+        return count_++;
+    }
+
+    /* Copy out / overwrite entry i (thread-safe). False when out of range. */
+    bool get(size_t i, T& out) {
+        guard g(&xm_);
+        if (i >= count_) return false;
+        out = data_[i];
+        return true;
+    }
+
+    bool set(size_t i, T v) {
+        guard g(&xm_);
+        if (i >= count_) return false;
+        data_[i] = std::move(v);
+        return true;
+    }
+
+    /* Erase entry i and shift later entries left (thread-safe) */
+    bool erase(size_t i) {
+        guard g(&xm_);
+        if (i >= count_) return false;
+        for (size_t j = i; j + 1 < count_; ++j) data_[j] = std::move(data_[j + 1]);
+        data_[--count_].~T();
+        return true;
+    }
+
+    /* Capacity management, following xmap_reserve()/xmap_shrink_to_fit() */
+    bool reserve(size_t n) {
+        guard g(&xm_);
+        return n <= capacity_ || relocate_locked(n);
+    }
+
+    bool shrink_to_fit() {
+        guard g(&xm_);
+        if (count_ == capacity_) return true;
+        if (count_ == 0) {
+            free(data_);
+            data_ = NULL;
+            capacity_ = 0;
+            return true;
+        }
+        return relocate_locked(count_);
+    }
+
+    void clear() {
+        guard g(&xm_);
+        for (size_t i = 0; i < count_; ++i) data_[i].~T();
+        count_ = 0;
+    }
+
+    size_t size() {
+        guard g(&xm_);
+        return count_;
+    }
+
+    size_t capacity() {
+        guard g(&xm_);
+        return capacity_;
+    }
+
+    /* Call fn(T&) on every entry in order under the lock (thread-safe) */
+    template<class F>
+    void for_each(F fn) {
+        guard g(&xm_);
+        for (size_t i = 0; i < count_; ++i) fn(data_[i]);
+    }
+
+    /* Unsynchronized access: the caller must rule out concurrent writers,
+       as with xmap_iterator. Pointers are invalidated by growth. */
+    T& operator[](size_t i) { return data_[i]; }
+    T* begin() { return data_; }
+    T* end() { return data_ + count_; }
+    xmap_t* raw() { return &xm_; }
+
+private:
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+
+    struct guard {
+        xmap_t *xm;
+        explicit guard(xmap_t *m) : xm(m) { xmap_lock(xm); }
+        ~guard() { xmap_unlock(xm); }
+    };
+
+    bool grow_locked(size_t mincap) {
+        if (capacity_ >= mincap) return true;
+        return relocate_locked(xmap_grow_capacity(&xm_, capacity_, mincap));
+    }
+
+    /* Move the entries into a block of exactly `newcap' >= count_ slots.
+       The copy is picked at compile time, so realloc() is never even
+       instantiated for types that are not trivially copyable. */
+    bool relocate_locked(size_t newcap) {
+        T *tmp = move_locked(newcap, std::is_trivially_copyable<T>());
+        if (!tmp) {
+            errno = ENOMEM;
+            return false;
+        }
+        data_ = tmp;
+        capacity_ = newcap;
+        return true;
+    }
+
+    /* Trivially copyable entries: realloc() moves them bitwise */
+    T *move_locked(size_t newcap, std::true_type) {
+        return static_cast<T*>(realloc(data_, newcap * sizeof(T)));
+    }
+
+    /* Other entries are move-constructed into a fresh block */
+    T *move_locked(size_t newcap, std::false_type) {
+        T *tmp = static_cast<T*>(malloc(newcap * sizeof(T)));
+        if (tmp) {
+            for (size_t i = 0; i < count_; ++i) {
+                new (tmp + i) T(std::move(data_[i]));
+                data_[i].~T();
+            }
+            free(data_);
+        }
+        return tmp;
+    }
+
+    xmap_t xm_;
+    T *data_;
+    size_t count_;
+    size_t capacity_;
+};
 #endif
 
 #endif /* __XMAP_H__ */
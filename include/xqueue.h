@@ -0,0 +1,130 @@
+/**
+ * xqueue.h: Extern Queue Library
+ *
+ * Copyright (C) 2025 MrR736 <MrR736@users.github.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The complete text of the GNU General Public License
+ * can be found in /usr/share/common-licenses/GPL-3 file.
+ */
+
+#ifndef __XQUEUE_H__
+#define __XQUEUE_H__
+
+#include "xstddef.h"
+#include <pthread.h>
+
+#define XQUEUE_CACHELINE    64
+#define XQUEUE_SPIN         64 /* failed attempts before a blocking call sleeps */
+
+/* One ring slot: `seq' tells whose turn it is. A producer may fill the
+   slot at position p when seq == p; a consumer may empty it when
+   seq == p + 1. */
+typedef struct {
+    size_t seq;
+    void *data;
+} xqueue_cell_t;
+
+/* Bounded multi-producer/multi-consumer FIFO of pointers. Push and pop
+   are lock-free (one CAS each); the mutex and condition variables are
+   only used by blocking calls that have to wait. head and tail sit on
+   their own cache lines so producers and consumers do not share one. */
+typedef struct {
+    xqueue_cell_t *cells;
+    size_t mask; /* capacity - 1, capacity a power of two */
+    char pad0[XQUEUE_CACHELINE];
+    size_t head; /* next position to push */
+    char pad1[XQUEUE_CACHELINE - sizeof(size_t)];
+    size_t tail; /* next position to pop */
+    char pad2[XQUEUE_CACHELINE - sizeof(size_t)];
+    int closed; /* xqueue_close(): pushes fail, pops drain then fail */
+    unsigned waiters; /* threads sleeping (or about to) in a blocking call */
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} xqueue_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initialize a queue holding up to `capacity' pointers, rounded up to a
+   power of two (at least 2). Returns 1 on success, 0 on failure (errno
+   set: EINVAL for a zero or too large capacity, ENOMEM). */
+XSTDDEF_IMPORT_API int xqueue_init(xqueue_t *q, size_t capacity);
+
+/* Destroy: frees the ring. Pointers still queued are not released; the
+   caller owns them (drain with xqueue_trypop() first if needed). No
+   thread may be using the queue. */
+XSTDDEF_IMPORT_API void xqueue_destroy(xqueue_t *q);
+
+/* Helper: wake threads sleeping in a blocking call (after a push wakes
+   consumers, after a pop producers). The seq_cst fence pairs with the
+   one in xqueue_wait(): either the sleeper sees the new state on its
+   re-check, or we see it in `waiters'. */
+XSTDDEF_IMPORT_API void xqueue_wake(xqueue_t *q, pthread_cond_t *cond);
+
+/* Helper: claim the slot at head and fill it, without waking anyone.
+   Returns 1 on success, 0 if full (errno EAGAIN) or closed (EPIPE). */
+XSTDDEF_IMPORT_API int xqueue_enqueue(xqueue_t *q, void *data);
+
+/* Helper: claim the slot at tail and empty it, without waking anyone.
+   Returns 1 on success, 0 if empty (errno EAGAIN, or EPIPE once closed). */
+XSTDDEF_IMPORT_API int xqueue_dequeue(xqueue_t *q, void **out);
+
+/* Non-blocking push (thread-safe, lock-free). Returns 1 on success, 0 if
+   the queue is full (errno EAGAIN) or closed (errno EPIPE). */
+XSTDDEF_IMPORT_API int xqueue_trypush(xqueue_t *q, void *data);
+
+/* Non-blocking pop (thread-safe, lock-free). Stores the oldest pointer in
+   *out and returns 1, or returns 0 if the queue is empty (errno EAGAIN,
+   or EPIPE once it is also closed). */
+XSTDDEF_IMPORT_API int xqueue_trypop(xqueue_t *q, void **out);
+
+/* Helper: one sleeping attempt of a blocking push (push != 0, `arg' is
+   the pointer) or pop (`arg' is the void ** out). Registers as a waiter,
+   re-checks under the mutex and sleeps if that fails with EAGAIN; the
+   re-check closes the lost-wakeup window (see xqueue_wake()). Returns 1
+   if the re-check succeeded, else 0 with errno EAGAIN (try again) or
+   EPIPE. */
+XSTDDEF_IMPORT_API int xqueue_wait(xqueue_t *q, int push, void *arg);
+
+/* Blocking push (thread-safe): waits while the queue is full. Spins
+   briefly before sleeping. Returns 1 on success, 0 if the queue is or
+   becomes closed (errno EPIPE). */
+XSTDDEF_IMPORT_API int xqueue_push(xqueue_t *q, void *data);
+
+/* Blocking pop (thread-safe): waits while the queue is empty. Returns 1
+   with the oldest pointer in *out, or 0 once the queue is closed and
+   drained (errno EPIPE). */
+XSTDDEF_IMPORT_API int xqueue_pop(xqueue_t *q, void **out);
+
+/* Close the queue (thread-safe): later pushes fail with EPIPE, pops
+   return what is left and then fail with EPIPE. Wakes every blocked
+   thread. */
+XSTDDEF_IMPORT_API void xqueue_close(xqueue_t *q);
+
+/* Number of queued pointers (thread-safe). Only a snapshot while other
+   threads push or pop. */
+XSTDDEF_IMPORT_API size_t xqueue_size(xqueue_t *q);
+
+/* Capacity of the ring (thread-safe) */
+XSTDDEF_IMPORT_API size_t xqueue_capacity(xqueue_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XQUEUE_H__ */
@@ -5,5 +5,6 @@
 #include "xstring.h"
 #include "xwchar.h"
 #include "xmap.h"
+#include "xqueue.h"
 #include "xctype.h"
 #include "xwctype.h"
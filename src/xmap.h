@@ -25,13 +25,128 @@
 
 #include "xstddef.h"
 #include <pthread.h>
+#include <sched.h>
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 
 #ifdef __cplusplus
 #include <string>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 #endif
 
+/* Key kinds for slots of the hashed (associative) store */
+#define XMAP_KEY_EMPTY	0
+#define XMAP_KEY_INT	1
+#define XMAP_KEY_STR	2
+#define XMAP_KEY_WCS	3
+#define XMAP_KEY_DEAD	4 /* tombstone left behind by a removal */
+
+/* Positional entry tags (xmap_t.tags): the entry type in the low two bits,
+   the inline, shared and dead bits, and for strings and binary entries
+   the length above */
+#define XMAP_ENTRY_VALUE	0 /* caller-supplied pointer */
+#define XMAP_ENTRY_STR	1 /* char* copy listed in str */
+#define XMAP_ENTRY_WCS	2 /* wchar_t* copy listed in wstr */
+#define XMAP_ENTRY_MEM	3 /* binary copy, length in the tag (xmap_meminsert) */
+#define XMAP_ENTRY_INLINE	4 /* string stored in the slot's cell (XMAP_INLINE) */
+#define XMAP_ENTRY_SHARED	8 /* copy owned by the arena or a loaded image, never released per slot */
+#define XMAP_ENTRY_DEAD	16 /* tombstone left by a _no_shift erase (xmap_compact drops it) */
+#define XMAP_ENTRY_NOLEN	(SIZE_MAX >> 5) /* length not measured yet */
+#define XMAP_ENTRY_TAG(type,len)	(((size_t)(len) << 5) | (size_t)(type))
+#define XMAP_ENTRY_TYPE(tag)	((int)((tag) & 3))
+#define XMAP_ENTRY_LEN(tag)	((size_t)(tag) >> 5)
+
+/* Inline string cell, one per map slot in XMAP_INLINE maps */
+#define XMAP_INLINE_SIZE	24
+typedef union {
+	char str[XMAP_INLINE_SIZE];
+	wchar_t wcs[XMAP_INLINE_SIZE / sizeof(wchar_t)];
+} xmap_cell_t;
+
+typedef struct {
+	size_t hash;
+	int kind;
+	uintptr_t ikey; /* integer key (XMAP_KEY_INT) */
+	void *pkey; /* owned char* / wchar_t* copy (XMAP_KEY_STR/WCS) */
+	void *value;
+} xmap_slot_t;
+
+/* Open-addressing hash table (linear probing, power-of-two capacity) */
+typedef struct {
+	xmap_slot_t *slots;
+	size_t count; /* live keys */
+	size_t used; /* live keys + tombstones */
+	size_t capacity;
+} xmap_hash_t;
+
+/* Map flags (xmap_init_flags) */
+#define XMAP_READMOSTLY	0x1u /* lock-free positional reads (seqlock); writers still lock */
+#define XMAP_ARENA	0x2u /* string copies are bump-allocated from map-owned chunks */
+#define XMAP_INTERN	0x4u /* string inserts share one copy per distinct string */
+#define XMAP_NONOWNING	0x8u /* erase/destroy never release stored values */
+#define XMAP_INLINE	0x10u /* short strings live in per-slot cells (not with XMAP_READMOSTLY) */
+#define XMAP_STATS	0x20u /* count lock contention, resizes and shifts (xmap_stats) */
+#define XMAP_SINGLE	0x40u /* thread-confined: no operation takes the mutex */
+
+/* Element allocator (xmap_init_alloc): serves the string and key copies
+   the map makes and its arena chunks, and releases stored values when no
+   destructor is set. NULL callbacks fall back to malloc()/free(). */
+typedef struct {
+	void *(*allocate)(size_t size, void *ctx);
+	void (*deallocate)(void *ptr, void *ctx);
+	void *ctx;
+} xmap_allocator_t;
+
+/* Value destructor: called instead of free() for every stored value */
+typedef void (*xmap_dtor_t)(void *data, void *ctx);
+
+/* Arrays replaced while lock-free readers may still be looking at them,
+   and element releases postponed while views are open */
+typedef struct xmap_retired {
+	struct xmap_retired *next;
+	void *ptr;
+	int value; /* deferred element: 1 = stored value, 0 = string copy */
+} xmap_retired_t;
+
+/* Ordered index over one string list: string indices sorted by string */
+typedef struct {
+	size_t *idx;
+	size_t count; /* indexed entries */
+	size_t capacity;
+	size_t covered; /* list entries already merged in; the rest are pending */
+} xmap_order_t;
+
+/* Operation counters of an XMAP_STATS map (xmap_stats). Updated under
+   the mutex; lock-free reads are not counted. */
+typedef struct {
+	unsigned long long locks; /* mutex acquisitions */
+	unsigned long long contended; /* acquisitions that found the mutex held */
+	unsigned long long wait_ns; /* time spent waiting for the mutex */
+	unsigned long long reallocs; /* map and str/wstr array resizes */
+	unsigned long long bytes_moved; /* bytes copied by resizes that moved */
+	unsigned long long erases; /* shifting erases */
+	unsigned long long shifted; /* slots moved left by shifting erases */
+} xmap_stats_t;
+
+/* Arena chunk header; string data follows it */
+typedef struct xmap_chunk {
+	struct xmap_chunk *next;
+	size_t size; /* usable bytes after the header */
+	size_t used;
+} xmap_chunk_t;
+
 typedef struct {
 	void **map;
+	size_t *tags; /* XMAP_ENTRY_TAG per map slot (mutex only) */
+	xmap_cell_t *cells; /* inline strings per map slot (XMAP_INLINE) */
 	size_t count;
 	size_t capacity;
 
@@ -44,9 +159,199 @@ typedef struct {
 	size_t cwstr;
 	size_t cwstr_capacity;
 
+	size_t dead; /* XMAP_ENTRY_DEAD (erased, not shifted) slots in map[0..count) */
+
+	xmap_order_t order; /* sorted view of str (built on first query) */
+	xmap_order_t worder; /* sorted view of wstr */
+
+	xmap_hash_t hash; /* keyed entries (xmap_put/xmap_find/xmap_remove) */
+	xmap_hash_t intern; /* interned strings (keys live in the arena) */
+
+	unsigned flags;
+	unsigned growth; /* capacity growth in percent, 0 = double (xmap_set_growth) */
+	unsigned long seq; /* odd while a writer is modifying (XMAP_READMOSTLY) */
+	xmap_retired_t *retired; /* freed on xmap_reclaim()/xmap_destroy() */
+	size_t views; /* open xmap_view_t snapshots, leases and xmap_snapshot_t */
+	struct xmap_snapshot *snapshots; /* open copy-on-write snapshots */
+	xmap_retired_t *deferred; /* element releases waiting for views to close */
+	xmap_chunk_t *arena; /* current chunk first (XMAP_ARENA) */
+
+	void *mapped; /* xmap_load() image; its strings are never freed */
+	size_t mapped_size;
+
+	xmap_allocator_t allocator;
+	xmap_dtor_t dtor; /* releases values instead of the allocator */
+	void *dtor_ctx;
+
+	xmap_stats_t stats; /* XMAP_STATS only */
+
 	pthread_mutex_t mutex;
 } xmap_t;
 
+/* Stable snapshot of the live positional entries (xmap_view_begin).
+   While any view is open, erased elements are released only once the
+   last view ends, so every pointer in `items' stays valid. Inline
+   strings, which move with their slots, are copied into cells kept in
+   the same block as `items'. */
+typedef struct {
+	xmap_t *xm;
+	void **items; /* non-NULL entries in map order */
+	size_t count;
+} xmap_view_t;
+
+#define XMAP_PAGE_SHIFT	9
+#define XMAP_PAGE_SLOTS	((size_t)1 << XMAP_PAGE_SHIFT) /* map slots per copy-on-write page */
+
+/* Map slots [k << XMAP_PAGE_SHIFT, ...) as they were before a writer
+   (or a snapshot reader) first touched them; shared by every snapshot
+   that still saw the live slots at that moment. Immutable once made. */
+typedef struct {
+	size_t refs;
+	void *map[XMAP_PAGE_SLOTS];
+	size_t tags[XMAP_PAGE_SLOTS];
+	xmap_cell_t *cells; /* inline strings (XMAP_INLINE maps only) */
+} xmap_page_t;
+
+/* Copy-on-write snapshot of the positional entries (xmap_snapshot).
+   pages[k] is NULL while page k of the live map is unchanged since the
+   snapshot was taken, and the preserved page afterwards. */
+typedef struct xmap_snapshot {
+	xmap_t *xm;
+	size_t count; /* map entries when taken */
+	xmap_page_t **pages; /* one per XMAP_PAGE_SLOTS slots of count */
+	int error; /* ENOMEM once a page could not be preserved */
+	struct xmap_snapshot *next; /* open snapshots of xm */
+	struct xmap_snapshot *prev;
+} xmap_snapshot_t;
+
+/* Pinned string (xmap_lease_str): `str' holds `len' characters plus the
+   terminator and stays readable until xmap_lease_end(), like the entries
+   of an open view. Inline strings are copied into `buf', so a lease must
+   not be copied while it is open. */
+typedef struct {
+	xmap_t *xm; /* NULL unless the lease holds a view */
+	const void *str;
+	size_t len; /* characters, without the terminator */
+	xmap_cell_t buf;
+} xmap_lease_t;
+
+/* One worker's chunk of a parallel pass (xmap_parallel_foreach/_reduce) */
+typedef struct {
+	void **items;
+	size_t count;
+	void (*fn)(void *data, void *arg);
+	void (*reduce)(void *data, void *acc, void *arg);
+	void *acc;
+	void *arg;
+} xmap_task_t;
+
+/* Image file header (xmap_save/xmap_load), followed by uint64_t offsets
+   [count], str[cstr], wstr[cwstr] and a blob of blob_size bytes. A
+   tombstoned string slot is kept, with offset XMAP_IMAGE_DEAD, so string
+   indices survive a save and load. */
+#define XMAP_IMAGE_MAGIC "XMAPIMG1"
+#define XMAP_IMAGE_DEAD	UINT64_MAX
+typedef struct {
+	char magic[8];
+	uint32_t wchar_size;
+	uint32_t reserved;
+	uint64_t count; /* entries, all strings or their tombstones, in map order */
+	uint64_t cstr;
+	uint64_t cwstr;
+	uint64_t blob_size;
+} xmap_image_header_t;
+
+/* Smallest chunk handed to a separate thread by the parallel passes */
+#ifndef XMAP_PARALLEL_MIN
+#define XMAP_PARALLEL_MIN 4096
+#endif
+
+/* Sharded map: independently locked shards, padded so that neighbouring
+   shards never share a cache line */
+typedef struct {
+	xmap_t xm;
+	unsigned char pad[64];
+} xmap_shard_t;
+
+typedef struct {
+	xmap_shard_t *shards;
+	size_t nshards; /* power of two */
+} xmap_sharded_t;
+
+/* Resident entry of a bounded cache. `pkey' is the key copy owned by the
+   key table slot, kept here to find that slot again on eviction. */
+typedef struct {
+	void *value;
+	void *pkey;
+	uintptr_t ikey;
+	size_t hash;
+	size_t size; /* bytes charged against max_bytes */
+	int kind; /* XMAP_KEY_STR or XMAP_KEY_INT */
+	int ref; /* CLOCK reference bit, set on every hit */
+} xmap_cache_entry_t;
+
+typedef struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+} xmap_cache_stats_t;
+
+/* Bounded cache with CLOCK eviction (xmap_cache_init). The embedded map
+   supplies the mutex, the allocator and destructor, and the key table,
+   whose slot values are entry indices + 1. Entries are kept dense. */
+typedef struct {
+	xmap_t xm;
+	xmap_cache_entry_t *entries;
+	size_t count;
+	size_t capacity;
+	size_t hand; /* next entry the CLOCK sweep looks at */
+	size_t bytes;
+	size_t max_entries; /* 0 = unlimited */
+	size_t max_bytes; /* 0 = unlimited */
+	xmap_cache_stats_t stats;
+} xmap_cache_t;
+
+#define XMAP_TTL_BITS	6
+#define XMAP_TTL_SLOTS	(1 << XMAP_TTL_BITS) /* slots per wheel level */
+#define XMAP_TTL_LEVELS	4 /* level k slots span 64^k ticks; 64^4 ticks in all */
+#define XMAP_TTL_NONE	((size_t)-1) /* end of a slot list */
+#define XMAP_TTL_UNARMED	(~0u) /* node slot: no timer */
+
+/* Timer of the entry at the same map index, linked into one wheel slot */
+typedef struct {
+	uint64_t expires;
+	size_t next;
+	size_t prev;
+	unsigned slot; /* level * XMAP_TTL_SLOTS + slot, or XMAP_TTL_UNARMED */
+	size_t gen; /* bumped each time the index is retired */
+} xmap_ttl_node_t;
+
+/* Handle of an expiring entry (xmap_ttl_insert): its map index and the
+   generation of that index, so a handle to an expired or erased entry
+   never reaches the entry that reuses the index */
+typedef struct {
+	size_t index; /* XMAP_TTL_NONE if the insert failed */
+	size_t gen;
+} xmap_ttl_id_t;
+
+/* Expiring map (xmap_ttl_init): positional entries with a deadline, kept
+   in a hierarchical timer wheel. Level 0 holds timers due in the next 64
+   ticks, one slot per tick; each higher level slot covers a whole turn
+   of the level below and is cascaded into it when that turn starts.
+   Indices of expired and erased entries are reused by later inserts, so
+   memory follows the live set rather than the total inserted; handles
+   carry a generation that tells them apart. */
+typedef struct {
+	xmap_t xm;
+	xmap_ttl_node_t *nodes; /* parallel to xm.map */
+	size_t capacity;
+	size_t pending; /* armed timers */
+	size_t spare; /* tombstoned indices, linked through nodes[].next */
+	uint64_t now; /* next tick xmap_ttl_expire() processes */
+	uint64_t occupied[XMAP_TTL_LEVELS]; /* bit s: slot s of that level is not empty */
+	size_t heads[XMAP_TTL_LEVELS * XMAP_TTL_SLOTS];
+} xmap_ttl_t;
+
 /* Types for `void *' pointers.  */
 #define xmap_intptr(p)		((intptr_t)(p))
 #define xmap_uintptr(p)		((uintptr_t)(p))
@@ -75,9 +380,11 @@ typedef struct {
 extern "C" {
 #endif
 
-/* Initialize */
-XSTDDEF_INLINE_API void xmap_init(xmap_t *xm) {
+/* Initialize with flags (XMAP_READMOSTLY, ...) */
+XSTDDEF_INLINE_API void xmap_init_flags(xmap_t *xm, unsigned flags) {
 	xm->map = NULL;
+	xm->tags = NULL;
+	xm->cells = NULL;
 	xm->str = NULL;
 	xm->wstr = NULL;
 	xm->count = 0;
@@ -86,419 +393,2437 @@ XSTDDEF_INLINE_API void xmap_init(xmap_t *xm) {
 	xm->cstr_capacity = 0;
 	xm->cwstr = 0;
 	xm->cwstr_capacity = 0;
+	xm->dead = 0;
+	memset(&xm->order, 0, sizeof(xm->order));
+	memset(&xm->worder, 0, sizeof(xm->worder));
+	xm->hash.slots = NULL;
+	xm->hash.count = 0;
+	xm->hash.used = 0;
+	xm->hash.capacity = 0;
+	xm->intern.slots = NULL;
+	xm->intern.count = 0;
+	xm->intern.used = 0;
+	xm->intern.capacity = 0;
+	/* a single-threaded map has no lock-free readers to publish to */
+	if (flags & XMAP_SINGLE) flags &= ~XMAP_READMOSTLY;
+	/* inline cells move on growth: no lock-free reader may see them */
+	xm->flags = (flags & XMAP_READMOSTLY) ? flags & ~XMAP_INLINE : flags;
+	xm->growth = 0;
+	xm->seq = 0;
+	xm->retired = NULL;
+	xm->views = 0;
+	xm->snapshots = NULL;
+	xm->deferred = NULL;
+	xm->arena = NULL;
+	xm->mapped = NULL;
+	xm->mapped_size = 0;
+	xm->allocator.allocate = NULL;
+	xm->allocator.deallocate = NULL;
+	xm->allocator.ctx = NULL;
+	xm->dtor = NULL;
+	xm->dtor_ctx = NULL;
+	memset(&xm->stats, 0, sizeof(xm->stats));
 	pthread_mutex_init(&xm->mutex, NULL);
 }
 
-/* Helper: ensure map capacity (holds/assumes caller has not locked mutex:
-   this routine will not lock. Returns 1 on success, 0 on failure).
-   It updates xm->map and xm->capacity atomically (no mutex) — caller
-   MUST hold the mutex if concurrent use is possible.
-*/
-XSTDDEF_INLINE_API int xmap_ensure_capacity_nolock(xmap_t *xm, size_t mincap) {
-	if (xm->capacity >= mincap) return 1;
-	size_t newcap = (xm->capacity == 0) ? 4 : xm->capacity;
-	while (newcap < mincap) newcap *= 2;
-	void **tmp = (void **)realloc(xm->map, newcap * sizeof(void *));
-	if (!tmp) {
-		errno = ENOMEM;
-		return 0;
-	}
-	/* initialize new slots to NULL (helps later logic) */
-	for (size_t i = xm->capacity; i < newcap; ++i) tmp[i] = NULL;
-	xm->map = tmp;
-	xm->capacity = newcap;
-	return 1;
+/* Initialize */
+XSTDDEF_INLINE_API void xmap_init(xmap_t *xm) {
+	xmap_init_flags(xm, 0);
 }
 
-/* Helpers for str/wstr arrays (caller must hold mutex) */
-XSTDDEF_INLINE_API int xmap_ensure_str_capacity_locked(xmap_t *xm, size_t mincap) {
-	if (xm->cstr_capacity >= mincap) return 1;
-	size_t newcap = (xm->cstr_capacity == 0) ? 4 : xm->cstr_capacity;
-	while (newcap < mincap) newcap *= 2;
-	size_t *tmp = (size_t *)realloc(xm->str, newcap * sizeof(size_t));
-	if (!tmp) {
-		errno = ENOMEM;
-		return 0;
-	}
-	xm->str = tmp;
-	xm->cstr_capacity = newcap;
-	return 1;
+/* Initialize with flags, an element allocator and a value destructor.
+   Either may be NULL. With a destructor, every stored value (not the
+   string copies the map makes itself) is passed to dtor(data, dtor_ctx)
+   on erase, replace and destroy instead of being freed; XMAP_NONOWNING
+   skips releasing values altogether. */
+XSTDDEF_INLINE_API void xmap_init_alloc(xmap_t *xm, unsigned flags, const xmap_allocator_t *allocator, xmap_dtor_t dtor, void *dtor_ctx) {
+	xmap_init_flags(xm, flags);
+	if (allocator) xm->allocator = *allocator;
+	xm->dtor = dtor;
+	xm->dtor_ctx = dtor_ctx;
 }
 
-XSTDDEF_INLINE_API int xmap_ensure_wstr_capacity_locked(xmap_t *xm, size_t mincap) {
-	if (xm->cwstr_capacity >= mincap) return 1;
-	size_t newcap = (xm->cwstr_capacity == 0) ? 4 : xm->cwstr_capacity;
-	while (newcap < mincap) newcap *= 2;
-	size_t *tmp = (size_t *)realloc(xm->wstr, newcap * sizeof(size_t));
-	if (!tmp) {
-		errno = ENOMEM;
-		return 0;
-	}
-	xm->wstr = tmp;
-	xm->cwstr_capacity = newcap;
-	return 1;
+/* Helpers: element memory through the map's allocator. The allocator is
+   fixed at init, so these need no lock. */
+XSTDDEF_INLINE_API void* xmap_elem_alloc(xmap_t *xm, size_t size) {
+	void *p = xm->allocator.allocate
+		? xm->allocator.allocate(size, xm->allocator.ctx)
+		: malloc(size);
+	if (!p) errno = ENOMEM;
+	return p;
 }
 
-/* Exists? (thread-safe) */
-XSTDDEF_INLINE_API int xmap_exists(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	int exists = (i < xm->count && xm->map[i] != NULL);
-	pthread_mutex_unlock(&xm->mutex);
-	return exists;
+XSTDDEF_INLINE_API void xmap_elem_free(xmap_t *xm, void *ptr) {
+	if (!ptr) return;
+	if (xm->allocator.deallocate) xm->allocator.deallocate(ptr, xm->allocator.ctx);
+	else free(ptr);
 }
 
-/* String/wstring existence by string-index (thread-safe) */
-XSTDDEF_INLINE_API int xmap_strexists(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->cstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return 0;
-	}
-	size_t ret = xm->str[i];
-	int exists = (ret < xm->count && xm->map[ret] != NULL);
-	pthread_mutex_unlock(&xm->mutex);
-	return exists;
+XSTDDEF_INLINE_API void* xmap_elem_dup(xmap_t *xm, const void *src, size_t size) {
+	void *p = xmap_elem_alloc(xm, size);
+	if (p) memcpy(p, src, size);
+	return p;
 }
 
-XSTDDEF_INLINE_API int xmap_wcsexists(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->cwstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return 0;
-	}
-	size_t ret = xm->wstr[i];
-	int exists = (ret < xm->count && xm->map[ret] != NULL);
-	pthread_mutex_unlock(&xm->mutex);
-	return exists;
+/* Helper: monotonic clock in nanoseconds (XMAP_STATS wait times) */
+XSTDDEF_INLINE_API unsigned long long xmap_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
 }
 
-/* Insert data pointer (thread-safe) */
-XSTDDEF_INLINE_API void xmap_insert(xmap_t *xm, void *data) {
-	pthread_mutex_lock(&xm->mutex);
-	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) {
-		/* errno set by ensure; leave map unchanged */
-		pthread_mutex_unlock(&xm->mutex);
+/* Take the mutex. XMAP_SINGLE maps skip it, but still count the elided
+   acquisition under XMAP_STATS; XMAP_STATS maps try it first and time
+   the wait when another thread holds it. */
+XSTDDEF_INLINE_API void xmap_mutex_lock(xmap_t *xm) {
+	if (!(xm->flags & (XMAP_STATS | XMAP_SINGLE))) {
+		pthread_mutex_lock(&xm->mutex);
+		return;
+	}
+	if (xm->flags & XMAP_SINGLE) {
+		if (xm->flags & XMAP_STATS) xm->stats.locks++;
 		return;
 	}
-	xm->map[xm->count++] = data;
-	pthread_mutex_unlock(&xm->mutex);
+	if (pthread_mutex_trylock(&xm->mutex) != 0) {
+		unsigned long long t0 = xmap_now_ns();
+		pthread_mutex_lock(&xm->mutex);
+		xm->stats.wait_ns += xmap_now_ns() - t0;
+		xm->stats.contended++;
+	}
+	xm->stats.locks++;
 }
 
-/* Non-locking insert (caller must hold mutex) */
-XSTDDEF_INLINE_API int xmap_insert_nolock(xmap_t *xm, void *data) {
-	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) return 0;
-	xm->map[xm->count++] = data;
-	return 1;
+XSTDDEF_INLINE_API void xmap_mutex_unlock(xmap_t *xm) {
+	if (!(xm->flags & XMAP_SINGLE)) pthread_mutex_unlock(&xm->mutex);
 }
 
-/* String Insert data pointer (thread-safe) */
-XSTDDEF_INLINE_API void xmap_strinsert(xmap_t *xm, const char* str) {
-	if (!str) return;
-	char* copy = strdup(str);
-	if (!copy) {
-		errno = ENOMEM;
-		return;
+/* Writer lock: takes the mutex and, in XMAP_READMOSTLY mode, makes the
+   sequence counter odd so lock-free readers retry until xmap_unlock(). */
+XSTDDEF_INLINE_API void xmap_lock(xmap_t *xm) {
+	xmap_mutex_lock(xm);
+	if (xm->flags & XMAP_READMOSTLY) {
+		__atomic_store_n(&xm->seq, xm->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
 	}
+}
 
-	pthread_mutex_lock(&xm->mutex);
-	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) {
-		pthread_mutex_unlock(&xm->mutex);
-		free(copy);
+XSTDDEF_INLINE_API void xmap_unlock(xmap_t *xm) {
+	if (xm->flags & XMAP_READMOSTLY)
+		__atomic_store_n(&xm->seq, xm->seq + 1, __ATOMIC_RELEASE);
+	xmap_mutex_unlock(xm);
+}
+
+/* Lock-free read section (XMAP_READMOSTLY): returns an even sequence
+   number to pass to xmap_read_retry() once the reads are done. */
+XSTDDEF_INLINE_API unsigned long xmap_read_begin(xmap_t *xm) {
+	unsigned long s;
+	while ((s = __atomic_load_n(&xm->seq, __ATOMIC_ACQUIRE)) & 1)
+		sched_yield();
+	return s;
+}
+
+XSTDDEF_INLINE_API int xmap_read_retry(xmap_t *xm, unsigned long s) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&xm->seq, __ATOMIC_RELAXED) != s;
+}
+
+/* Store to a map slot, list entry or count that lock-free readers load
+   (caller inside the write section). Relaxed is enough: the sequence
+   counter orders the section as a whole, the atomic just keeps each
+   store race-free. */
+#define xmap_store(lhs,v)	__atomic_store_n(&(lhs), (v), __ATOMIC_RELAXED)
+
+/* Helpers: memmove() for the map slots and the str/wstr indices. In
+   XMAP_READMOSTLY mode each element is copied with xmap_store(), lowest
+   first, so `dst' must lie below `src' or not overlap it. */
+XSTDDEF_INLINE_API void xmap_move_slots_nolock(xmap_t *xm, void **dst, void *const *src, size_t n) {
+	if (!(xm->flags & XMAP_READMOSTLY)) {
+		memmove(dst, src, n * sizeof(void *));
 		return;
 	}
-	xm->map[xm->count] = copy;
-	size_t map_index = xm->count;
-	xm->count++;
+	for (size_t k = 0; k < n; ++k) xmap_store(dst[k], src[k]);
+}
 
-	if (!xmap_ensure_str_capacity_locked(xm, xm->cstr + 1)) {
-		/* cannot expand str index array: rollback insertion */
-		free(copy);
-		xm->count--;
-		xm->map[map_index] = NULL;
-		pthread_mutex_unlock(&xm->mutex);
+XSTDDEF_INLINE_API void xmap_move_indices_nolock(xmap_t *xm, size_t *dst, const size_t *src, size_t n) {
+	if (!(xm->flags & XMAP_READMOSTLY)) {
+		memmove(dst, src, n * sizeof(size_t));
 		return;
 	}
-	xm->str[xm->cstr++] = map_index;
-	pthread_mutex_unlock(&xm->mutex);
+	for (size_t k = 0; k < n; ++k) xmap_store(dst[k], src[k]);
 }
 
-/* Non-locking variant: caller must hold mutex */
-XSTDDEF_INLINE_API int xmap_strinsert_nolock(xmap_t *xm, const char* str) {
-	if (!str) return 0;
-	char* copy = strdup(str);
-	if (!copy) {
+/* Helper: defer freeing an array until no lock-free reader can see it
+   (caller must hold mutex). Returns 1 on success, 0 on failure. */
+XSTDDEF_INLINE_API int xmap_retire_nolock(xmap_t *xm, void *ptr) {
+	xmap_retired_t *r = (xmap_retired_t *)malloc(sizeof(xmap_retired_t));
+	if (!r) {
 		errno = ENOMEM;
 		return 0;
 	}
-	if (!xmap_insert_nolock(xm, copy)) {
-		free(copy);
-		return 0;
-	}
-	if (!xmap_ensure_str_capacity_locked(xm, xm->cstr + 1)) {
-		/* rollback */
-		xm->count--;
-		free(copy);
-		return 0;
-	}
-	xm->str[xm->cstr++] = xm->count - 1;
+	r->ptr = ptr;
+	r->value = 0;
+	r->next = xm->retired;
+	xm->retired = r;
 	return 1;
 }
 
-/* String getter (thread-safe) */
-XSTDDEF_INLINE_API char* xmap_strget(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->cstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return NULL;
-	}
-	size_t ret = xm->str[i];
-	if (ret >= xm->count) {
-		pthread_mutex_unlock(&xm->mutex);
-		return NULL;
+/* Helper: resize an internal array (caller must hold mutex). In
+   XMAP_READMOSTLY mode the old block is retired instead of freed. */
+XSTDDEF_INLINE_API void* xmap_resize_nolock(xmap_t *xm, void *ptr, size_t oldsize, size_t newsize) {
+	if (!(xm->flags & XMAP_READMOSTLY)) return realloc(ptr, newsize);
+	void *tmp = malloc(newsize);
+	if (!tmp) return NULL;
+	if (ptr) {
+		if (!xmap_retire_nolock(xm, ptr)) {
+			free(tmp);
+			return NULL;
+		}
+		memcpy(tmp, ptr, oldsize < newsize ? oldsize : newsize);
 	}
-	void *ptr = xm->map[ret];
-	pthread_mutex_unlock(&xm->mutex);
-	if (!ptr) return NULL;
-	return xmap_cast(char*, ptr);
+	return tmp;
 }
 
-/* Wchar Insert data pointer (thread-safe) */
-XSTDDEF_INLINE_API void xmap_wcsinsert(xmap_t *xm, const wchar_t *str) {
-	if (!str) return;
-	wchar_t *copy = wcsdup(str);
-	if (!copy) {
-		errno = ENOMEM;
-		return;
+/* Free retired arrays (thread-safe). The caller guarantees that no
+   lock-free reader is still running against this map. */
+XSTDDEF_INLINE_API void xmap_reclaim(xmap_t *xm) {
+	xmap_mutex_lock(xm);
+	while (xm->retired) {
+		xmap_retired_t *r = xm->retired;
+		xm->retired = r->next;
+		free(r->ptr);
+		free(r);
 	}
+	xmap_mutex_unlock(xm);
+}
 
-	pthread_mutex_lock(&xm->mutex);
-	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) {
-		pthread_mutex_unlock(&xm->mutex);
-		free(copy);
-		return;
+/* Helper: next capacity >= mincap under the map's growth policy. Empty
+   arrays start at 4 slots; each step grows by xm->growth percent. */
+XSTDDEF_INLINE_API size_t xmap_grow_capacity(xmap_t *xm, size_t cap, size_t mincap) {
+	size_t pct = xm->growth ? xm->growth : 200;
+	size_t newcap = (cap == 0) ? 4 : cap;
+	while (newcap < mincap) {
+		size_t next = newcap / 100 * pct + newcap % 100 * pct / 100;
+		newcap = (next > newcap) ? next : newcap + 1;
 	}
-	xm->map[xm->count] = copy;
-	size_t map_index = xm->count;
-	xm->count++;
+	return newcap;
+}
 
-	if (!xmap_ensure_wstr_capacity_locked(xm, xm->cwstr + 1)) {
-		free(copy);
-		xm->count--;
-		xm->map[map_index] = NULL;
-		pthread_mutex_unlock(&xm->mutex);
-		return;
-	}
-	xm->wstr[xm->cwstr++] = map_index;
-	pthread_mutex_unlock(&xm->mutex);
+/* Helper: drop an internal array (caller must hold mutex). In
+   XMAP_READMOSTLY mode the block is retired instead of freed. */
+XSTDDEF_INLINE_API int xmap_drop_array_nolock(xmap_t *xm, void *ptr) {
+	if (!ptr) return 1;
+	if (xm->flags & XMAP_READMOSTLY) return xmap_retire_nolock(xm, ptr);
+	free(ptr);
+	return 1;
 }
 
-/* Wchar getter (thread-safe) */
-XSTDDEF_INLINE_API wchar_t* xmap_wcsget(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->cwstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return NULL;
+/* Helper: point the inline slots of map[from..count) back at their cells
+   after the cell array moved or slots shifted (caller must hold mutex) */
+XSTDDEF_INLINE_API void xmap_cells_repoint_nolock(xmap_t *xm, size_t from) {
+	for (size_t i = from; i < xm->count; ++i)
+		if (xm->tags[i] & XMAP_ENTRY_INLINE) xmap_store(xm->map[i], (void *)xm->cells[i].str);
+}
+
+/* Helper: resize the inline cell array of an XMAP_INLINE map to `newcap'
+   cells (caller must hold mutex). Returns 1 on success. */
+XSTDDEF_INLINE_API int xmap_cells_resize_nolock(xmap_t *xm, size_t newcap) {
+	if (!(xm->flags & XMAP_INLINE)) return 1;
+	if (newcap == 0) {
+		free(xm->cells);
+		xm->cells = NULL;
+		return 1;
 	}
-	size_t ret = xm->wstr[i];
-	if (ret >= xm->count) {
-		pthread_mutex_unlock(&xm->mutex);
-		return NULL;
+	xmap_cell_t *cells = (xmap_cell_t *)realloc(xm->cells, newcap * sizeof(xmap_cell_t));
+	if (!cells) {
+		errno = ENOMEM;
+		return 0;
 	}
-	void *ptr = xm->map[ret];
-	pthread_mutex_unlock(&xm->mutex);
-	if (!ptr) return NULL;
-	return xmap_cast(wchar_t*, ptr);
+	xm->cells = cells;
+	xmap_cells_repoint_nolock(xm, 0);
+	return 1;
 }
 
-/* Generic get (thread-safe) - avoids nested locking by checking directly */
-XSTDDEF_INLINE_API void* xmap_get(xmap_t* xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->count) {
-		pthread_mutex_unlock(&xm->mutex);
-		return NULL;
-	}
-	void *data = xm->map[i];
-	pthread_mutex_unlock(&xm->mutex);
-	return data;
+/* Helper: count one map or list resize (XMAP_STATS, caller must hold
+   mutex). `bytes' of old contents were copied if the array moved. */
+XSTDDEF_INLINE_API void xmap_stats_resize_nolock(xmap_t *xm, const void *from, const void *to, size_t bytes) {
+	if (!(xm->flags & XMAP_STATS)) return;
+	xm->stats.reallocs++;
+	if (from && from != to) xm->stats.bytes_moved += bytes;
 }
 
-/* Erase entry and shift (thread-safe). Frees stored pointer. */
-XSTDDEF_INLINE_API void xmap_erase(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->count) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
+/* Helper: set map capacity to exactly `newcap' >= count slots (caller
+   must hold mutex). Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_set_capacity_nolock(xmap_t *xm, size_t newcap) {
+	if (newcap == xm->capacity) return 1;
+	if (newcap == 0) {
+		if (!xmap_drop_array_nolock(xm, xm->map)) return 0;
+		__atomic_store_n(&xm->map, (void **)NULL, __ATOMIC_RELEASE);
+		free(xm->tags);
+		xm->tags = NULL;
+		xmap_cells_resize_nolock(xm, 0);
+		xm->capacity = 0;
+		return 1;
 	}
-	if (!xm->map[i]) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
+	/* tags and cells are never read lock-free: plain realloc, grown before
+	   and shrunk after the map so they always cover `capacity' slots */
+	if (newcap > xm->capacity) {
+		size_t *tags = (size_t *)realloc(xm->tags, newcap * sizeof(size_t));
+		if (!tags) {
+			errno = ENOMEM;
+			return 0;
+		}
+		xm->tags = tags;
+		if (!xmap_cells_resize_nolock(xm, newcap)) return 0;
 	}
+	void **tmp = (void **)xmap_resize_nolock(xm, xm->map, xm->capacity * sizeof(void *), newcap * sizeof(void *));
+	if (!tmp) {
+		errno = ENOMEM;
+		return 0;
+	}
+	xmap_stats_resize_nolock(xm, xm->map, tmp, (xm->capacity < newcap ? xm->capacity : newcap) * sizeof(void *));
+	/* initialize new slots to NULL (helps later logic) */
+	for (size_t i = xm->capacity; i < newcap; ++i) tmp[i] = NULL;
+	/* publish the array before any count that indexes into it */
+	__atomic_store_n(&xm->map, tmp, __ATOMIC_RELEASE);
+	if (newcap < xm->capacity) {
+		size_t *tags = (size_t *)realloc(xm->tags, newcap * sizeof(size_t));
+		if (tags) xm->tags = tags;
+		xmap_cells_resize_nolock(xm, newcap);
+	}
+	xm->capacity = newcap;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 1;
+}
 
-	free(xm->map[i]);
-
-	/* shift map entries left */
-	for (size_t j = i; j + 1 < xm->count; ++j)
-		xm->map[j] = xm->map[j + 1];
-	xm->map[xm->count - 1] = NULL;
+/* Helper: set str (wide == 0) or wstr (wide != 0) list capacity to
+   exactly `newcap' (caller must hold mutex). Returns 1 on success. */
+XSTDDEF_INLINE_API int xmap_set_list_capacity_locked(xmap_t *xm, int wide, size_t newcap) {
+	size_t **list = wide ? &xm->wstr : &xm->str;
+	size_t *cap = wide ? &xm->cwstr_capacity : &xm->cstr_capacity;
+	if (newcap == *cap) return 1;
+	if (newcap == 0) {
+		if (!xmap_drop_array_nolock(xm, *list)) return 0;
+		__atomic_store_n(list, (size_t *)NULL, __ATOMIC_RELEASE);
+		*cap = 0;
+		return 1;
+	}
+	size_t *tmp = (size_t *)xmap_resize_nolock(xm, *list, *cap * sizeof(size_t), newcap * sizeof(size_t));
+	if (!tmp) {
+		errno = ENOMEM;
+		return 0;
+	}
+	xmap_stats_resize_nolock(xm, *list, tmp, (*cap < newcap ? *cap : newcap) * sizeof(size_t));
+	__atomic_store_n(list, tmp, __ATOMIC_RELEASE);
+	*cap = newcap;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 1;
+}
 
-	/* fix str index list */
-	for (size_t k = 0; k < xm->cstr;) {
-		if (xm->str[k] == i) {
-			/* remove this mapping */
-			for (size_t m = k; m + 1 < xm->cstr; ++m)
-				xm->str[m] = xm->str[m + 1];
-			xm->cstr--;
-			/* don't increment k: new element at k must be checked */
-			continue;
+/* Helper: copy live page `k' of the map into a new page (caller must
+   hold mutex). Slots past count are left unset; no snapshot reads them.
+   Inline entries point into the page's own cells. Returns NULL on
+   failure. */
+XSTDDEF_INLINE_API xmap_page_t* xmap_page_copy_nolock(xmap_t *xm, size_t k) {
+	size_t base = k << XMAP_PAGE_SHIFT;
+	size_t n = (base < xm->count) ? xm->count - base : 0;
+	if (n > XMAP_PAGE_SLOTS) n = XMAP_PAGE_SLOTS;
+	xmap_page_t *page = (xmap_page_t *)malloc(sizeof(xmap_page_t));
+	if (!page) return NULL;
+	page->refs = 0;
+	page->cells = NULL;
+	if (!n) return page;
+	if (xm->cells) {
+		page->cells = (xmap_cell_t *)malloc(n * sizeof(xmap_cell_t));
+		if (!page->cells) {
+			free(page);
+			return NULL;
 		}
-		if (xm->str[k] > i) xm->str[k]--;
-		k++;
+		memcpy(page->cells, xm->cells + base, n * sizeof(xmap_cell_t));
 	}
+	memcpy(page->map, xm->map + base, n * sizeof(void *));
+	memcpy(page->tags, xm->tags + base, n * sizeof(size_t));
+	for (size_t j = 0; j < n; ++j)
+		if (page->map[j] && (page->tags[j] & XMAP_ENTRY_INLINE)) page->map[j] = page->cells[j].str;
+	return page;
+}
+
+/* Helper: drop a snapshot's reference to a page (caller must hold mutex) */
+XSTDDEF_INLINE_API void xmap_page_unref_nolock(xmap_page_t *page) {
+	if (!page || --page->refs) return;
+	free(page->cells);
+	free(page);
+}
 
-	/* fix wstr index list */
-	for (size_t k = 0; k < xm->cwstr;) {
-		if (xm->wstr[k] == i) {
-			for (size_t m = k; m + 1 < xm->cwstr; ++m)
-				xm->wstr[m] = xm->wstr[m + 1];
-			xm->cwstr--;
+/* Helper: give every open snapshot that still reads page `k' from the
+   live map one shared copy of it (caller must hold mutex). The live
+   page is unchanged since each of those snapshots was taken, so one
+   copy serves them all. A failed copy marks them ENOMEM. */
+XSTDDEF_INLINE_API void xmap_snapshot_preserve_nolock(xmap_t *xm, size_t k) {
+	xmap_page_t *page = NULL;
+	for (xmap_snapshot_t *s = xm->snapshots; s; s = s->next) {
+		if ((k << XMAP_PAGE_SHIFT) >= s->count || s->pages[k] || s->error) continue;
+		if (!page && !(page = xmap_page_copy_nolock(xm, k))) {
+			__atomic_store_n(&s->error, ENOMEM, __ATOMIC_RELAXED);
 			continue;
 		}
-		if (xm->wstr[k] > i) xm->wstr[k]--;
-		k++;
+		page->refs++;
+		__atomic_store_n(&s->pages[k], page, __ATOMIC_RELEASE);
 	}
+}
 
-	xm->count--;
-	pthread_mutex_unlock(&xm->mutex);
+/* Helper: copy-on-write hook, called before map slots [first, end) are
+   changed (caller must hold mutex). Free unless a snapshot is open. */
+XSTDDEF_INLINE_API void xmap_cow_nolock(xmap_t *xm, size_t first, size_t end) {
+	if (!xm->snapshots) return;
+	size_t covered = 0;
+	for (xmap_snapshot_t *s = xm->snapshots; s; s = s->next)
+		if (s->count > covered) covered = s->count;
+	if (end > covered) end = covered;
+	if (first >= end) return;
+	for (size_t k = first >> XMAP_PAGE_SHIFT; k <= (end - 1) >> XMAP_PAGE_SHIFT; ++k)
+		xmap_snapshot_preserve_nolock(xm, k);
 }
 
-/* Erase entry but do not shift map (thread-safe). Frees pointer and sets slot NULL. */
-XSTDDEF_INLINE_API void xmap_erase_no_shift(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->count) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
-	}
-	if (!xm->map[i]) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
-	}
-	free(xm->map[i]);
-	xm->map[i] = NULL;
-	pthread_mutex_unlock(&xm->mutex);
+/* Helper: ensure map capacity (holds/assumes caller has not locked mutex:
+   this routine will not lock. Returns 1 on success, 0 on failure).
+   It updates xm->map and xm->capacity atomically (no mutex) — caller
+   MUST hold the mutex if concurrent use is possible.
+*/
+XSTDDEF_INLINE_API int xmap_ensure_capacity_nolock(xmap_t *xm, size_t mincap) {
+	/* appends land in [count, mincap), which an open snapshot still
+	   covers after shifting erases shrank the map */
+	xmap_cow_nolock(xm, xm->count, mincap);
+	if (xm->capacity >= mincap) return 1;
+	return xmap_set_capacity_nolock(xm, xmap_grow_capacity(xm, xm->capacity, mincap));
 }
 
-/* String erase by string-index (thread-safe): removes mapping and frees stored string, shifts arrays */
-XSTDDEF_INLINE_API void xmap_strerase(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->cstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
-	}
-	size_t ret = xm->str[i];
-	if (ret < xm->count && xm->map[ret]) {
-		free(xm->map[ret]);
-	}
-	/* shift map entries starting at ret */
-	for (size_t j = ret; j + 1 < xm->count; ++j)
-		xm->map[j] = xm->map[j + 1];
-	xm->map[xm->count - 1] = NULL;
+/* Helpers for str/wstr arrays (caller must hold mutex) */
+XSTDDEF_INLINE_API int xmap_ensure_str_capacity_locked(xmap_t *xm, size_t mincap) {
+	if (xm->cstr_capacity >= mincap) return 1;
+	return xmap_set_list_capacity_locked(xm, 0, xmap_grow_capacity(xm, xm->cstr_capacity, mincap));
+}
 
-	/* remove str index at i and shift left */
-	for (size_t j = i; j + 1 < xm->cstr; ++j)
-		xm->str[j] = xm->str[j + 1];
-	xm->cstr--;
+XSTDDEF_INLINE_API int xmap_ensure_wstr_capacity_locked(xmap_t *xm, size_t mincap) {
+	if (xm->cwstr_capacity >= mincap) return 1;
+	return xmap_set_list_capacity_locked(xm, 1, xmap_grow_capacity(xm, xm->cwstr_capacity, mincap));
+}
 
-	/* Fix all str/wstr indices that referenced indices after ret */
-	for (size_t k = 0; k < xm->cstr; ++k)
-		if (xm->str[k] > ret) xm->str[k]--;
-	for (size_t k = 0; k < xm->cwstr; ++k)
-		if (xm->wstr[k] > ret) xm->wstr[k]--;
+/* Set the growth factor in percent used when an array runs out of room
+   (thread-safe). 0 restores the default of 200 (doubling); other values
+   must exceed 100. Returns 1 on success, 0 on EINVAL. */
+XSTDDEF_INLINE_API int xmap_set_growth(xmap_t *xm, unsigned percent) {
+	if (percent != 0 && percent <= 100) {
+		errno = EINVAL;
+		return 0;
+	}
+	xmap_mutex_lock(xm);
+	xm->growth = percent;
+	xmap_mutex_unlock(xm);
+	return 1;
+}
 
-	xm->count--;
-	pthread_mutex_unlock(&xm->mutex);
+/* Pre-size the map and the str/wstr lists for at least the given number
+   of entries (thread-safe). Never shrinks. Returns 1 on success, 0 on
+   failure (errno set). */
+XSTDDEF_INLINE_API int xmap_reserve(xmap_t *xm, size_t entries, size_t strs, size_t wstrs) {
+	xmap_lock(xm);
+	int ok = (entries <= xm->capacity || xmap_set_capacity_nolock(xm, entries))
+		&& (strs <= xm->cstr_capacity || xmap_set_list_capacity_locked(xm, 0, strs))
+		&& (wstrs <= xm->cwstr_capacity || xmap_set_list_capacity_locked(xm, 1, wstrs));
+	xmap_unlock(xm);
+	return ok;
 }
 
-/* String erase by string-index (thread-safe): removes mapping and frees stored string, shifts arrays */
-XSTDDEF_INLINE_API void xmap_wcserase(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
+/* Hash functions for the keyed store (FNV-1a / splitmix finalizer) */
+XSTDDEF_INLINE_API size_t xmap_hash_str(const char *key) {
+	uint64_t h = 14695981039346656037ULL;
+	for (const unsigned char *p = (const unsigned char *)key; *p; ++p) {
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return (size_t)h;
+}
 
-	if (i >= xm->cwstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
+XSTDDEF_INLINE_API size_t xmap_hash_wcs(const wchar_t *key) {
+	uint64_t h = 14695981039346656037ULL;
+	for (const wchar_t *p = key; *p; ++p) {
+		h ^= (uint64_t)(uint32_t)*p;
+		h *= 1099511628211ULL;
 	}
+	return (size_t)h;
+}
 
-	size_t ret = xm->wstr[i];
+XSTDDEF_INLINE_API size_t xmap_hash_int(uintptr_t key) {
+	uint64_t h = (uint64_t)key;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return (size_t)h;
+}
 
-	/* Free map[ret] *before* shifting */
-	if (ret < xm->count && xm->map[ret]) {
-		free(xm->map[ret]);
-		xm->map[ret] = NULL;
+/* Helper: locate the slot holding a key (caller must hold mutex).
+   Returns the slot index, or (size_t)-1 if the key is not present. */
+XSTDDEF_INLINE_API size_t xmap_hash_lookup_locked(xmap_hash_t *h, int kind, size_t hash, uintptr_t ikey, const void *pkey) {
+	if (h->count == 0) return (size_t)-1;
+	size_t mask = h->capacity - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		xmap_slot_t *s = &h->slots[i];
+		if (s->kind == XMAP_KEY_EMPTY) return (size_t)-1;
+		if (s->kind != kind || s->hash != hash) continue;
+		if (kind == XMAP_KEY_INT) {
+			if (s->ikey == ikey) return i;
+		} else if (kind == XMAP_KEY_STR) {
+			if (strcmp((const char *)s->pkey, (const char *)pkey) == 0) return i;
+		} else if (wcscmp((const wchar_t *)s->pkey, (const wchar_t *)pkey) == 0) {
+			return i;
+		}
 	}
+}
 
-	/* Shift map entries left */
-	for (size_t j = ret; j + 1 < xm->count; ++j)
-		xm->map[j] = xm->map[j + 1];
-	xm->map[xm->count - 1] = NULL;
+/* Helper: rehash into `newcap' slots, a power of two with room for every
+   live key, dropping tombstones (caller must hold mutex). `newcap' 0
+   frees the table. Returns 1 on success, 0 on failure. */
+XSTDDEF_INLINE_API int xmap_hash_rehash_locked(xmap_hash_t *h, size_t newcap) {
+	if (newcap == 0) {
+		free(h->slots);
+		h->slots = NULL;
+		h->capacity = 0;
+		h->used = 0;
+		return 1;
+	}
+	xmap_slot_t *slots = (xmap_slot_t *)calloc(newcap, sizeof(xmap_slot_t));
+	if (!slots) {
+		errno = ENOMEM;
+		return 0;
+	}
+	size_t mask = newcap - 1;
+	for (size_t i = 0; i < h->capacity; ++i) {
+		xmap_slot_t *s = &h->slots[i];
+		if (s->kind == XMAP_KEY_EMPTY || s->kind == XMAP_KEY_DEAD) continue;
+		size_t j = s->hash & mask;
+		while (slots[j].kind != XMAP_KEY_EMPTY) j = (j + 1) & mask;
+		slots[j] = *s;
+	}
+	free(h->slots);
+	h->slots = slots;
+	h->capacity = newcap;
+	h->used = h->count;
+	return 1;
+}
+
+/* Helper: make room for `extra' more keys (caller must hold mutex). Grows
+   or rehashes in place to drop tombstones once the table is 3/4 used.
+   Returns 1 on success, 0 on failure. */
+XSTDDEF_INLINE_API int xmap_hash_reserve_locked(xmap_hash_t *h, size_t extra) {
+	if ((h->used + extra) * 4 < h->capacity * 3) return 1;
+	size_t newcap = (h->capacity == 0) ? 16 : h->capacity;
+	while ((h->count + extra) * 4 >= newcap * 3) newcap *= 2;
+	return xmap_hash_rehash_locked(h, newcap);
+}
+
+/* Helper: store a key known to be absent into a table that has room
+   (caller must hold mutex and have called xmap_hash_reserve_locked).
+   Reuses the first tombstone on the probe path. */
+XSTDDEF_INLINE_API void xmap_hash_insert_locked(xmap_hash_t *h, int kind, size_t hash, uintptr_t ikey, void *pkey, void *value) {
+	size_t mask = h->capacity - 1;
+	size_t j = hash & mask;
+	while (h->slots[j].kind != XMAP_KEY_EMPTY && h->slots[j].kind != XMAP_KEY_DEAD)
+		j = (j + 1) & mask;
+	if (h->slots[j].kind == XMAP_KEY_EMPTY) h->used++;
+	h->slots[j].hash = hash;
+	h->slots[j].kind = kind;
+	h->slots[j].ikey = ikey;
+	h->slots[j].pkey = pkey;
+	h->slots[j].value = value;
+	h->count++;
+}
+
+/* Helper: bump-allocate `size' bytes aligned to `align' from the map's
+   arena (caller must hold mutex). Chunks start at 4 KiB and double up to
+   8 MiB; requests larger than a chunk get a dedicated chunk behind the
+   current one. Returns NULL on failure (errno set). */
+XSTDDEF_INLINE_API void* xmap_arena_alloc_nolock(xmap_t *xm, size_t size, size_t align) {
+	xmap_chunk_t *c = xm->arena;
+	if (c) {
+		size_t off = (c->used + align - 1) & ~(align - 1);
+		if (off + size <= c->size) {
+			c->used = off + size;
+			return (char *)(c + 1) + off;
+		}
+	}
+
+	size_t csize = c ? c->size * 2 : 4096;
+	if (csize > 8388608) csize = 8388608;
+	int dedicated = (size + align > csize);
+	if (dedicated) csize = size + align;
+
+	xmap_chunk_t *n = (xmap_chunk_t *)xmap_elem_alloc(xm, sizeof(xmap_chunk_t) + csize);
+	if (!n) return NULL;
+	n->size = csize;
+	n->used = size;
+	if (dedicated && c) {
+		/* keep bump-allocating from the current chunk */
+		n->next = c->next;
+		c->next = n;
+	} else {
+		n->next = c;
+		xm->arena = n;
+	}
+	return (char *)(n + 1);
+}
+
+/* Helper: copy `size' bytes into the arena (caller must hold mutex) */
+XSTDDEF_INLINE_API void* xmap_arena_dup_nolock(xmap_t *xm, const void *src, size_t size, size_t align) {
+	void *p = xmap_arena_alloc_nolock(xm, size, align);
+	if (p) memcpy(p, src, size);
+	return p;
+}
+
+/* Helper: postpone an element release until the last view ends (caller
+   must hold mutex). On allocation failure the element is leaked rather
+   than freed under a reader. */
+XSTDDEF_INLINE_API void xmap_defer_nolock(xmap_t *xm, void *ptr, int value) {
+	xmap_retired_t *r = (xmap_retired_t *)malloc(sizeof(xmap_retired_t));
+	if (!r) {
+		errno = ENOMEM;
+		return;
+	}
+	r->ptr = ptr;
+	r->value = value;
+	r->next = xm->deferred;
+	xm->deferred = r;
+}
+
+/* Helper: release a heap string copy made by the map (caller must hold
+   mutex). Arena and image copies are tagged XMAP_ENTRY_SHARED and are
+   reclaimed with their chunk or mapping instead; they never get here. */
+XSTDDEF_INLINE_API void xmap_release_nolock(xmap_t *xm, void *ptr) {
+	if (!ptr) return;
+	if (xm->views) xmap_defer_nolock(xm, ptr, 0);
+	else xmap_elem_free(xm, ptr);
+}
+
+/* Helper: release a caller-supplied value (caller must hold mutex):
+   destructor if set, nothing for XMAP_NONOWNING maps, else the allocator. */
+XSTDDEF_INLINE_API void xmap_release_value_nolock(xmap_t *xm, void *ptr) {
+	if (!ptr) return;
+	if (!xm->dtor && (xm->flags & XMAP_NONOWNING)) return;
+	if (xm->views) xmap_defer_nolock(xm, ptr, 1);
+	else if (xm->dtor) xm->dtor(ptr, xm->dtor_ctx);
+	else xmap_elem_free(xm, ptr);
+}
+
+/* Helper: run the releases postponed by open views (caller must hold
+   mutex and no view may be open) */
+XSTDDEF_INLINE_API void xmap_flush_deferred_nolock(xmap_t *xm) {
+	while (xm->deferred) {
+		xmap_retired_t *r = xm->deferred;
+		xm->deferred = r->next;
+		if (r->value) xmap_release_value_nolock(xm, r->ptr);
+		else xmap_release_nolock(xm, r->ptr);
+		free(r);
+	}
+}
+
+/* Helper: is map index `i' referenced by the str or wstr list? Read from
+   the slot's tag (caller must hold mutex, i < count). */
+XSTDDEF_INLINE_API int xmap_is_string_slot_nolock(xmap_t *xm, size_t i) {
+	int type = XMAP_ENTRY_TYPE(xm->tags[i]);
+	return type == XMAP_ENTRY_STR || type == XMAP_ENTRY_WCS;
+}
+
+/* Helper: length in characters of the string in map slot `i', measured
+   once and cached in its tag (caller must hold mutex, slot non-NULL) */
+XSTDDEF_INLINE_API size_t xmap_entry_len_nolock(xmap_t *xm, size_t i) {
+	size_t tag = xm->tags[i];
+	if (XMAP_ENTRY_LEN(tag) != XMAP_ENTRY_NOLEN) return XMAP_ENTRY_LEN(tag);
+	size_t len = (XMAP_ENTRY_TYPE(tag) == XMAP_ENTRY_WCS)
+		? wcslen((const wchar_t *)xm->map[i]) : strlen((const char *)xm->map[i]);
+	xm->tags[i] = XMAP_ENTRY_TAG(XMAP_ENTRY_TYPE(tag), len) | (tag & (XMAP_ENTRY_INLINE | XMAP_ENTRY_SHARED | XMAP_ENTRY_DEAD));
+	return len;
+}
+
+/* Helper: position of the first entry of the str (wide == 0) or wstr
+   list whose map index is >= i. Binary search, both lists being sorted
+   by map index (caller must hold mutex). */
+XSTDDEF_INLINE_API size_t xmap_list_lower_nolock(xmap_t *xm, int wide, size_t i) {
+	const size_t *list = wide ? xm->wstr : xm->str;
+	size_t lo = 0, hi = wide ? xm->cwstr : xm->cstr;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (list[mid] < i) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* Helper: does a string of `len' characters of `csize' bytes go in an
+   inline cell? Interned strings never do: their handles are shared. */
+XSTDDEF_INLINE_API int xmap_inline_fits(xmap_t *xm, size_t len, size_t csize) {
+	return (xm->flags & XMAP_INLINE) && !(xm->flags & XMAP_INTERN) && (len + 1) * csize <= XMAP_INLINE_SIZE;
+}
+
+/* Helper: copy a string of `size' bytes into the cell of map slot `i'
+   (caller must hold mutex, i < capacity) */
+XSTDDEF_INLINE_API void* xmap_inline_put_nolock(xmap_t *xm, size_t i, const void *str, size_t size) {
+	memcpy(xm->cells[i].str, str, size);
+	return xm->cells[i].str;
+}
+
+/* Helper: release whatever map[i] holds (caller must hold mutex) */
+XSTDDEF_INLINE_API void xmap_release_slot_nolock(xmap_t *xm, size_t i) {
+	if (xm->tags[i] & (XMAP_ENTRY_INLINE | XMAP_ENTRY_SHARED)) return;
+	if (XMAP_ENTRY_TYPE(xm->tags[i]) != XMAP_ENTRY_VALUE) xmap_release_nolock(xm, xm->map[i]);
+	else xmap_release_value_nolock(xm, xm->map[i]);
+}
+
+/* Helper: return the interned copy of a string, creating it in the arena
+   if needed (caller must hold mutex). `kind' is XMAP_KEY_STR or
+   XMAP_KEY_WCS and `hash' its xmap_hash_str/xmap_hash_wcs value.
+   Returns NULL on failure (errno set). */
+XSTDDEF_INLINE_API void* xmap_intern_nolock(xmap_t *xm, int kind, size_t hash, const void *str) {
+	size_t i = xmap_hash_lookup_locked(&xm->intern, kind, hash, 0, str);
+	if (i != (size_t)-1) return xm->intern.slots[i].pkey;
+	if (!xmap_hash_reserve_locked(&xm->intern, 1)) return NULL;
+	void *copy = (kind == XMAP_KEY_STR)
+		? xmap_arena_dup_nolock(xm, str, strlen((const char *)str) + 1, 1)
+		: xmap_arena_dup_nolock(xm, str, (wcslen((const wchar_t *)str) + 1) * sizeof(wchar_t), sizeof(wchar_t));
+	if (!copy) return NULL;
+	xmap_hash_insert_locked(&xm->intern, kind, hash, 0, copy, NULL);
+	return copy;
+}
+
+/* Intern a string (thread-safe): returns a stable handle shared by every
+   identical string interned in this map, valid until xmap_destroy(). Two
+   handles are equal iff the strings are equal. Does not add a positional
+   entry. Returns NULL on failure (errno set). */
+XSTDDEF_INLINE_API const char* xmap_strintern(xmap_t *xm, const char *str) {
+	if (!str) {
+		errno = EINVAL;
+		return NULL;
+	}
+	size_t hash = xmap_hash_str(str);
+	xmap_mutex_lock(xm);
+	const char *h = (const char *)xmap_intern_nolock(xm, XMAP_KEY_STR, hash, str);
+	xmap_mutex_unlock(xm);
+	return h;
+}
+
+XSTDDEF_INLINE_API const wchar_t* xmap_wcsintern(xmap_t *xm, const wchar_t *str) {
+	if (!str) {
+		errno = EINVAL;
+		return NULL;
+	}
+	size_t hash = xmap_hash_wcs(str);
+	xmap_mutex_lock(xm);
+	const wchar_t *h = (const wchar_t *)xmap_intern_nolock(xm, XMAP_KEY_WCS, hash, str);
+	xmap_mutex_unlock(xm);
+	return h;
+}
+
+/* Number of distinct interned strings (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_interncount(xmap_t *xm) {
+	xmap_mutex_lock(xm);
+	size_t n = xm->intern.count;
+	xmap_mutex_unlock(xm);
+	return n;
+}
+
+/* Lock-free positional get (XMAP_READMOSTLY maps only) */
+XSTDDEF_INLINE_API void* xmap_get_lockfree(xmap_t *xm, size_t i) {
+	void *data;
+	unsigned long s;
+	do {
+		s = xmap_read_begin(xm);
+		data = NULL;
+		if (i < __atomic_load_n(&xm->count, __ATOMIC_ACQUIRE)) {
+			void **map = __atomic_load_n(&xm->map, __ATOMIC_ACQUIRE);
+			data = __atomic_load_n(&map[i], __ATOMIC_RELAXED);
+		}
+	} while (xmap_read_retry(xm, s));
+	return data;
+}
+
+/* Lock-free get by string-index (XMAP_READMOSTLY maps only).
+   `wide' selects the wstr list instead of the str list. */
+XSTDDEF_INLINE_API void* xmap_listget_lockfree(xmap_t *xm, int wide, size_t i) {
+	void *data;
+	unsigned long s;
+	do {
+		s = xmap_read_begin(xm);
+		data = NULL;
+		size_t n = __atomic_load_n(wide ? &xm->cwstr : &xm->cstr, __ATOMIC_ACQUIRE);
+		if (i < n) {
+			size_t *list = __atomic_load_n(wide ? &xm->wstr : &xm->str, __ATOMIC_ACQUIRE);
+			size_t ret = __atomic_load_n(&list[i], __ATOMIC_RELAXED);
+			if (ret < __atomic_load_n(&xm->count, __ATOMIC_ACQUIRE)) {
+				void **map = __atomic_load_n(&xm->map, __ATOMIC_ACQUIRE);
+				data = __atomic_load_n(&map[ret], __ATOMIC_RELAXED);
+			}
+		}
+	} while (xmap_read_retry(xm, s));
+	return data;
+}
+
+/* Exists? (thread-safe) */
+XSTDDEF_INLINE_API int xmap_exists(xmap_t *xm, size_t i) {
+	if (xm->flags & XMAP_READMOSTLY) return xmap_get_lockfree(xm, i) != NULL;
+	xmap_mutex_lock(xm);
+	int exists = (i < xm->count && xm->map[i] != NULL);
+	xmap_mutex_unlock(xm);
+	return exists;
+}
+
+/* String/wstring existence by string-index (thread-safe) */
+XSTDDEF_INLINE_API int xmap_strexists(xmap_t *xm, size_t i) {
+	if (xm->flags & XMAP_READMOSTLY) return xmap_listget_lockfree(xm, 0, i) != NULL;
+	xmap_mutex_lock(xm);
+	if (i >= xm->cstr) {
+		xmap_mutex_unlock(xm);
+		return 0;
+	}
+	size_t ret = xm->str[i];
+	int exists = (ret < xm->count && xm->map[ret] != NULL);
+	xmap_mutex_unlock(xm);
+	return exists;
+}
+
+XSTDDEF_INLINE_API int xmap_wcsexists(xmap_t *xm, size_t i) {
+	if (xm->flags & XMAP_READMOSTLY) return xmap_listget_lockfree(xm, 1, i) != NULL;
+	xmap_mutex_lock(xm);
+	if (i >= xm->cwstr) {
+		xmap_mutex_unlock(xm);
+		return 0;
+	}
+	size_t ret = xm->wstr[i];
+	int exists = (ret < xm->count && xm->map[ret] != NULL);
+	xmap_mutex_unlock(xm);
+	return exists;
+}
+
+/* Insert data pointer (thread-safe) */
+XSTDDEF_INLINE_API void xmap_insert(xmap_t *xm, void *data) {
+	xmap_lock(xm);
+	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) {
+		/* errno set by ensure; leave map unchanged */
+		xmap_unlock(xm);
+		return;
+	}
+	xm->tags[xm->count] = XMAP_ENTRY_VALUE;
+	xmap_store(xm->map[xm->count], data);
+	xmap_store(xm->count, xm->count + 1);
+	xmap_unlock(xm);
+}
+
+/* Non-locking insert (caller must hold mutex) */
+XSTDDEF_INLINE_API int xmap_insert_nolock(xmap_t *xm, void *data) {
+	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) return 0;
+	xm->tags[xm->count] = XMAP_ENTRY_VALUE;
+	xmap_store(xm->map[xm->count], data);
+	xmap_store(xm->count, xm->count + 1);
+	return 1;
+}
+
+/* Helper: copy `len' characters of `csize' bytes from `src' to `dst' and
+   terminate them. Returns dst. */
+XSTDDEF_INLINE_API void* xmap_termcpy(void *dst, const void *src, size_t len, size_t csize) {
+	memcpy(dst, src, len * csize);
+	memset((char *)dst + len * csize, 0, csize);
+	return dst;
+}
+
+/* Helper: append a string entry whose heap, interned or adopted copy is
+   `copy' (NULL for an inline or arena copy of `str', made here). `shared'
+   says the arena owns `copy' (interned). Caller must hold mutex. On
+   failure a heap `copy' is released. Returns 1 on success. */
+XSTDDEF_INLINE_API int xmap_listinsert_nolock(xmap_t *xm, int wide, const void *str, size_t len, int inl, void *copy, int shared) {
+	size_t csize = wide ? sizeof(wchar_t) : 1;
+	if (!copy && !inl) {
+		copy = xmap_arena_alloc_nolock(xm, (len + 1) * csize, csize);
+		if (!copy) return 0;
+		xmap_termcpy(copy, str, len, csize);
+		shared = 1;
+	}
+	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) {
+		if (!shared) xmap_release_nolock(xm, copy);
+		return 0;
+	}
+	xm->tags[xm->count] = XMAP_ENTRY_TAG(wide ? XMAP_ENTRY_WCS : XMAP_ENTRY_STR, len)
+		| (inl ? XMAP_ENTRY_INLINE : 0) | (shared ? XMAP_ENTRY_SHARED : 0);
+	/* an inline copy is never released: rollback below leaves it alone */
+	xmap_store(xm->map[xm->count], inl ? xmap_termcpy(xm->cells[xm->count].str, str, len, csize) : copy);
+	xmap_store(xm->count, xm->count + 1);
+	if (!(wide ? xmap_ensure_wstr_capacity_locked(xm, xm->cwstr + 1) : xmap_ensure_str_capacity_locked(xm, xm->cstr + 1))) {
+		/* cannot expand the index list: rollback insertion */
+		if (!shared) xmap_release_nolock(xm, copy);
+		xmap_store(xm->count, xm->count - 1);
+		xmap_store(xm->map[xm->count], (void *)NULL);
+		return 0;
+	}
+	size_t *list = wide ? xm->wstr : xm->str, *n = wide ? &xm->cwstr : &xm->cstr;
+	xmap_store(list[*n], xm->count - 1);
+	xmap_store(*n, *n + 1);
+	return 1;
+}
+
+/* Helper shared by the string inserts: append the `len' characters of
+   `str' (wchar_t if wide) as a string entry. `str' need not be
+   terminated unless `terminated' says so. `adopt', if not NULL, is a
+   terminated copy of it from the element allocator that the map keeps
+   instead of copying again; it is released on failure. Arena and
+   interning maps copy it into their own storage and release it at once,
+   so every string they hold goes away with the arena. Returns 1 on
+   success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_listinsert_impl(xmap_t *xm, int wide, const void *str, size_t len, int terminated, void *adopt) {
+	size_t csize = wide ? sizeof(wchar_t) : 1, hash = 0;
+	int inl = !adopt && xmap_inline_fits(xm, len, csize);
+	void *copy = (xm->flags & XMAP_ARENA) ? NULL : adopt, *term = NULL;
+	if (xm->flags & XMAP_INTERN) {
+		/* interning hashes and compares terminated strings */
+		term = adopt ? adopt : terminated ? (void *)str : malloc((len + 1) * csize);
+		if (!term) {
+			errno = ENOMEM;
+			return 0;
+		}
+		if (term != str) xmap_termcpy(term, str, len, csize);
+		hash = wide ? xmap_hash_wcs((const wchar_t *)term) : xmap_hash_str((const char *)term);
+	} else if (!copy && !inl && !(xm->flags & XMAP_ARENA)) {
+		copy = xmap_elem_alloc(xm, (len + 1) * csize);
+		if (!copy) return 0;
+		xmap_termcpy(copy, str, len, csize);
+	}
+
+	xmap_lock(xm);
+	if (term) copy = xmap_intern_nolock(xm, wide ? XMAP_KEY_WCS : XMAP_KEY_STR, hash, term);
+	int ok = (!term || copy) && xmap_listinsert_nolock(xm, wide, str, len, inl, copy, term != NULL);
+	xmap_unlock(xm);
+	/* an interned or arena copy was made from `term' or `str' */
+	if (adopt && copy != adopt) xmap_elem_free(xm, adopt);
+	else if (term && term != str) free(term);
+	return ok;
+}
+
+/* String Insert data pointer (thread-safe) */
+XSTDDEF_INLINE_API void xmap_strinsert(xmap_t *xm, const char* str) {
+	if (!str) return;
+	xmap_listinsert_impl(xm, 0, str, strlen(str), 1, NULL);
+}
+
+/* Length-aware string insert (thread-safe): copies the first `len'
+   characters of `str', which need not be terminated, without measuring
+   it again. Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_strninsert(xmap_t *xm, const char *str, size_t len) {
+	if (!str && len) {
+		errno = EINVAL;
+		return 0;
+	}
+	return xmap_listinsert_impl(xm, 0, str ? str : "", len, 0, NULL);
+}
+
+/* Adopting string insert (thread-safe): the map takes over `str', a
+   terminated string of `len' characters allocated with the map's element
+   allocator (malloc() unless xmap_init_alloc() installed one), instead of
+   copying it. Arena and interning maps copy it into the arena and release
+   it. On failure `str' is released too. Returns 1 on success, 0 on
+   failure (errno set). */
+XSTDDEF_INLINE_API int xmap_stradopt(xmap_t *xm, char *str, size_t len) {
+	if (!str) {
+		errno = EINVAL;
+		return 0;
+	}
+	return xmap_listinsert_impl(xm, 0, str, len, 1, str);
+}
+
+/* Non-locking variant: caller must hold mutex */
+XSTDDEF_INLINE_API int xmap_strinsert_nolock(xmap_t *xm, const char* str) {
+	if (!str) return 0;
+	size_t len = strlen(str);
+	int inl = xmap_inline_fits(xm, len, 1);
+	char* copy = inl ? NULL
+		: (xm->flags & XMAP_INTERN)
+		? (char *)xmap_intern_nolock(xm, XMAP_KEY_STR, xmap_hash_str(str), str)
+		: (xm->flags & XMAP_ARENA)
+		? (char *)xmap_arena_dup_nolock(xm, str, len + 1, 1)
+		: (char *)xmap_elem_dup(xm, str, len + 1);
+	if (!copy && !inl) {
+		errno = ENOMEM;
+		return 0;
+	}
+	int shared = !inl && (xm->flags & (XMAP_INTERN | XMAP_ARENA));
+	if (!xmap_insert_nolock(xm, copy)) {
+		if (!shared) xmap_release_nolock(xm, copy);
+		return 0;
+	}
+	if (!xmap_ensure_str_capacity_locked(xm, xm->cstr + 1)) {
+		/* rollback */
+		xmap_store(xm->count, xm->count - 1);
+		if (!shared) xmap_release_nolock(xm, copy);
+		return 0;
+	}
+	if (inl) xmap_store(xm->map[xm->count - 1], xmap_inline_put_nolock(xm, xm->count - 1, str, len + 1));
+	xm->tags[xm->count - 1] = XMAP_ENTRY_TAG(XMAP_ENTRY_STR, len)
+		| (inl ? XMAP_ENTRY_INLINE : 0) | (shared ? XMAP_ENTRY_SHARED : 0);
+	xmap_store(xm->str[xm->cstr], xm->count - 1);
+	xmap_store(xm->cstr, xm->cstr + 1);
+	return 1;
+}
+
+/* String getter (thread-safe, except for XMAP_INLINE entries: their
+   pointer is into the cell array, which any later write may move or
+   reallocate; use xmap_lease_str() or a view to read those) */
+XSTDDEF_INLINE_API char* xmap_strget(xmap_t *xm, size_t i) {
+	if (xm->flags & XMAP_READMOSTLY) return xmap_cast(char*, xmap_listget_lockfree(xm, 0, i));
+	xmap_mutex_lock(xm);
+	if (i >= xm->cstr) {
+		xmap_mutex_unlock(xm);
+		return NULL;
+	}
+	size_t ret = xm->str[i];
+	if (ret >= xm->count) {
+		xmap_mutex_unlock(xm);
+		return NULL;
+	}
+	void *ptr = xm->map[ret];
+	xmap_mutex_unlock(xm);
+	if (!ptr) return NULL;
+	return xmap_cast(char*, ptr);
+}
+
+/* Wchar Insert data pointer (thread-safe) */
+XSTDDEF_INLINE_API void xmap_wcsinsert(xmap_t *xm, const wchar_t *str) {
+	if (!str) return;
+	xmap_listinsert_impl(xm, 1, str, wcslen(str), 1, NULL);
+}
+
+/* Wide counterparts of xmap_strninsert() and xmap_stradopt() */
+XSTDDEF_INLINE_API int xmap_wcsninsert(xmap_t *xm, const wchar_t *str, size_t len) {
+	if (!str && len) {
+		errno = EINVAL;
+		return 0;
+	}
+	return xmap_listinsert_impl(xm, 1, str ? str : L"", len, 0, NULL);
+}
+
+XSTDDEF_INLINE_API int xmap_wcsadopt(xmap_t *xm, wchar_t *str, size_t len) {
+	if (!str) {
+		errno = EINVAL;
+		return 0;
+	}
+	return xmap_listinsert_impl(xm, 1, str, len, 1, str);
+}
+
+/* Wchar getter (thread-safe, except for XMAP_INLINE entries, as for
+   xmap_strget(); use xmap_lease_wcs() or a view to read those) */
+XSTDDEF_INLINE_API wchar_t* xmap_wcsget(xmap_t *xm, size_t i) {
+	if (xm->flags & XMAP_READMOSTLY) return xmap_cast(wchar_t*, xmap_listget_lockfree(xm, 1, i));
+	xmap_mutex_lock(xm);
+	if (i >= xm->cwstr) {
+		xmap_mutex_unlock(xm);
+		return NULL;
+	}
+	size_t ret = xm->wstr[i];
+	if (ret >= xm->count) {
+		xmap_mutex_unlock(xm);
+		return NULL;
+	}
+	void *ptr = xm->map[ret];
+	xmap_mutex_unlock(xm);
+	if (!ptr) return NULL;
+	return xmap_cast(wchar_t*, ptr);
+}
+
+/* Helper shared by xmap_strlen/xmap_wcslen */
+XSTDDEF_INLINE_API size_t xmap_listlen_impl(xmap_t *xm, int wide, size_t i) {
+	size_t len = (size_t)-1;
+	xmap_mutex_lock(xm);
+	if (i < (wide ? xm->cwstr : xm->cstr)) {
+		size_t ret = wide ? xm->wstr[i] : xm->str[i];
+		if (ret < xm->count && xm->map[ret]) len = xmap_entry_len_nolock(xm, ret);
+	}
+	xmap_mutex_unlock(xm);
+	return len;
+}
+
+/* String length by string-index (thread-safe): the length in characters
+   without the terminator, cached in the entry tag when the string was
+   inserted. Returns (size_t)-1 if there is no such string. */
+XSTDDEF_INLINE_API size_t xmap_strlen(xmap_t *xm, size_t i) {
+	return xmap_listlen_impl(xm, 0, i);
+}
+
+XSTDDEF_INLINE_API size_t xmap_wcslen(xmap_t *xm, size_t i) {
+	return xmap_listlen_impl(xm, 1, i);
+}
+
+/* Helper shared by xmap_lease_str/xmap_lease_wcs */
+XSTDDEF_INLINE_API int xmap_lease_impl(xmap_t *xm, int wide, size_t i, xmap_lease_t *l) {
+	l->xm = NULL;
+	l->str = NULL;
+	l->len = 0;
+	xmap_mutex_lock(xm);
+	size_t ret = (i < (wide ? xm->cwstr : xm->cstr)) ? (wide ? xm->wstr[i] : xm->str[i]) : (size_t)-1;
+	if (ret == (size_t)-1 || ret >= xm->count || !xm->map[ret]) {
+		xmap_mutex_unlock(xm);
+		errno = ENOENT;
+		return 0;
+	}
+	l->len = xmap_entry_len_nolock(xm, ret);
+	if (xm->tags[ret] & XMAP_ENTRY_INLINE) {
+		/* cells move with their slots: take a copy */
+		memcpy(l->buf.str, xm->map[ret], (l->len + 1) * (wide ? sizeof(wchar_t) : 1));
+		l->str = l->buf.str;
+	} else {
+		l->str = xm->map[ret];
+		l->xm = xm;
+		xm->views++;
+	}
+	xmap_mutex_unlock(xm);
+	return 1;
+}
+
+/* Lease string `i' (thread-safe): points l->str at the string and sets
+   l->len to its cached length, without copying it. Erases and
+   replacements postpone releasing it until xmap_lease_end(). Returns 1
+   on success, 0 if there is no such string (errno ENOENT). */
+XSTDDEF_INLINE_API int xmap_lease_str(xmap_t *xm, size_t i, xmap_lease_t *l) {
+	return xmap_lease_impl(xm, 0, i, l);
+}
+
+XSTDDEF_INLINE_API int xmap_lease_wcs(xmap_t *xm, size_t i, xmap_lease_t *l) {
+	return xmap_lease_impl(xm, 1, i, l);
+}
+
+/* End a lease (thread-safe). Safe on a lease that failed. */
+XSTDDEF_INLINE_API void xmap_lease_end(xmap_lease_t *l) {
+	xmap_t *xm = l->xm;
+	l->xm = NULL;
+	l->str = NULL;
+	if (!xm) return;
+	xmap_mutex_lock(xm);
+	if (--xm->views == 0) xmap_flush_deferred_nolock(xm);
+	xmap_mutex_unlock(xm);
+}
+
+/* Binary-safe insert (thread-safe): appends a copy of the `len' bytes at
+   `data', embedded NULs included, as a positional entry of type
+   XMAP_ENTRY_MEM with its length in the tag. The copy is followed by a
+   NUL byte that is not counted, so text payloads still read as C strings.
+   Returns the new map index, or (size_t)-1 on failure (errno set). */
+XSTDDEF_INLINE_API size_t xmap_meminsert(xmap_t *xm, const void *data, size_t len) {
+	if ((!data && len) || len >= XMAP_ENTRY_NOLEN) {
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+	if (!data) data = "";
+	int inl = xmap_inline_fits(xm, len, 1);
+	void *copy = NULL;
+	if (!inl && !(xm->flags & XMAP_ARENA)) {
+		copy = xmap_elem_alloc(xm, len + 1);
+		if (!copy) return (size_t)-1;
+		xmap_termcpy(copy, data, len, 1);
+	}
+
+	xmap_lock(xm);
+	if (!copy && !inl) {
+		copy = xmap_arena_alloc_nolock(xm, len + 1, 1);
+		if (!copy) {
+			xmap_unlock(xm);
+			return (size_t)-1;
+		}
+		xmap_termcpy(copy, data, len, 1);
+	}
+	int shared = !inl && (xm->flags & XMAP_ARENA);
+	if (!xmap_ensure_capacity_nolock(xm, xm->count + 1)) {
+		if (!shared) xmap_release_nolock(xm, copy);
+		xmap_unlock(xm);
+		return (size_t)-1;
+	}
+	size_t i = xm->count;
+	xm->tags[i] = XMAP_ENTRY_TAG(XMAP_ENTRY_MEM, len) | (inl ? XMAP_ENTRY_INLINE : 0) | (shared ? XMAP_ENTRY_SHARED : 0);
+	xmap_store(xm->map[i], inl ? xmap_termcpy(xm->cells[i].str, data, len, 1) : copy);
+	xmap_store(xm->count, i + 1);
+	xmap_unlock(xm);
+	return i;
+}
+
+/* Binary entry at map index `i' (thread-safe): returns the data and
+   stores its length in *len (if not NULL) in O(1), or returns NULL if
+   slot `i' is missing, erased or not an XMAP_ENTRY_MEM entry. Like
+   xmap_get(), the pointer is valid until the entry is erased; an inline
+   entry's pointer only until the next write (not thread-safe). */
+XSTDDEF_INLINE_API void* xmap_memget(xmap_t *xm, size_t i, size_t *len) {
+	void *ptr = NULL;
+	xmap_mutex_lock(xm);
+	if (i < xm->count && XMAP_ENTRY_TYPE(xm->tags[i]) == XMAP_ENTRY_MEM) {
+		ptr = xm->map[i];
+		if (ptr && len) *len = XMAP_ENTRY_LEN(xm->tags[i]);
+	}
+	xmap_mutex_unlock(xm);
+	return ptr;
+}
+
+/* Entry type of map index `i' (thread-safe): XMAP_ENTRY_VALUE,
+   XMAP_ENTRY_STR, XMAP_ENTRY_WCS or XMAP_ENTRY_MEM, or -1 if i >= count.
+   Tombstoned slots keep their type until compaction. */
+XSTDDEF_INLINE_API int xmap_entry_type(xmap_t *xm, size_t i) {
+	xmap_mutex_lock(xm);
+	int type = (i < xm->count) ? XMAP_ENTRY_TYPE(xm->tags[i]) : -1;
+	xmap_mutex_unlock(xm);
+	return type;
+}
+
+/* Copy the counters of an XMAP_STATS map into *out (thread-safe: taken
+   under the map lock like every other accessor, whose acquisition is
+   itself counted in `locks'). Returns 1 on success, 0 if the map was not
+   initialized with XMAP_STATS (errno EINVAL, *out zeroed). */
+XSTDDEF_INLINE_API int xmap_stats(xmap_t *xm, xmap_stats_t *out) {
+	if (!(xm->flags & XMAP_STATS)) {
+		memset(out, 0, sizeof(*out));
+		errno = EINVAL;
+		return 0;
+	}
+	xmap_mutex_lock(xm);
+	*out = xm->stats;
+	xmap_mutex_unlock(xm);
+	return 1;
+}
+
+/* Zero the counters of an XMAP_STATS map (thread-safe) */
+XSTDDEF_INLINE_API void xmap_stats_reset(xmap_t *xm) {
+	xmap_mutex_lock(xm);
+	memset(&xm->stats, 0, sizeof(xm->stats));
+	xmap_mutex_unlock(xm);
+}
+
+/* Generic get (thread-safe) - avoids nested locking by checking directly.
+   Not thread-safe for XMAP_INLINE string entries, as for xmap_strget(). */
+XSTDDEF_INLINE_API void* xmap_get(xmap_t* xm, size_t i) {
+	if (xm->flags & XMAP_READMOSTLY) return xmap_get_lockfree(xm, i);
+	xmap_mutex_lock(xm);
+	if (i >= xm->count) {
+		xmap_mutex_unlock(xm);
+		return NULL;
+	}
+	void *data = xm->map[i];
+	xmap_mutex_unlock(xm);
+	return data;
+}
+
+/* Batch insert (thread-safe): appends `n' pointers with a single lock and
+   at most one reallocation. All-or-nothing: returns n on success, 0 on
+   failure (errno set, map unchanged). */
+XSTDDEF_INLINE_API size_t xmap_insert_many(xmap_t *xm, void *const *data, size_t n) {
+	if (n == 0) return 0;
+	xmap_lock(xm);
+	if (!xmap_ensure_capacity_nolock(xm, xm->count + n)) {
+		xmap_unlock(xm);
+		return 0;
+	}
+	xmap_move_slots_nolock(xm, xm->map + xm->count, data, n);
+	for (size_t k = 0; k < n; ++k) xm->tags[xm->count + k] = XMAP_ENTRY_VALUE;
+	__atomic_store_n(&xm->count, xm->count + n, __ATOMIC_RELEASE);
+	xmap_unlock(xm);
+	return n;
+}
+
+/* Helper shared by the batch string inserts. `wide' selects wchar_t
+   strings and the wstr list. Plain maps duplicate every string before
+   taking the lock; arena/intern maps copy under it once capacity for the
+   whole batch has been reserved. Strings that fit an inline cell keep
+   their source pointer in `copies' until they are copied into place. */
+XSTDDEF_INLINE_API size_t xmap_strinsert_many_impl(xmap_t *xm, int wide, const void *const *strs, size_t n) {
+	size_t m = 0;
+	for (size_t k = 0; k < n; ++k) if (strs[k]) m++;
+	if (m == 0) return 0;
+	/* copies[0..m) followed by the string lengths lens[0..m) */
+	void **copies = (void **)malloc(m * (sizeof(void *) + sizeof(size_t)));
+	if (!copies) {
+		errno = ENOMEM;
+		return 0;
+	}
+	size_t *lens = (size_t *)(copies + m);
+	size_t csize = wide ? sizeof(wchar_t) : 1;
+	size_t j = 0;
+	for (size_t k = 0; k < n; ++k)
+		if (strs[k]) lens[j++] = wide ? wcslen((const wchar_t *)strs[k]) : strlen((const char *)strs[k]);
+	int heap = !(xm->flags & (XMAP_ARENA | XMAP_INTERN));
+	j = 0;
+	if (heap) {
+		for (size_t k = 0; k < n; ++k) {
+			if (!strs[k]) continue;
+			copies[j] = xmap_inline_fits(xm, lens[j], csize) ? (void *)strs[k]
+				: xmap_elem_dup(xm, strs[k], (lens[j] + 1) * csize);
+			if (!copies[j]) {
+				while (j--) if (!xmap_inline_fits(xm, lens[j], csize)) xmap_elem_free(xm, copies[j]);
+				free(copies);
+				return 0;
+			}
+			j++;
+		}
+	}
+
+	xmap_lock(xm);
+	int ok = xmap_ensure_capacity_nolock(xm, xm->count + m) &&
+		(wide ? xmap_ensure_wstr_capacity_locked(xm, xm->cwstr + m)
+		      : xmap_ensure_str_capacity_locked(xm, xm->cstr + m));
+	for (size_t k = 0; ok && !heap && k < n; ++k) {
+		if (!strs[k]) continue;
+		if (xmap_inline_fits(xm, lens[j], csize))
+			copies[j] = (void *)strs[k];
+		else if (xm->flags & XMAP_INTERN)
+			copies[j] = wide
+				? xmap_intern_nolock(xm, XMAP_KEY_WCS, xmap_hash_wcs((const wchar_t *)strs[k]), strs[k])
+				: xmap_intern_nolock(xm, XMAP_KEY_STR, xmap_hash_str((const char *)strs[k]), strs[k]);
+		else
+			copies[j] = xmap_arena_dup_nolock(xm, strs[k], (lens[j] + 1) * csize, csize);
+		if (!copies[j]) ok = 0;
+		j++;
+	}
+	if (!ok) {
+		/* arena/intern copies stay with the arena until xmap_destroy() */
+		if (heap) for (j = 0; j < m; ++j) if (!xmap_inline_fits(xm, lens[j], csize)) xmap_elem_free(xm, copies[j]);
+		xmap_unlock(xm);
+		free(copies);
+		return 0;
+	}
+
+	size_t *list = wide ? xm->wstr + xm->cwstr : xm->str + xm->cstr;
+	for (j = 0; j < m; ++j) {
+		size_t i = xm->count + j;
+		xmap_store(list[j], i);
+		xm->tags[i] = XMAP_ENTRY_TAG(wide ? XMAP_ENTRY_WCS : XMAP_ENTRY_STR, lens[j]);
+		if (xmap_inline_fits(xm, lens[j], csize)) {
+			xm->tags[i] |= XMAP_ENTRY_INLINE;
+			xmap_store(xm->map[i], xmap_inline_put_nolock(xm, i, copies[j], (lens[j] + 1) * csize));
+		} else {
+			if (!heap) xm->tags[i] |= XMAP_ENTRY_SHARED;
+			xmap_store(xm->map[i], copies[j]);
+		}
+	}
+	__atomic_store_n(&xm->count, xm->count + m, __ATOMIC_RELEASE);
+	if (wide) __atomic_store_n(&xm->cwstr, xm->cwstr + m, __ATOMIC_RELEASE);
+	else __atomic_store_n(&xm->cstr, xm->cstr + m, __ATOMIC_RELEASE);
+	xmap_unlock(xm);
+	free(copies);
+	return m;
+}
+
+/* Batch string inserts (thread-safe): copy every non-NULL string of
+   `strs[0..n)' and append them under a single lock. All-or-nothing:
+   returns the number of strings inserted, 0 on failure (errno set). */
+XSTDDEF_INLINE_API size_t xmap_strinsert_many(xmap_t *xm, const char *const *strs, size_t n) {
+	return xmap_strinsert_many_impl(xm, 0, (const void *const *)strs, n);
+}
+
+XSTDDEF_INLINE_API size_t xmap_wcsinsert_many(xmap_t *xm, const wchar_t *const *strs, size_t n) {
+	return xmap_strinsert_many_impl(xm, 1, (const void *const *)strs, n);
+}
+
+/* Batch get (thread-safe): copies up to `n' pointers starting at map
+   index `first' into `out'. Returns the number of pointers copied. */
+XSTDDEF_INLINE_API size_t xmap_get_many(xmap_t *xm, size_t first, void **out, size_t n) {
+	size_t got;
+	if (xm->flags & XMAP_READMOSTLY) {
+		unsigned long s;
+		do {
+			s = xmap_read_begin(xm);
+			size_t count = __atomic_load_n(&xm->count, __ATOMIC_ACQUIRE);
+			void **map = __atomic_load_n(&xm->map, __ATOMIC_ACQUIRE);
+			got = (first < count) ? count - first : 0;
+			if (got > n) got = n;
+			for (size_t k = 0; k < got; ++k)
+				out[k] = __atomic_load_n(&map[first + k], __ATOMIC_RELAXED);
+		} while (xmap_read_retry(xm, s));
+		return got;
+	}
+	xmap_mutex_lock(xm);
+	got = (first < xm->count) ? xm->count - first : 0;
+	if (got > n) got = n;
+	if (got) memcpy(out, xm->map + first, got * sizeof(void *));
+	xmap_mutex_unlock(xm);
+	return got;
+}
+
+/* Open a view (thread-safe): copies the live (non-NULL) positional
+   entries into v->items under the lock, then lets writers proceed. The
+   pointers stay valid until xmap_view_end(), because erases postpone
+   element releases while a view is open; inline strings are copied
+   along, since writers move and reallocate the cells. Tombstones are
+   skipped. Returns 1 on success, 0 on failure (errno set, v empty). */
+XSTDDEF_INLINE_API int xmap_view_begin(xmap_t *xm, xmap_view_t *v) {
+	v->xm = xm;
+	v->items = NULL;
+	v->count = 0;
+	xmap_mutex_lock(xm);
+	size_t live = xm->count - xm->dead, ninl = 0;
+	if (xm->cells)
+		for (size_t i = 0; i < xm->count; ++i)
+			if (xm->map[i] && (xm->tags[i] & XMAP_ENTRY_INLINE)) ninl++;
+	if (live) {
+		/* items[0..live) followed by the copied cells */
+		v->items = (void **)malloc(live * sizeof(void *) + ninl * sizeof(xmap_cell_t));
+		if (!v->items) {
+			xmap_mutex_unlock(xm);
+			v->xm = NULL;
+			errno = ENOMEM;
+			return 0;
+		}
+		xmap_cell_t *cells = (xmap_cell_t *)(v->items + live);
+		for (size_t i = 0; i < xm->count && v->count < live; ++i) {
+			if (!xm->map[i]) continue;
+			if (xm->tags[i] & XMAP_ENTRY_INLINE) {
+				*cells = xm->cells[i];
+				v->items[v->count++] = (cells++)->str;
+			} else {
+				v->items[v->count++] = xm->map[i];
+			}
+		}
+	}
+	xm->views++;
+	xmap_mutex_unlock(xm);
+	return 1;
+}
+
+/* Close a view (thread-safe). The last view to close runs the releases
+   postponed while it was open. */
+XSTDDEF_INLINE_API void xmap_view_end(xmap_view_t *v) {
+	xmap_t *xm = v->xm;
+	if (!xm) return;
+	xmap_mutex_lock(xm);
+	if (--xm->views == 0) xmap_flush_deferred_nolock(xm);
+	xmap_mutex_unlock(xm);
+	free(v->items);
+	v->xm = NULL;
+	v->items = NULL;
+	v->count = 0;
+}
+
+/* Take a copy-on-write snapshot of the positional entries (thread-safe).
+   Copies no entry: the snapshot shares the live map until a writer is
+   about to change a page of XMAP_PAGE_SLOTS slots, which is then
+   preserved once for every open snapshot. Its only O(n) cost is the
+   directory of count / XMAP_PAGE_SLOTS page pointers, allocated outside
+   the lock, which is held in O(1). Like a view, it postpones
+   element releases until xmap_snapshot_release(). Returns 1 on success,
+   0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_snapshot(xmap_t *xm, xmap_snapshot_t *s) {
+	xmap_page_t **pages = NULL;
+	size_t cap = 0;
+	xmap_mutex_lock(xm);
+	/* size the directory from the count seen under the lock, allocate it
+	   unlocked and retry if writers grew the map in between */
+	for (;;) {
+		size_t npages = (xm->count + XMAP_PAGE_SLOTS - 1) >> XMAP_PAGE_SHIFT;
+		if (npages <= cap) break;
+		xmap_mutex_unlock(xm);
+		free(pages);
+		pages = (xmap_page_t **)calloc(npages, sizeof(xmap_page_t *));
+		if (!pages) {
+			s->xm = NULL;
+			errno = ENOMEM;
+			return 0;
+		}
+		cap = npages;
+		xmap_mutex_lock(xm);
+	}
+	s->pages = pages;
+	s->xm = xm;
+	s->count = xm->count;
+	s->error = 0;
+	s->prev = NULL;
+	s->next = xm->snapshots;
+	if (s->next) s->next->prev = s;
+	xm->snapshots = s;
+	xm->views++;
+	xmap_mutex_unlock(xm);
+	return 1;
+}
+
+/* Helper: page holding slot `i' of a snapshot (thread-safe). Preserved
+   pages are read without the lock; a page nobody wrote yet is preserved
+   here, under the lock, for every snapshot that shares it. Returns NULL
+   with errno ENOMEM if the snapshot lost a page. */
+XSTDDEF_INLINE_API xmap_page_t* xmap_snapshot_page(xmap_snapshot_t *s, size_t i) {
+	size_t k = i >> XMAP_PAGE_SHIFT;
+	xmap_page_t *page = __atomic_load_n(&s->pages[k], __ATOMIC_ACQUIRE);
+	if (!page) {
+		xmap_mutex_lock(s->xm);
+		xmap_snapshot_preserve_nolock(s->xm, k);
+		page = s->pages[k];
+		xmap_mutex_unlock(s->xm);
+	}
+	if (__atomic_load_n(&s->error, __ATOMIC_RELAXED)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return page;
+}
+
+/* Entry at map index `i' when the snapshot was taken (thread-safe), or
+   NULL for a tombstone, i >= count or a failed snapshot (errno ENOMEM).
+   The pointer stays valid until xmap_snapshot_release(). */
+XSTDDEF_INLINE_API void* xmap_snapshot_get(xmap_snapshot_t *s, size_t i) {
+	if (!s->xm || i >= s->count) return NULL;
+	xmap_page_t *page = xmap_snapshot_page(s, i);
+	return page ? page->map[i & (XMAP_PAGE_SLOTS - 1)] : NULL;
+}
+
+/* Entry type at map index `i' as for xmap_entry_type(), or -1 */
+XSTDDEF_INLINE_API int xmap_snapshot_type(xmap_snapshot_t *s, size_t i) {
+	if (!s->xm || i >= s->count) return -1;
+	xmap_page_t *page = xmap_snapshot_page(s, i);
+	return page ? XMAP_ENTRY_TYPE(page->tags[i & (XMAP_PAGE_SLOTS - 1)]) : -1;
+}
+
+/* Length of the string or binary entry at map index `i' (characters
+   for strings, bytes for XMAP_ENTRY_MEM), 0 for values and tombstones */
+XSTDDEF_INLINE_API size_t xmap_snapshot_len(xmap_snapshot_t *s, size_t i) {
+	void *p = xmap_snapshot_get(s, i);
+	if (!p) return 0;
+	size_t tag = s->pages[i >> XMAP_PAGE_SHIFT]->tags[i & (XMAP_PAGE_SLOTS - 1)];
+	int type = XMAP_ENTRY_TYPE(tag);
+	if (type == XMAP_ENTRY_VALUE) return 0;
+	if (XMAP_ENTRY_LEN(tag) != XMAP_ENTRY_NOLEN) return XMAP_ENTRY_LEN(tag);
+	return (type == XMAP_ENTRY_WCS) ? wcslen((const wchar_t *)p) : strlen((const char *)p);
+}
+
+/* Number of map slots the snapshot covers, tombstones included */
+XSTDDEF_INLINE_API size_t xmap_snapshot_count(xmap_snapshot_t *s) {
+	return s->xm ? s->count : 0;
+}
+
+/* Release a snapshot (thread-safe): drops its pages and, if it was the
+   last view or snapshot, runs the element releases it postponed. Must
+   happen before xmap_destroy(). */
+XSTDDEF_INLINE_API void xmap_snapshot_release(xmap_snapshot_t *s) {
+	xmap_t *xm = s->xm;
+	if (!xm) return;
+	size_t npages = (s->count + XMAP_PAGE_SLOTS - 1) >> XMAP_PAGE_SHIFT;
+	xmap_mutex_lock(xm);
+	if (s->prev) s->prev->next = s->next;
+	else xm->snapshots = s->next;
+	if (s->next) s->next->prev = s->prev;
+	for (size_t k = 0; k < npages; ++k) xmap_page_unref_nolock(s->pages[k]);
+	if (--xm->views == 0) xmap_flush_deferred_nolock(xm);
+	xmap_mutex_unlock(xm);
+	free(s->pages);
+	s->xm = NULL;
+	s->pages = NULL;
+	s->count = 0;
+}
+
+/* Helper: number of online processors (at least 1) */
+XSTDDEF_INLINE_API size_t xmap_ncpu(void) {
+#if defined(_WIN32) || defined(_WIN64)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	long n = (long)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? (size_t)n : 1;
+}
+
+/* Helper: one worker's share of a parallel pass */
+XSTDDEF_INLINE_API void* xmap_parallel_worker(void *p) {
+	xmap_task_t *t = (xmap_task_t *)p;
+	if (t->reduce) {
+		for (size_t i = 0; i < t->count; ++i) t->reduce(t->items[i], t->acc, t->arg);
+	} else {
+		for (size_t i = 0; i < t->count; ++i) t->fn(t->items[i], t->arg);
+	}
+	return NULL;
+}
+
+/* Helper: split a view into `ntasks' contiguous chunks, one per thread
+   with the caller running the first. Each task must already carry its
+   callback, argument and accumulator. Chunks whose thread cannot be
+   created run inline. */
+XSTDDEF_INLINE_API void xmap_parallel_run(xmap_view_t *v, xmap_task_t *tasks, size_t ntasks) {
+	pthread_t *tids = (pthread_t *)malloc(ntasks * sizeof(pthread_t));
+	char *started = (char *)calloc(ntasks, 1);
+	size_t per = v->count / ntasks, extra = v->count % ntasks, at = 0;
+	for (size_t k = 0; k < ntasks; ++k) {
+		tasks[k].items = v->items + at;
+		tasks[k].count = per + (k < extra);
+		at += tasks[k].count;
+	}
+	for (size_t k = 1; k < ntasks; ++k)
+		if (tids && started && pthread_create(&tids[k], NULL, xmap_parallel_worker, &tasks[k]) == 0)
+			started[k] = 1;
+	xmap_parallel_worker(&tasks[0]);
+	for (size_t k = 1; k < ntasks; ++k) {
+		if (started && started[k]) pthread_join(tids[k], NULL);
+		else xmap_parallel_worker(&tasks[k]);
+	}
+	free(started);
+	free(tids);
+}
+
+/* Helper: worker count for `n' entries. 0 requests one per processor;
+   chunks smaller than XMAP_PARALLEL_MIN entries are not worth a thread. */
+XSTDDEF_INLINE_API size_t xmap_parallel_threads(size_t nthreads, size_t n) {
+	if (nthreads == 0) nthreads = xmap_ncpu();
+	size_t cap = n / XMAP_PARALLEL_MIN;
+	if (nthreads > cap) nthreads = cap;
+	return nthreads ? nthreads : 1;
+}
+
+/* Parallel for-each (thread-safe): calls fn(data, arg) for every live
+   positional entry, splitting a snapshot (xmap_view_begin) of the map
+   into contiguous chunks run on `nthreads' threads (0 = one per
+   processor). fn runs concurrently with itself and with writers, but
+   every entry it sees stays valid for the whole pass.
+   Returns the number of entries visited, or (size_t)-1 on failure. */
+XSTDDEF_INLINE_API size_t xmap_parallel_foreach(xmap_t *xm, size_t nthreads, void (*fn)(void *data, void *arg), void *arg) {
+	xmap_view_t v;
+	if (!xmap_view_begin(xm, &v)) return (size_t)-1;
+	size_t ntasks = xmap_parallel_threads(nthreads, v.count);
+	xmap_task_t *tasks = (xmap_task_t *)calloc(ntasks, sizeof(xmap_task_t));
+	if (!tasks) {
+		xmap_view_end(&v);
+		errno = ENOMEM;
+		return (size_t)-1;
+	}
+	for (size_t k = 0; k < ntasks; ++k) {
+		tasks[k].fn = fn;
+		tasks[k].arg = arg;
+	}
+	xmap_parallel_run(&v, tasks, ntasks);
+	size_t n = v.count;
+	free(tasks);
+	xmap_view_end(&v);
+	return n;
+}
+
+/* Parallel reduce (thread-safe): like xmap_parallel_foreach, but every
+   thread folds its chunk into a private accumulator of `acc_size' bytes
+   with fn(data, acc, arg). Accumulators start as copies of *result, which
+   must hold the identity of `combine'; the partials are then merged into
+   *result in chunk order with combine(result, partial, arg).
+   Returns the number of entries visited, or (size_t)-1 on failure. */
+XSTDDEF_INLINE_API size_t xmap_parallel_reduce(xmap_t *xm, size_t nthreads, void *result, size_t acc_size,
+	void (*fn)(void *data, void *acc, void *arg),
+	void (*combine)(void *result, const void *partial, void *arg), void *arg) {
+	xmap_view_t v;
+	if (!xmap_view_begin(xm, &v)) return (size_t)-1;
+	size_t ntasks = xmap_parallel_threads(nthreads, v.count);
+	/* keep accumulators a cache line apart to avoid false sharing */
+	size_t stride = (acc_size + 63) & ~(size_t)63;
+	xmap_task_t *tasks = (xmap_task_t *)calloc(ntasks, sizeof(xmap_task_t));
+	char *accs = (char *)malloc(ntasks * stride);
+	if (!tasks || !accs) {
+		free(tasks);
+		free(accs);
+		xmap_view_end(&v);
+		errno = ENOMEM;
+		return (size_t)-1;
+	}
+	for (size_t k = 0; k < ntasks; ++k) {
+		tasks[k].reduce = fn;
+		tasks[k].arg = arg;
+		tasks[k].acc = accs + k * stride;
+		memcpy(tasks[k].acc, result, acc_size);
+	}
+	xmap_parallel_run(&v, tasks, ntasks);
+	for (size_t k = 0; k < ntasks; ++k) combine(result, tasks[k].acc, arg);
+	size_t n = v.count;
+	free(accs);
+	free(tasks);
+	xmap_view_end(&v);
+	return n;
+}
+
+/* Helper: drop the ordered index of the str (wide == 0) or wstr list
+   after its string indices changed; the next query rebuilds it */
+XSTDDEF_INLINE_API void xmap_order_reset_nolock(xmap_t *xm, int wide) {
+	xmap_order_t *o = wide ? &xm->worder : &xm->order;
+	o->count = 0;
+	o->covered = 0;
+}
 
-	/* Remove wstr entry and shift left */
-	for (size_t j = i; j + 1 < xm->cwstr; ++j)
-		xm->wstr[j] = xm->wstr[j + 1];
-	xm->cwstr--;
+/* Helper: drop map slot `i' (already released) and shift the slots after
+   it left (caller must hold mutex). The slot's tag tells which list, if
+   any, references it; only the tail of each list past `i' is renumbered. */
+XSTDDEF_INLINE_API void xmap_shift_out_nolock(xmap_t *xm, size_t i) {
+	int type = XMAP_ENTRY_TYPE(xm->tags[i]);
+	size_t tail = xm->count - i - 1;
+	xmap_cow_nolock(xm, i, xm->count);
+	if (xm->flags & XMAP_STATS) {
+		xm->stats.erases++;
+		xm->stats.shifted += tail;
+	}
+	xmap_move_slots_nolock(xm, xm->map + i, xm->map + i + 1, tail);
+	memmove(xm->tags + i, xm->tags + i + 1, tail * sizeof(size_t));
+	if (xm->cells) memmove(xm->cells + i, xm->cells + i + 1, tail * sizeof(xmap_cell_t));
+	xmap_store(xm->map[xm->count - 1], (void *)NULL);
+	xmap_store(xm->count, xm->count - 1);
+	if (xm->cells) xmap_cells_repoint_nolock(xm, i);
+	for (int wide = 0; wide < 2; ++wide) {
+		size_t *list = wide ? xm->wstr : xm->str;
+		size_t *n = wide ? &xm->cwstr : &xm->cstr;
+		size_t k = xmap_list_lower_nolock(xm, wide, i);
+		if (type == (wide ? XMAP_ENTRY_WCS : XMAP_ENTRY_STR)) {
+			xmap_move_indices_nolock(xm, list + k, list + k + 1, *n - k - 1);
+			xmap_store(*n, *n - 1);
+			xmap_order_reset_nolock(xm, wide);
+		}
+		for (; k < *n; ++k) xmap_store(list[k], list[k] - 1);
+	}
+}
 
-	/* Decrement all references above ret */
-	for (size_t k = 0; k < xm->cstr; ++k)
-		if (xm->str[k] > ret)
-			xm->str[k]--;
+/* Erase entry and shift (thread-safe). Frees stored pointer. */
+XSTDDEF_INLINE_API void xmap_erase(xmap_t *xm, size_t i) {
+	xmap_lock(xm);
+	if (i >= xm->count) {
+		xmap_unlock(xm);
+		return;
+	}
+	if (!xm->map[i]) {
+		xmap_unlock(xm);
+		return;
+	}
 
-	for (size_t k = 0; k < xm->cwstr; ++k)
-		if (xm->wstr[k] > ret)
-			xm->wstr[k]--;
+	xmap_release_slot_nolock(xm, i);
+	xmap_shift_out_nolock(xm, i);
+	xmap_unlock(xm);
+}
+
+/* Helper: release live entry `i' and leave a tombstone (caller must hold
+   the writer lock) */
+XSTDDEF_INLINE_API void xmap_erase_no_shift_nolock(xmap_t *xm, size_t i) {
+	xmap_cow_nolock(xm, i, i + 1);
+	if (xmap_is_string_slot_nolock(xm, i)) {
+		xmap_order_reset_nolock(xm, 0);
+		xmap_order_reset_nolock(xm, 1);
+	}
+	xmap_release_slot_nolock(xm, i);
+	xmap_store(xm->map[i], (void *)NULL);
+	xm->tags[i] |= XMAP_ENTRY_DEAD;
+	xm->dead++;
+}
+
+/* Erase entry but do not shift map (thread-safe). Frees pointer and sets slot NULL. */
+XSTDDEF_INLINE_API void xmap_erase_no_shift(xmap_t *xm, size_t i) {
+	xmap_lock(xm);
+	if (i < xm->count && xm->map[i]) xmap_erase_no_shift_nolock(xm, i);
+	xmap_unlock(xm);
+}
+
+/* String erase by string-index (thread-safe): removes mapping and frees stored string, shifts arrays */
+XSTDDEF_INLINE_API void xmap_strerase(xmap_t *xm, size_t i) {
+	xmap_lock(xm);
+	if (i >= xm->cstr) {
+		xmap_unlock(xm);
+		return;
+	}
+	size_t ret = xm->str[i];
+	if (ret >= xm->count) {
+		xmap_unlock(xm);
+		return;
+	}
+	if (xm->tags[ret] & XMAP_ENTRY_DEAD) xm->dead--; /* shifting out a tombstone */
+	else if (xm->map[ret]) xmap_release_slot_nolock(xm, ret);
+	xmap_shift_out_nolock(xm, ret);
+	xmap_unlock(xm);
+}
 
-	xm->count--;
-	pthread_mutex_unlock(&xm->mutex);
+/* String erase by string-index (thread-safe): removes mapping and frees stored string, shifts arrays */
+XSTDDEF_INLINE_API void xmap_wcserase(xmap_t *xm, size_t i) {
+	xmap_lock(xm);
+	if (i >= xm->cwstr) {
+		xmap_unlock(xm);
+		return;
+	}
+	size_t ret = xm->wstr[i];
+	if (ret >= xm->count) {
+		xmap_unlock(xm);
+		return;
+	}
+	if (xm->tags[ret] & XMAP_ENTRY_DEAD) xm->dead--; /* shifting out a tombstone */
+	else if (xm->map[ret]) xmap_release_slot_nolock(xm, ret);
+	xmap_shift_out_nolock(xm, ret);
+	xmap_unlock(xm);
 }
 
 
 /* String erase no shift (thread-safe): free stored string and clear map slot; keep str index list */
 XSTDDEF_INLINE_API void xmap_strerase_no_shift(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
+	xmap_lock(xm);
 	if (i >= xm->cstr) {
-		pthread_mutex_unlock(&xm->mutex);
+		xmap_unlock(xm);
 		return;
 	}
-	size_t ret = xm->str[i];
-	if (ret < xm->count && xm->map[ret]) {
-		free(xm->map[ret]);
-		xm->map[ret] = NULL;
+	size_t ret = xm->str[i];
+	if (ret < xm->count && xm->map[ret]) {
+		xmap_cow_nolock(xm, ret, ret + 1);
+		xmap_release_slot_nolock(xm, ret);
+		xmap_store(xm->map[ret], (void *)NULL);
+		xm->tags[ret] |= XMAP_ENTRY_DEAD;
+		xm->dead++;
+		xmap_order_reset_nolock(xm, 0);
+	}
+	xmap_unlock(xm);
+}
+
+/* Wchar erase no shift (thread-safe) */
+XSTDDEF_INLINE_API void xmap_wcserase_no_shift(xmap_t *xm, size_t i) {
+	xmap_lock(xm);
+	if (i >= xm->cwstr) {
+		xmap_unlock(xm);
+		return;
+	}
+	size_t ret = xm->wstr[i];
+	if (ret < xm->count && xm->map[ret]) {
+		xmap_cow_nolock(xm, ret, ret + 1);
+		xmap_release_slot_nolock(xm, ret);
+		xmap_store(xm->map[ret], (void *)NULL);
+		xm->tags[ret] |= XMAP_ENTRY_DEAD;
+		xm->dead++;
+		xmap_order_reset_nolock(xm, 1);
+	}
+	xmap_unlock(xm);
+}
+
+/* Compaction (caller must hold mutex): drops every tombstone (tagged
+   XMAP_ENTRY_DEAD) left by the _no_shift erase variants, keeping NULL
+   values the caller stored, and rebuilds map, str and wstr in one linear
+   pass, the slot tags saying which list a live slot belongs to. Both
+   lists stay sorted by map index because entries are only ever appended
+   and shifting erases preserve order. Map and string indices change;
+   returns the number of slots dropped. */
+XSTDDEF_INLINE_API size_t xmap_compact_nolock(xmap_t *xm) {
+	size_t w = 0, so = 0, wo = 0;
+	if (xm->snapshots) {
+		/* slots before the first tombstone stay put */
+		size_t first = 0;
+		while (first < xm->count && !(xm->tags[first] & XMAP_ENTRY_DEAD)) first++;
+		xmap_cow_nolock(xm, first, xm->count);
+	}
+	for (size_t r = 0; r < xm->count; ++r) {
+		if (xm->tags[r] & XMAP_ENTRY_DEAD) continue;
+		int type = XMAP_ENTRY_TYPE(xm->tags[r]);
+		if (type == XMAP_ENTRY_STR) xmap_store(xm->str[so++], w);
+		else if (type == XMAP_ENTRY_WCS) xmap_store(xm->wstr[wo++], w);
+		xm->tags[w] = xm->tags[r];
+		if (xm->tags[r] & XMAP_ENTRY_INLINE) {
+			xm->cells[w] = xm->cells[r];
+			xmap_store(xm->map[w], (void *)xm->cells[w].str);
+		} else {
+			xmap_store(xm->map[w], xm->map[r]);
+		}
+		w++;
+	}
+	size_t dropped = xm->count - w;
+	for (size_t r = w; r < xm->count; ++r) xmap_store(xm->map[r], (void *)NULL);
+	xmap_store(xm->count, w);
+	if (so != xm->cstr) xmap_order_reset_nolock(xm, 0);
+	if (wo != xm->cwstr) xmap_order_reset_nolock(xm, 1);
+	xmap_store(xm->cstr, so);
+	xmap_store(xm->cwstr, wo);
+	xm->dead = 0;
+	return dropped;
+}
+
+/* Compaction (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_compact(xmap_t *xm) {
+	xmap_lock(xm);
+	size_t dropped = xmap_compact_nolock(xm);
+	xmap_unlock(xm);
+	return dropped;
+}
+
+/* Number of tombstoned slots awaiting compaction (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_dead(xmap_t *xm) {
+	xmap_mutex_lock(xm);
+	size_t n = xm->dead;
+	xmap_mutex_unlock(xm);
+	return n;
+}
+
+/* Give unused capacity back (thread-safe): trims the map and str/wstr
+   lists to their element counts and rehashes the keyed store into the
+   smallest table that holds its keys. Indices do not change; call
+   xmap_compact() first to drop tombstones as well. In XMAP_READMOSTLY
+   mode the old arrays are retired until xmap_reclaim().
+   Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_shrink_to_fit(xmap_t *xm) {
+	xmap_lock(xm);
+	size_t hcap = 0;
+	if (xm->hash.count) {
+		hcap = 16;
+		while (xm->hash.count * 4 >= hcap * 3) hcap *= 2;
+	}
+	int ok = xmap_set_capacity_nolock(xm, xm->count)
+		&& xmap_set_list_capacity_locked(xm, 0, xm->cstr)
+		&& xmap_set_list_capacity_locked(xm, 1, xm->cwstr)
+		&& (hcap == xm->hash.capacity || xmap_hash_rehash_locked(&xm->hash, hcap));
+	xmap_unlock(xm);
+	return ok;
+}
+
+/* Helper: string at string-index k of the str (wide == 0) or wstr list */
+XSTDDEF_INLINE_API const void* xmap_order_str_nolock(xmap_t *xm, int wide, size_t k) {
+	return xm->map[wide ? xm->wstr[k] : xm->str[k]];
+}
+
+XSTDDEF_INLINE_API int xmap_order_cmp(int wide, const void *a, const void *b) {
+	return wide ? wcscmp((const wchar_t *)a, (const wchar_t *)b) : strcmp((const char *)a, (const char *)b);
+}
+
+/* Helper: stable merge of two sorted runs of string indices into `out' */
+XSTDDEF_INLINE_API void xmap_order_merge_nolock(xmap_t *xm, int wide, const size_t *a, size_t na, const size_t *b, size_t nb, size_t *out) {
+	size_t i = 0, j = 0, k = 0;
+	while (i < na && j < nb) {
+		if (xmap_order_cmp(wide, xmap_order_str_nolock(xm, wide, b[j]), xmap_order_str_nolock(xm, wide, a[i])) < 0)
+			out[k++] = b[j++];
+		else
+			out[k++] = a[i++];
+	}
+	while (i < na) out[k++] = a[i++];
+	while (j < nb) out[k++] = b[j++];
+}
+
+/* Helper: bring the ordered index up to date (caller must hold mutex).
+   String indices appended since the last query are merge-sorted on their
+   own and merged into the index in one pass, so steady appends cost
+   O(k log k + n) rather than a full re-sort. Returns 1 on success. */
+XSTDDEF_INLINE_API int xmap_order_sync_nolock(xmap_t *xm, int wide) {
+	xmap_order_t *o = wide ? &xm->worder : &xm->order;
+	size_t n = wide ? xm->cwstr : xm->cstr;
+	if (o->covered == n) return 1;
+	size_t add = n - o->covered;
+	if (o->capacity < o->count + add) {
+		size_t *tmp = (size_t *)realloc(o->idx, (o->count + add) * sizeof(size_t));
+		if (!tmp) {
+			errno = ENOMEM;
+			return 0;
+		}
+		o->idx = tmp;
+		o->capacity = o->count + add;
+	}
+	size_t *buf = (size_t *)malloc((o->count + add) * sizeof(size_t));
+	if (!buf) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+	/* collect the new live entries, then bottom-up merge sort them */
+	size_t *run = o->idx + o->count, m = 0;
+	for (size_t k = o->covered; k < n; ++k)
+		if (xmap_order_str_nolock(xm, wide, k)) run[m++] = k;
+	size_t *src = run, *dst = buf;
+	for (size_t width = 1; width < m; width *= 2) {
+		for (size_t lo = 0; lo < m; lo += 2 * width) {
+			size_t mid = (lo + width < m) ? lo + width : m;
+			size_t hi = (lo + 2 * width < m) ? lo + 2 * width : m;
+			xmap_order_merge_nolock(xm, wide, src + lo, mid - lo, src + mid, hi - mid, dst + lo);
+		}
+		size_t *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != run) memcpy(run, src, m * sizeof(size_t));
+
+	if (o->count && m) {
+		xmap_order_merge_nolock(xm, wide, o->idx, o->count, run, m, buf);
+		memcpy(o->idx, buf, (o->count + m) * sizeof(size_t));
+	}
+	free(buf);
+	o->count += m;
+	o->covered = n;
+	return 1;
+}
+
+/* Helper: first rank whose string is >= key (caller must hold mutex and
+   have synced the index) */
+XSTDDEF_INLINE_API size_t xmap_order_lower_nolock(xmap_t *xm, int wide, const void *key) {
+	xmap_order_t *o = wide ? &xm->worder : &xm->order;
+	size_t lo = 0, hi = o->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (xmap_order_cmp(wide, xmap_order_str_nolock(xm, wide, o->idx[mid]), key) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* Helper: lower_bound shared by the str and wcs variants (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_order_lower_bound(xmap_t *xm, int wide, const void *key) {
+	xmap_mutex_lock(xm);
+	size_t r = xmap_order_sync_nolock(xm, wide) ? xmap_order_lower_nolock(xm, wide, key) : 0;
+	xmap_mutex_unlock(xm);
+	return r;
+}
+
+/* Helper: prefix range shared by the str and wcs variants (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_order_prefix(xmap_t *xm, int wide, const void *prefix, size_t *first) {
+	size_t plen = wide ? wcslen((const wchar_t *)prefix) : strlen((const char *)prefix);
+	size_t lo = 0, hi = 0;
+	xmap_mutex_lock(xm);
+	if (xmap_order_sync_nolock(xm, wide)) {
+		xmap_order_t *o = wide ? &xm->worder : &xm->order;
+		lo = xmap_order_lower_nolock(xm, wide, prefix);
+		/* matches are contiguous from lo; find the first that is past them */
+		size_t a = lo;
+		hi = o->count;
+		while (a < hi) {
+			size_t mid = a + (hi - a) / 2;
+			const void *s = xmap_order_str_nolock(xm, wide, o->idx[mid]);
+			int c = wide ? wcsncmp((const wchar_t *)s, (const wchar_t *)prefix, plen)
+				     : strncmp((const char *)s, (const char *)prefix, plen);
+			if (c <= 0) a = mid + 1;
+			else hi = mid;
+		}
+		hi = a;
+	}
+	xmap_mutex_unlock(xm);
+	if (first) *first = lo;
+	return hi - lo;
+}
+
+/* Helper: rank lookup shared by the str and wcs variants (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_order_rank(xmap_t *xm, int wide, size_t rank) {
+	size_t k = (size_t)-1;
+	xmap_mutex_lock(xm);
+	xmap_order_t *o = wide ? &xm->worder : &xm->order;
+	if (xmap_order_sync_nolock(xm, wide) && rank < o->count) k = o->idx[rank];
+	xmap_mutex_unlock(xm);
+	return k;
+}
+
+/* Helper: ordered scan shared by the str (sfn) and wcs (wfn) variants
+   (thread-safe). Exactly one callback is non-NULL. */
+XSTDDEF_INLINE_API size_t xmap_order_scan(xmap_t *xm, const void *from, int (*sfn)(const char *str, size_t i, void *arg), int (*wfn)(const wchar_t *str, size_t i, void *arg), void *arg) {
+	int wide = (wfn != NULL);
+	size_t calls = 0;
+	xmap_mutex_lock(xm);
+	if (xmap_order_sync_nolock(xm, wide)) {
+		xmap_order_t *o = wide ? &xm->worder : &xm->order;
+		for (size_t r = from ? xmap_order_lower_nolock(xm, wide, from) : 0; r < o->count; ++r) {
+			const void *str = xmap_order_str_nolock(xm, wide, o->idx[r]);
+			calls++;
+			if (wide ? wfn((const wchar_t *)str, o->idx[r], arg) : sfn((const char *)str, o->idx[r], arg)) break;
+		}
+	}
+	xmap_mutex_unlock(xm);
+	return calls;
+}
+
+/* Ordered index over the string entries. It is built on the first query,
+   extended incrementally as strings are appended and rebuilt after
+   string erases or compaction; maps never queried pay nothing. Ranks
+   count positions in ascending strcmp()/wcscmp() order (ties in insertion
+   order) and are valid until the next modification. */
+
+/* First rank whose string is >= key (count of strings if none) */
+XSTDDEF_INLINE_API size_t xmap_strlower_bound(xmap_t *xm, const char *key) {
+	return xmap_order_lower_bound(xm, 0, key);
+}
+
+XSTDDEF_INLINE_API size_t xmap_wcslower_bound(xmap_t *xm, const wchar_t *key) {
+	return xmap_order_lower_bound(xm, 1, key);
+}
+
+/* Number of strings starting with `prefix'; *first receives the rank of
+   the first one (their ranks are contiguous) */
+XSTDDEF_INLINE_API size_t xmap_strprefix(xmap_t *xm, const char *prefix, size_t *first) {
+	return xmap_order_prefix(xm, 0, prefix, first);
+}
+
+XSTDDEF_INLINE_API size_t xmap_wcsprefix(xmap_t *xm, const wchar_t *prefix, size_t *first) {
+	return xmap_order_prefix(xm, 1, prefix, first);
+}
+
+/* String index (for xmap_strget) at `rank', or (size_t)-1 */
+XSTDDEF_INLINE_API size_t xmap_strrank(xmap_t *xm, size_t rank) {
+	return xmap_order_rank(xm, 0, rank);
+}
+
+XSTDDEF_INLINE_API size_t xmap_wcsrank(xmap_t *xm, size_t rank) {
+	return xmap_order_rank(xm, 1, rank);
+}
+
+/* Ordered iteration: calls fn(str, string-index, arg) in ascending order
+   starting at the first string >= from (NULL = from the start), under
+   the lock. fn must not call back into the map; returning non-zero stops
+   the scan. Returns the number of calls. */
+XSTDDEF_INLINE_API size_t xmap_strscan(xmap_t *xm, const char *from, int (*fn)(const char *str, size_t i, void *arg), void *arg) {
+	return xmap_order_scan(xm, from, fn, NULL, arg);
+}
+
+XSTDDEF_INLINE_API size_t xmap_wcsscan(xmap_t *xm, const wchar_t *from, int (*fn)(const wchar_t *str, size_t i, void *arg), void *arg) {
+	return xmap_order_scan(xm, from, NULL, fn, arg);
+}
+
+/* Helper: insert or replace a key (caller must hold mutex). `pkey' is
+   copied for string kinds. A replaced value is freed. Returns 1 on success. */
+XSTDDEF_INLINE_API int xmap_hash_put_locked(xmap_t *xm, int kind, size_t hash, uintptr_t ikey, const void *pkey, void *value) {
+	size_t i = xmap_hash_lookup_locked(&xm->hash, kind, hash, ikey, pkey);
+	if (i != (size_t)-1) {
+		xmap_slot_t *s = &xm->hash.slots[i];
+		if (s->value != value) xmap_release_value_nolock(xm, s->value);
+		s->value = value;
+		return 1;
+	}
+
+	void *copy = NULL;
+	if (kind == XMAP_KEY_STR) copy = xmap_elem_dup(xm, pkey, strlen((const char *)pkey) + 1);
+	else if (kind == XMAP_KEY_WCS) copy = xmap_elem_dup(xm, pkey, (wcslen((const wchar_t *)pkey) + 1) * sizeof(wchar_t));
+	if (kind != XMAP_KEY_INT && !copy) return 0;
+	if (!xmap_hash_reserve_locked(&xm->hash, 1)) {
+		xmap_elem_free(xm, copy);
+		return 0;
+	}
+	xmap_hash_insert_locked(&xm->hash, kind, hash, ikey, copy, value);
+	return 1;
+}
+
+/* Helper: remove a key and free its value (caller must hold mutex) */
+XSTDDEF_INLINE_API int xmap_hash_remove_locked(xmap_t *xm, int kind, size_t hash, uintptr_t ikey, const void *pkey) {
+	size_t i = xmap_hash_lookup_locked(&xm->hash, kind, hash, ikey, pkey);
+	if (i == (size_t)-1) return 0;
+	xmap_slot_t *s = &xm->hash.slots[i];
+	xmap_elem_free(xm, s->pkey);
+	xmap_release_value_nolock(xm, s->value);
+	s->pkey = NULL;
+	s->value = NULL;
+	s->kind = XMAP_KEY_DEAD;
+	xm->hash.count--;
+	return 1;
+}
+
+/* Keyed put (thread-safe): associates a copy of `key' with `value'.
+   The map takes ownership of `value' (freed on remove/replace/destroy).
+   Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_put(xmap_t *xm, const char *key, void *value) {
+	if (!key) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t hash = xmap_hash_str(key);
+	xmap_mutex_lock(xm);
+	int ok = xmap_hash_put_locked(xm, XMAP_KEY_STR, hash, 0, key, value);
+	xmap_mutex_unlock(xm);
+	return ok;
+}
+
+/* Keyed lookup (thread-safe): returns the value stored under `key' or NULL */
+XSTDDEF_INLINE_API void* xmap_find(xmap_t *xm, const char *key) {
+	if (!key) return NULL;
+	size_t hash = xmap_hash_str(key);
+	xmap_mutex_lock(xm);
+	size_t i = xmap_hash_lookup_locked(&xm->hash, XMAP_KEY_STR, hash, 0, key);
+	void *value = (i != (size_t)-1) ? xm->hash.slots[i].value : NULL;
+	xmap_mutex_unlock(xm);
+	return value;
+}
+
+/* Keyed removal (thread-safe): frees the value. Returns 1 if the key existed. */
+XSTDDEF_INLINE_API int xmap_remove(xmap_t *xm, const char *key) {
+	if (!key) return 0;
+	size_t hash = xmap_hash_str(key);
+	xmap_mutex_lock(xm);
+	int removed = xmap_hash_remove_locked(xm, XMAP_KEY_STR, hash, 0, key);
+	xmap_mutex_unlock(xm);
+	return removed;
+}
+
+/* Wide-string keyed variants (thread-safe) */
+XSTDDEF_INLINE_API int xmap_wcsput(xmap_t *xm, const wchar_t *key, void *value) {
+	if (!key) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t hash = xmap_hash_wcs(key);
+	xmap_mutex_lock(xm);
+	int ok = xmap_hash_put_locked(xm, XMAP_KEY_WCS, hash, 0, key, value);
+	xmap_mutex_unlock(xm);
+	return ok;
+}
+
+XSTDDEF_INLINE_API void* xmap_wcsfind(xmap_t *xm, const wchar_t *key) {
+	if (!key) return NULL;
+	size_t hash = xmap_hash_wcs(key);
+	xmap_mutex_lock(xm);
+	size_t i = xmap_hash_lookup_locked(&xm->hash, XMAP_KEY_WCS, hash, 0, key);
+	void *value = (i != (size_t)-1) ? xm->hash.slots[i].value : NULL;
+	xmap_mutex_unlock(xm);
+	return value;
+}
+
+XSTDDEF_INLINE_API int xmap_wcsremove(xmap_t *xm, const wchar_t *key) {
+	if (!key) return 0;
+	size_t hash = xmap_hash_wcs(key);
+	xmap_mutex_lock(xm);
+	int removed = xmap_hash_remove_locked(xm, XMAP_KEY_WCS, hash, 0, key);
+	xmap_mutex_unlock(xm);
+	return removed;
+}
+
+/* Integer keyed variants (thread-safe) */
+XSTDDEF_INLINE_API int xmap_intput(xmap_t *xm, uintptr_t key, void *value) {
+	size_t hash = xmap_hash_int(key);
+	xmap_mutex_lock(xm);
+	int ok = xmap_hash_put_locked(xm, XMAP_KEY_INT, hash, key, NULL, value);
+	xmap_mutex_unlock(xm);
+	return ok;
+}
+
+XSTDDEF_INLINE_API void* xmap_intfind(xmap_t *xm, uintptr_t key) {
+	size_t hash = xmap_hash_int(key);
+	xmap_mutex_lock(xm);
+	size_t i = xmap_hash_lookup_locked(&xm->hash, XMAP_KEY_INT, hash, key, NULL);
+	void *value = (i != (size_t)-1) ? xm->hash.slots[i].value : NULL;
+	xmap_mutex_unlock(xm);
+	return value;
+}
+
+XSTDDEF_INLINE_API int xmap_intremove(xmap_t *xm, uintptr_t key) {
+	size_t hash = xmap_hash_int(key);
+	xmap_mutex_lock(xm);
+	int removed = xmap_hash_remove_locked(xm, XMAP_KEY_INT, hash, key, NULL);
+	xmap_mutex_unlock(xm);
+	return removed;
+}
+
+/* Number of keyed entries (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_keycount(xmap_t *xm) {
+	xmap_mutex_lock(xm);
+	size_t n = xm->hash.count;
+	xmap_mutex_unlock(xm);
+	return n;
+}
+
+/* Helper: map a file read-only. Falls back to reading it into a heap
+   buffer where mmap() is unavailable. Returns NULL on failure (errno set). */
+XSTDDEF_INLINE_API void* xmap_map_file(const char *path, size_t *size) {
+#if defined(_WIN32) || defined(_WIN64)
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+	long len = (fseek(f, 0, SEEK_END) == 0) ? ftell(f) : -1;
+	void *base = (len > 0) ? malloc((size_t)len) : NULL;
+	if (!base || fseek(f, 0, SEEK_SET) != 0 || fread(base, 1, (size_t)len, f) != (size_t)len) {
+		free(base);
+		fclose(f);
+		errno = (len > 0) ? EIO : EINVAL;
+		return NULL;
+	}
+	fclose(f);
+	*size = (size_t)len;
+	return base;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return NULL;
+	*size = (size_t)st.st_size;
+	return base;
+#endif
+}
+
+XSTDDEF_INLINE_API void xmap_unmap_file(void *base, size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+	(void)size;
+	free(base);
+#else
+	munmap(base, size);
+#endif
+}
+
+/* Helper: write the image of xm's string entries and string tombstones
+   to `f' (caller must hold mutex). `tmp' holds 5 * (cstr + cwstr + 1) 64-bit scratch
+   slots. Returns 1 on success, 0 on failure. */
+XSTDDEF_INLINE_API int xmap_write_image_nolock(xmap_t *xm, FILE *f, uint64_t *tmp) {
+	static const char zeros[16] = { 0 };
+	size_t cap = xm->cstr + xm->cwstr + 1;
+	uint64_t *off = tmp, *len = tmp + cap, *sidx = tmp + 2 * cap, *widx = tmp + 3 * cap;
+	const void **src = (const void **)(tmp + 4 * cap);
+
+	/* lay out the blob in map order; wide strings are wchar_t aligned */
+	size_t n = 0, ns = 0, nw = 0;
+	uint64_t blob = 0;
+	for (size_t i = 0; i < xm->count; ++i) {
+		int type = XMAP_ENTRY_TYPE(xm->tags[i]);
+		if (type != XMAP_ENTRY_STR && type != XMAP_ENTRY_WCS) continue;
+		if (xm->tags[i] & XMAP_ENTRY_DEAD) {
+			/* placeholder: keeps the string index of the entries after it */
+			if (type == XMAP_ENTRY_WCS) widx[nw++] = n;
+			else sidx[ns++] = n;
+			len[n] = 0;
+			off[n++] = XMAP_IMAGE_DEAD;
+			continue;
+		}
+		if (type == XMAP_ENTRY_WCS) {
+			blob = (blob + sizeof(wchar_t) - 1) & ~(uint64_t)(sizeof(wchar_t) - 1);
+			len[n] = (xmap_entry_len_nolock(xm, i) + 1) * sizeof(wchar_t);
+			widx[nw++] = n;
+		} else {
+			len[n] = xmap_entry_len_nolock(xm, i) + 1;
+			sidx[ns++] = n;
+		}
+		src[n] = xm->map[i];
+		off[n] = blob;
+		blob += len[n++];
+	}
+	/* a trailing zero wchar_t bounds every string scan on load */
+	blob = ((blob + sizeof(wchar_t) - 1) & ~(uint64_t)(sizeof(wchar_t) - 1)) + sizeof(wchar_t);
+
+	xmap_image_header_t h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, XMAP_IMAGE_MAGIC, sizeof(h.magic));
+	h.wchar_size = sizeof(wchar_t);
+	h.count = n;
+	h.cstr = ns;
+	h.cwstr = nw;
+	h.blob_size = blob;
+	if (fwrite(&h, sizeof(h), 1, f) != 1
+	    || fwrite(off, sizeof(uint64_t), n, f) != n
+	    || fwrite(sidx, sizeof(uint64_t), ns, f) != ns
+	    || fwrite(widx, sizeof(uint64_t), nw, f) != nw) return 0;
+	uint64_t pos = 0;
+	for (size_t k = 0; k < n; ++k) {
+		if (off[k] == XMAP_IMAGE_DEAD) continue;
+		if (off[k] > pos && fwrite(zeros, 1, (size_t)(off[k] - pos), f) != off[k] - pos) return 0;
+		if (fwrite(src[k], 1, (size_t)len[k], f) != len[k]) return 0;
+		pos = off[k] + len[k];
+	}
+	return fwrite(zeros, 1, (size_t)(blob - pos), f) == blob - pos;
+}
+
+/* Save the string entries (thread-safe) as an image for xmap_load():
+   header, entry offsets, the str and wstr lists, then a blob of
+   NUL-terminated strings. Non-string and keyed entries are not saved,
+   so map indices are renumbered; string tombstones are saved as
+   placeholders, so string indices are kept and load as tombstones.
+   Native byte order. Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_save(xmap_t *xm, const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f) return 0;
+	xmap_mutex_lock(xm);
+	uint64_t *tmp = (uint64_t *)malloc(5 * (xm->cstr + xm->cwstr + 1) * sizeof(uint64_t));
+	int ok = tmp && xmap_write_image_nolock(xm, f, tmp);
+	xmap_mutex_unlock(xm);
+	if (fclose(f) != 0) ok = 0;
+	if (!ok) {
+		errno = tmp ? EIO : ENOMEM;
+		remove(path);
+	}
+	free(tmp);
+	return ok;
+}
+
+/* Helper: check that an image's str/wstr lists are strictly increasing,
+   disjoint and cover every entry, and that wide entries are aligned.
+   Tombstone placeholders have no blob bytes. */
+XSTDDEF_INLINE_API int xmap_image_valid(const xmap_image_header_t *h, const uint64_t *off, const uint64_t *sidx, const uint64_t *widx) {
+	if (h->cstr + h->cwstr != h->count) return 0;
+	size_t si = 0, wi = 0;
+	for (uint64_t i = 0; i < h->count; ++i) {
+		int dead = off[i] == XMAP_IMAGE_DEAD;
+		if (!dead && off[i] >= h->blob_size) return 0;
+		if (si < h->cstr && sidx[si] == i) si++;
+		else if (wi < h->cwstr && widx[wi] == i && (dead || off[i] % sizeof(wchar_t) == 0)) wi++;
+		else return 0;
+	}
+	return 1;
+}
+
+/* Load an image written by xmap_save() (initializes xm). The file is
+   memory-mapped read-only and the strings are served from the mapping
+   without copying: start-up cost is the page faults plus one pass over
+   the offset table. The map stays fully writable; image strings are never
+   freed, and the mapping is released by xmap_destroy(). Returned strings
+   must not be modified. On failure xm is still initialized (and empty).
+   Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_load(xmap_t *xm, const char *path, unsigned flags) {
+	xmap_init_flags(xm, flags);
+	size_t size = 0;
+	char *base = (char *)xmap_map_file(path, &size);
+	if (!base) return 0;
+
+	const xmap_image_header_t *h = (const xmap_image_header_t *)base;
+	if (size < sizeof(*h) || memcmp(h->magic, XMAP_IMAGE_MAGIC, sizeof(h->magic)) != 0
+	    || h->wchar_size != sizeof(wchar_t)) {
+		xmap_unmap_file(base, size);
+		errno = EINVAL;
+		return 0;
+	}
+	uint64_t avail = (size - sizeof(*h)) / sizeof(uint64_t);
+	if (h->count > avail || h->cstr > avail || h->cwstr > avail
+	    || h->count + h->cstr + h->cwstr > avail
+	    || h->blob_size < sizeof(wchar_t)
+	    || h->blob_size > size - sizeof(*h) - (h->count + h->cstr + h->cwstr) * sizeof(uint64_t)) {
+		xmap_unmap_file(base, size);
+		errno = EINVAL;
+		return 0;
+	}
+	const uint64_t *off = (const uint64_t *)(h + 1);
+	const uint64_t *sidx = off + h->count;
+	const uint64_t *widx = sidx + h->cstr;
+	char *blob = (char *)(widx + h->cwstr);
+	static const char zeros[sizeof(wchar_t)] = { 0 };
+	if (memcmp(blob + h->blob_size - sizeof(wchar_t), zeros, sizeof(wchar_t)) != 0
+	    || !xmap_image_valid(h, off, sidx, widx)) {
+		xmap_unmap_file(base, size);
+		errno = EINVAL;
+		return 0;
 	}
-	pthread_mutex_unlock(&xm->mutex);
-}
 
-/* Wchar erase no shift (thread-safe) */
-XSTDDEF_INLINE_API void xmap_wcserase_no_shift(xmap_t *xm, size_t i) {
-	pthread_mutex_lock(&xm->mutex);
-	if (i >= xm->cwstr) {
-		pthread_mutex_unlock(&xm->mutex);
-		return;
+	xmap_lock(xm);
+	if (!xmap_ensure_capacity_nolock(xm, (size_t)h->count)
+	    || !xmap_ensure_str_capacity_locked(xm, (size_t)h->cstr)
+	    || !xmap_ensure_wstr_capacity_locked(xm, (size_t)h->cwstr)) {
+		xmap_unlock(xm);
+		xmap_unmap_file(base, size);
+		return 0;
 	}
-	size_t ret = xm->wstr[i];
-	if (ret < xm->count && xm->map[ret]) {
-		free(xm->map[ret]);
-		xm->map[ret] = NULL;
+	/* lengths are measured on first use so loading never touches the blob */
+	for (size_t k = 0; k < h->count; ++k) {
+		int dead = off[k] == XMAP_IMAGE_DEAD;
+		xm->map[k] = dead ? NULL : blob + off[k];
+		xm->tags[k] = XMAP_ENTRY_TAG(XMAP_ENTRY_STR, XMAP_ENTRY_NOLEN) | XMAP_ENTRY_SHARED | (dead ? XMAP_ENTRY_DEAD : 0);
+		xm->dead += dead;
+	}
+	for (size_t k = 0; k < h->cstr; ++k) xm->str[k] = (size_t)sidx[k];
+	for (size_t k = 0; k < h->cwstr; ++k) {
+		xm->wstr[k] = (size_t)widx[k];
+		xm->tags[xm->wstr[k]] = XMAP_ENTRY_TAG(XMAP_ENTRY_WCS, XMAP_ENTRY_NOLEN) | XMAP_ENTRY_SHARED
+			| (xm->tags[xm->wstr[k]] & XMAP_ENTRY_DEAD);
 	}
-	pthread_mutex_unlock(&xm->mutex);
+	xm->mapped = base;
+	xm->mapped_size = size;
+	xm->count = (size_t)h->count;
+	xm->cstr = (size_t)h->cstr;
+	xm->cwstr = (size_t)h->cwstr;
+	xmap_unlock(xm);
+	return 1;
 }
 
 /* Destroy: free elements and arrays (thread-safe). After this call xm is unusable. */
 XSTDDEF_INLINE_API void xmap_destroy(xmap_t *xm) {
-	pthread_mutex_lock(&xm->mutex);
-	for (size_t i = 0; i < xm->count; ++i) {
-		if (xm->map && xm->map[i]) free(xm->map[i]);
-	}
+	xmap_lock(xm);
+	/* arena and image strings are skipped by their tag, in O(1) each */
+	for (size_t i = 0; i < xm->count; ++i)
+		if (xm->map[i]) xmap_release_slot_nolock(xm, i);
 	free(xm->map);
 	xm->map = NULL;
+	free(xm->tags);
+	xm->tags = NULL;
+	free(xm->cells);
+	xm->cells = NULL;
 	xm->count = 0;
 	xm->capacity = 0;
+	xm->dead = 0;
 
 	free(xm->str);
 	xm->str = NULL;
@@ -510,25 +2835,756 @@ XSTDDEF_INLINE_API void xmap_destroy(xmap_t *xm) {
 	xm->cwstr = 0;
 	xm->cwstr_capacity = 0;
 
-	pthread_mutex_unlock(&xm->mutex);
+	free(xm->order.idx);
+	free(xm->worder.idx);
+	memset(&xm->order, 0, sizeof(xm->order));
+	memset(&xm->worder, 0, sizeof(xm->worder));
+
+	for (size_t i = 0; i < xm->hash.capacity; ++i) {
+		xmap_slot_t *s = &xm->hash.slots[i];
+		if (s->kind == XMAP_KEY_EMPTY || s->kind == XMAP_KEY_DEAD) continue;
+		xmap_elem_free(xm, s->pkey);
+		xmap_release_value_nolock(xm, s->value);
+	}
+	free(xm->hash.slots);
+	xm->hash.slots = NULL;
+	xm->hash.count = 0;
+	xm->hash.used = 0;
+	xm->hash.capacity = 0;
+
+	/* interned strings live in the arena */
+	free(xm->intern.slots);
+	xm->intern.slots = NULL;
+	xm->intern.count = 0;
+	xm->intern.used = 0;
+	xm->intern.capacity = 0;
+
+	while (xm->retired) {
+		xmap_retired_t *r = xm->retired;
+		xm->retired = r->next;
+		free(r->ptr);
+		free(r);
+	}
+
+	/* views and snapshots must be closed by now; run what they postponed */
+	xm->views = 0;
+	xm->snapshots = NULL;
+	xmap_flush_deferred_nolock(xm);
+
+	while (xm->arena) {
+		xmap_chunk_t *c = xm->arena;
+		xm->arena = c->next;
+		xmap_elem_free(xm, c);
+	}
+
+	if (xm->mapped) xmap_unmap_file(xm->mapped, xm->mapped_size);
+	xm->mapped = NULL;
+	xm->mapped_size = 0;
+
+	xmap_unlock(xm);
 	pthread_mutex_destroy(&xm->mutex);
 }
 
+/* Initialize a sharded map with `nshards' independently locked shards
+   (rounded up to a power of two; 0 selects 16). Each shard is initialized
+   with `flags'. Returns 1 on success, 0 on failure (errno set). */
+XSTDDEF_INLINE_API int xmap_sharded_init(xmap_sharded_t *xs, size_t nshards, unsigned flags) {
+	size_t n = 1;
+	if (nshards == 0) nshards = 16;
+	while (n < nshards) n *= 2;
+	xs->shards = (xmap_shard_t *)malloc(n * sizeof(xmap_shard_t));
+	if (!xs->shards) {
+		errno = ENOMEM;
+		xs->nshards = 0;
+		return 0;
+	}
+	for (size_t s = 0; s < n; ++s) xmap_init_flags(&xs->shards[s].xm, flags);
+	xs->nshards = n;
+	return 1;
+}
+
+/* Shard owning the calling thread (used for positional inserts) */
+XSTDDEF_INLINE_API xmap_t* xmap_sharded_self(xmap_sharded_t *xs) {
+	size_t s = xmap_hash_int((uintptr_t)pthread_self()) & (xs->nshards - 1);
+	return &xs->shards[s].xm;
+}
+
+/* Shard owning a key hash. The hash is remixed so the shard choice does
+   not correlate with the probe position inside the shard's table. */
+XSTDDEF_INLINE_API xmap_t* xmap_sharded_keyshard(xmap_sharded_t *xs, size_t hash) {
+	size_t s = xmap_hash_int((uintptr_t)hash) & (xs->nshards - 1);
+	return &xs->shards[s].xm;
+}
+
+/* Direct access to shard `s' (no locking) */
+XSTDDEF_INLINE_API xmap_t* xmap_sharded_shard(xmap_sharded_t *xs, size_t s) {
+	if (s >= xs->nshards) return NULL;
+	return &xs->shards[s].xm;
+}
+
+/* Positional inserts into the calling thread's shard (thread-safe) */
+XSTDDEF_INLINE_API void xmap_sharded_insert(xmap_sharded_t *xs, void *data) {
+	xmap_insert(xmap_sharded_self(xs), data);
+}
+
+XSTDDEF_INLINE_API void xmap_sharded_strinsert(xmap_sharded_t *xs, const char *str) {
+	xmap_strinsert(xmap_sharded_self(xs), str);
+}
+
+XSTDDEF_INLINE_API void xmap_sharded_wcsinsert(xmap_sharded_t *xs, const wchar_t *str) {
+	xmap_wcsinsert(xmap_sharded_self(xs), str);
+}
+
+/* Keyed operations routed to the shard owning the key (thread-safe) */
+XSTDDEF_INLINE_API int xmap_sharded_put(xmap_sharded_t *xs, const char *key, void *value) {
+	if (!key) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t hash = xmap_hash_str(key);
+	xmap_t *xm = xmap_sharded_keyshard(xs, hash);
+	xmap_mutex_lock(xm);
+	int ok = xmap_hash_put_locked(xm, XMAP_KEY_STR, hash, 0, key, value);
+	xmap_mutex_unlock(xm);
+	return ok;
+}
+
+XSTDDEF_INLINE_API void* xmap_sharded_find(xmap_sharded_t *xs, const char *key) {
+	if (!key) return NULL;
+	size_t hash = xmap_hash_str(key);
+	xmap_t *xm = xmap_sharded_keyshard(xs, hash);
+	xmap_mutex_lock(xm);
+	size_t i = xmap_hash_lookup_locked(&xm->hash, XMAP_KEY_STR, hash, 0, key);
+	void *value = (i != (size_t)-1) ? xm->hash.slots[i].value : NULL;
+	xmap_mutex_unlock(xm);
+	return value;
+}
+
+XSTDDEF_INLINE_API int xmap_sharded_remove(xmap_sharded_t *xs, const char *key) {
+	if (!key) return 0;
+	size_t hash = xmap_hash_str(key);
+	xmap_t *xm = xmap_sharded_keyshard(xs, hash);
+	xmap_mutex_lock(xm);
+	int removed = xmap_hash_remove_locked(xm, XMAP_KEY_STR, hash, 0, key);
+	xmap_mutex_unlock(xm);
+	return removed;
+}
+
+XSTDDEF_INLINE_API int xmap_sharded_intput(xmap_sharded_t *xs, uintptr_t key, void *value) {
+	size_t hash = xmap_hash_int(key);
+	xmap_t *xm = xmap_sharded_keyshard(xs, hash);
+	xmap_mutex_lock(xm);
+	int ok = xmap_hash_put_locked(xm, XMAP_KEY_INT, hash, key, NULL, value);
+	xmap_mutex_unlock(xm);
+	return ok;
+}
+
+XSTDDEF_INLINE_API void* xmap_sharded_intfind(xmap_sharded_t *xs, uintptr_t key) {
+	size_t hash = xmap_hash_int(key);
+	xmap_t *xm = xmap_sharded_keyshard(xs, hash);
+	xmap_mutex_lock(xm);
+	size_t i = xmap_hash_lookup_locked(&xm->hash, XMAP_KEY_INT, hash, key, NULL);
+	void *value = (i != (size_t)-1) ? xm->hash.slots[i].value : NULL;
+	xmap_mutex_unlock(xm);
+	return value;
+}
+
+XSTDDEF_INLINE_API int xmap_sharded_intremove(xmap_sharded_t *xs, uintptr_t key) {
+	size_t hash = xmap_hash_int(key);
+	xmap_t *xm = xmap_sharded_keyshard(xs, hash);
+	xmap_mutex_lock(xm);
+	int removed = xmap_hash_remove_locked(xm, XMAP_KEY_INT, hash, key, NULL);
+	xmap_mutex_unlock(xm);
+	return removed;
+}
+
+/* Aggregate sizes (thread-safe; each shard is sampled under its own lock) */
+XSTDDEF_INLINE_API size_t xmap_sharded_count(xmap_sharded_t *xs) {
+	size_t n = 0;
+	for (size_t s = 0; s < xs->nshards; ++s) {
+		xmap_t *xm = &xs->shards[s].xm;
+		xmap_mutex_lock(xm);
+		n += xm->count - xm->dead;
+		xmap_mutex_unlock(xm);
+	}
+	return n;
+}
+
+XSTDDEF_INLINE_API size_t xmap_sharded_keycount(xmap_sharded_t *xs) {
+	size_t n = 0;
+	for (size_t s = 0; s < xs->nshards; ++s) n += xmap_keycount(&xs->shards[s].xm);
+	return n;
+}
+
+/* Aggregate iteration (thread-safe): calls fn(data, arg) for every
+   non-NULL positional entry, one shard at a time under that shard's lock.
+   Stops early when fn returns non-zero. Returns the number of calls. */
+XSTDDEF_INLINE_API size_t xmap_sharded_foreach(xmap_sharded_t *xs, int (*fn)(void *data, void *arg), void *arg) {
+	size_t visited = 0;
+	for (size_t s = 0; s < xs->nshards; ++s) {
+		xmap_t *xm = &xs->shards[s].xm;
+		int stop = 0;
+		xmap_mutex_lock(xm);
+		for (size_t i = 0; i < xm->count && !stop; ++i) {
+			if (!xm->map[i]) continue;
+			visited++;
+			stop = fn(xm->map[i], arg);
+		}
+		xmap_mutex_unlock(xm);
+		if (stop) break;
+	}
+	return visited;
+}
+
+/* Destroy every shard and the shard array (thread-safe per shard) */
+XSTDDEF_INLINE_API void xmap_sharded_destroy(xmap_sharded_t *xs) {
+	for (size_t s = 0; s < xs->nshards; ++s) xmap_destroy(&xs->shards[s].xm);
+	free(xs->shards);
+	xs->shards = NULL;
+	xs->nshards = 0;
+}
+
+/* Initialize a bounded cache holding at most `max_entries' entries and
+   `max_bytes' bytes of charged size (0 = no limit on that budget; at
+   least one must be set). `flags' may include XMAP_NONOWNING,
+   XMAP_SINGLE and XMAP_STATS; the allocator and destructor work as for
+   xmap_init_alloc() and release evicted values. Returns 1 on success, 0
+   on failure (errno EINVAL). */
+XSTDDEF_INLINE_API int xmap_cache_init_alloc(xmap_cache_t *c, size_t max_entries, size_t max_bytes, unsigned flags, const xmap_allocator_t *allocator, xmap_dtor_t dtor, void *dtor_ctx) {
+	if (!max_entries && !max_bytes) {
+		errno = EINVAL;
+		return 0;
+	}
+	xmap_init_alloc(&c->xm, flags & (XMAP_NONOWNING | XMAP_SINGLE | XMAP_STATS), allocator, dtor, dtor_ctx);
+	c->entries = NULL;
+	c->count = 0;
+	c->capacity = 0;
+	c->hand = 0;
+	c->bytes = 0;
+	c->max_entries = max_entries;
+	c->max_bytes = max_bytes;
+	memset(&c->stats, 0, sizeof(c->stats));
+	return 1;
+}
+
+XSTDDEF_INLINE_API int xmap_cache_init(xmap_cache_t *c, size_t max_entries, size_t max_bytes, unsigned flags) {
+	return xmap_cache_init_alloc(c, max_entries, max_bytes, flags, NULL, NULL, NULL);
+}
+
+/* Helper: key table slot of entry `e' (caller must hold mutex) */
+XSTDDEF_INLINE_API xmap_slot_t* xmap_cache_slot_nolock(xmap_cache_t *c, xmap_cache_entry_t *e) {
+	return &c->xm.hash.slots[xmap_hash_lookup_locked(&c->xm.hash, e->kind, e->hash, e->ikey, e->pkey)];
+}
+
+/* Helper: drop entry `i' and release its value (caller must hold mutex).
+   The last entry moves into the hole, so eviction never scans. */
+XSTDDEF_INLINE_API void xmap_cache_unlink_nolock(xmap_cache_t *c, size_t i) {
+	xmap_cache_entry_t *e = &c->entries[i];
+	xmap_slot_t *s = xmap_cache_slot_nolock(c, e);
+	s->kind = XMAP_KEY_DEAD;
+	s->pkey = NULL;
+	s->value = NULL;
+	c->xm.hash.count--;
+	xmap_elem_free(&c->xm, e->pkey);
+	xmap_release_value_nolock(&c->xm, e->value);
+	c->bytes -= e->size;
+	if (i != --c->count) {
+		*e = c->entries[c->count];
+		xmap_cache_slot_nolock(c, e)->value = (void *)(uintptr_t)(i + 1);
+	}
+}
+
+/* Helper: evict one entry with the CLOCK sweep (caller must hold mutex,
+   count > 0). Referenced entries lose their bit and are passed over, so
+   an entry survives as long as it is hit between two sweeps; every
+   entry is looked at at most twice. */
+XSTDDEF_INLINE_API void xmap_cache_evict_nolock(xmap_cache_t *c) {
+	for (;;) {
+		if (c->hand >= c->count) c->hand = 0;
+		xmap_cache_entry_t *e = &c->entries[c->hand];
+		if (e->ref) {
+			e->ref = 0;
+			c->hand++;
+			continue;
+		}
+		xmap_cache_unlink_nolock(c, c->hand);
+		c->stats.evictions++;
+		return;
+	}
+}
+
+/* Helper: insert or replace a key charged `size' bytes (caller must hold
+   mutex). Evicts until the new entry fits. Returns 1 on success. */
+XSTDDEF_INLINE_API int xmap_cache_put_nolock(xmap_cache_t *c, int kind, size_t hash, uintptr_t ikey, const char *pkey, void *value, size_t size) {
+	if (c->max_bytes && size > c->max_bytes) {
+		errno = EINVAL;
+		return 0;
+	}
+	xmap_t *xm = &c->xm;
+	size_t i = xmap_hash_lookup_locked(&xm->hash, kind, hash, ikey, pkey);
+	if (i != (size_t)-1) {
+		/* replace in place when the budget allows, else start over */
+		xmap_cache_entry_t *e = &c->entries[(uintptr_t)xm->hash.slots[i].value - 1];
+		if (!c->max_bytes || c->bytes - e->size + size <= c->max_bytes) {
+			if (e->value != value) xmap_release_value_nolock(xm, e->value);
+			c->bytes = c->bytes - e->size + size;
+			e->value = value;
+			e->size = size;
+			e->ref = 1;
+			return 1;
+		}
+		if (e->value == value) e->value = NULL; /* keep the value we are storing again */
+		xmap_cache_unlink_nolock(c, (uintptr_t)xm->hash.slots[i].value - 1);
+	}
+	while (c->count && ((c->max_entries && c->count >= c->max_entries) || (c->max_bytes && c->bytes + size > c->max_bytes)))
+		xmap_cache_evict_nolock(c);
+	if (c->count == c->capacity) {
+		size_t cap = xmap_grow_capacity(xm, c->capacity, c->count + 1);
+		if (c->max_entries && cap > c->max_entries) cap = c->max_entries;
+		xmap_cache_entry_t *tmp = (xmap_cache_entry_t *)realloc(c->entries, cap * sizeof(xmap_cache_entry_t));
+		if (!tmp) {
+			errno = ENOMEM;
+			return 0;
+		}
+		c->entries = tmp;
+		c->capacity = cap;
+	}
+	void *copy = (kind == XMAP_KEY_STR) ? xmap_elem_dup(xm, pkey, strlen(pkey) + 1) : NULL;
+	if (kind == XMAP_KEY_STR && !copy) return 0;
+	if (!xmap_hash_reserve_locked(&xm->hash, 1)) {
+		xmap_elem_free(xm, copy);
+		return 0;
+	}
+	xmap_hash_insert_locked(&xm->hash, kind, hash, ikey, copy, (void *)(uintptr_t)(c->count + 1));
+	xmap_cache_entry_t *e = &c->entries[c->count++];
+	e->value = value;
+	e->pkey = copy;
+	e->ikey = ikey;
+	e->hash = hash;
+	e->size = size;
+	e->kind = kind;
+	e->ref = 1;
+	c->bytes += size;
+	return 1;
+}
+
+/* Helper: look a key up and mark it referenced (caller must hold mutex) */
+XSTDDEF_INLINE_API void* xmap_cache_get_nolock(xmap_cache_t *c, int kind, size_t hash, uintptr_t ikey, const char *pkey) {
+	size_t i = xmap_hash_lookup_locked(&c->xm.hash, kind, hash, ikey, pkey);
+	if (i == (size_t)-1) {
+		c->stats.misses++;
+		return NULL;
+	}
+	xmap_cache_entry_t *e = &c->entries[(uintptr_t)c->xm.hash.slots[i].value - 1];
+	e->ref = 1;
+	c->stats.hits++;
+	return e->value;
+}
+
+/* Helper: remove a key and release its value (caller must hold mutex) */
+XSTDDEF_INLINE_API int xmap_cache_remove_nolock(xmap_cache_t *c, int kind, size_t hash, uintptr_t ikey, const char *pkey) {
+	size_t i = xmap_hash_lookup_locked(&c->xm.hash, kind, hash, ikey, pkey);
+	if (i == (size_t)-1) return 0;
+	xmap_cache_unlink_nolock(c, (uintptr_t)c->xm.hash.slots[i].value - 1);
+	return 1;
+}
+
+/* Cache `value' under a copy of `key' (thread-safe), charged `size'
+   bytes against max_bytes. Replaces and releases an older value. Evicts
+   least recently referenced entries (CLOCK) until the new one fits.
+   Returns 1 on success, 0 on failure (errno set: EINVAL if `size' alone
+   exceeds max_bytes); the caller keeps `value' on failure. */
+XSTDDEF_INLINE_API int xmap_cache_put(xmap_cache_t *c, const char *key, void *value, size_t size) {
+	if (!key) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t hash = xmap_hash_str(key);
+	xmap_mutex_lock(&c->xm);
+	int ok = xmap_cache_put_nolock(c, XMAP_KEY_STR, hash, 0, key, value, size);
+	xmap_mutex_unlock(&c->xm);
+	return ok;
+}
+
+/* Cached value for `key' (thread-safe), or NULL on a miss. A hit marks
+   the entry referenced in O(1). The value stays valid until it is
+   replaced, removed or evicted. */
+XSTDDEF_INLINE_API void* xmap_cache_get(xmap_cache_t *c, const char *key) {
+	if (!key) return NULL;
+	size_t hash = xmap_hash_str(key);
+	xmap_mutex_lock(&c->xm);
+	void *value = xmap_cache_get_nolock(c, XMAP_KEY_STR, hash, 0, key);
+	xmap_mutex_unlock(&c->xm);
+	return value;
+}
+
+/* Remove `key' and release its value (thread-safe). Returns 1 if the key
+   was cached. */
+XSTDDEF_INLINE_API int xmap_cache_remove(xmap_cache_t *c, const char *key) {
+	if (!key) return 0;
+	size_t hash = xmap_hash_str(key);
+	xmap_mutex_lock(&c->xm);
+	int removed = xmap_cache_remove_nolock(c, XMAP_KEY_STR, hash, 0, key);
+	xmap_mutex_unlock(&c->xm);
+	return removed;
+}
+
+/* Integer keyed variants (thread-safe) */
+XSTDDEF_INLINE_API int xmap_cache_intput(xmap_cache_t *c, uintptr_t key, void *value, size_t size) {
+	size_t hash = xmap_hash_int(key);
+	xmap_mutex_lock(&c->xm);
+	int ok = xmap_cache_put_nolock(c, XMAP_KEY_INT, hash, key, NULL, value, size);
+	xmap_mutex_unlock(&c->xm);
+	return ok;
+}
+
+XSTDDEF_INLINE_API void* xmap_cache_intget(xmap_cache_t *c, uintptr_t key) {
+	size_t hash = xmap_hash_int(key);
+	xmap_mutex_lock(&c->xm);
+	void *value = xmap_cache_get_nolock(c, XMAP_KEY_INT, hash, key, NULL);
+	xmap_mutex_unlock(&c->xm);
+	return value;
+}
+
+XSTDDEF_INLINE_API int xmap_cache_intremove(xmap_cache_t *c, uintptr_t key) {
+	size_t hash = xmap_hash_int(key);
+	xmap_mutex_lock(&c->xm);
+	int removed = xmap_cache_remove_nolock(c, XMAP_KEY_INT, hash, key, NULL);
+	xmap_mutex_unlock(&c->xm);
+	return removed;
+}
+
+/* Number of cached entries and their charged bytes (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_cache_count(xmap_cache_t *c) {
+	xmap_mutex_lock(&c->xm);
+	size_t n = c->count;
+	xmap_mutex_unlock(&c->xm);
+	return n;
+}
+
+XSTDDEF_INLINE_API size_t xmap_cache_bytes(xmap_cache_t *c) {
+	xmap_mutex_lock(&c->xm);
+	size_t n = c->bytes;
+	xmap_mutex_unlock(&c->xm);
+	return n;
+}
+
+/* Copy the hit, miss and eviction counters into *out (thread-safe) */
+XSTDDEF_INLINE_API void xmap_cache_stats(xmap_cache_t *c, xmap_cache_stats_t *out) {
+	xmap_mutex_lock(&c->xm);
+	*out = c->stats;
+	xmap_mutex_unlock(&c->xm);
+}
+
+/* Destroy: releases every cached value and key, then the embedded map.
+   No thread may be using the cache. */
+XSTDDEF_INLINE_API void xmap_cache_destroy(xmap_cache_t *c) {
+	xmap_mutex_lock(&c->xm);
+	for (size_t i = 0; i < c->count; ++i) {
+		xmap_elem_free(&c->xm, c->entries[i].pkey);
+		xmap_release_value_nolock(&c->xm, c->entries[i].value);
+	}
+	free(c->entries);
+	c->entries = NULL;
+	c->count = 0;
+	c->capacity = 0;
+	c->bytes = 0;
+	/* the key table holds entry indices, not values */
+	xmap_hash_rehash_locked(&c->xm.hash, 0);
+	c->xm.hash.count = 0;
+	xmap_mutex_unlock(&c->xm);
+	xmap_destroy(&c->xm);
+}
+
+/* Initialize an expiring map whose clock starts at tick `now'. Ticks
+   are caller-defined units (seconds, milliseconds, ...), one wheel slot
+   each. `flags' may include XMAP_NONOWNING, XMAP_SINGLE and XMAP_STATS;
+   the allocator and destructor work as for xmap_init_alloc() and release
+   expired values. Returns 1. */
+XSTDDEF_INLINE_API int xmap_ttl_init_alloc(xmap_ttl_t *t, uint64_t now, unsigned flags, const xmap_allocator_t *allocator, xmap_dtor_t dtor, void *dtor_ctx) {
+	xmap_init_alloc(&t->xm, flags & (XMAP_NONOWNING | XMAP_SINGLE | XMAP_STATS), allocator, dtor, dtor_ctx);
+	t->nodes = NULL;
+	t->capacity = 0;
+	t->pending = 0;
+	t->spare = XMAP_TTL_NONE;
+	t->now = now;
+	memset(t->occupied, 0, sizeof(t->occupied));
+	for (size_t s = 0; s < XMAP_TTL_LEVELS * XMAP_TTL_SLOTS; ++s) t->heads[s] = XMAP_TTL_NONE;
+	return 1;
+}
+
+XSTDDEF_INLINE_API int xmap_ttl_init(xmap_ttl_t *t, uint64_t now, unsigned flags) {
+	return xmap_ttl_init_alloc(t, now, flags, NULL, NULL, NULL);
+}
+
+/* Helper: arm the timer of entry `i' (caller must hold mutex). Timers
+   already due go to the slot processed next; timers beyond the last
+   level are parked at its far end and re-placed when cascaded. */
+XSTDDEF_INLINE_API void xmap_ttl_link_nolock(xmap_ttl_t *t, size_t i) {
+	xmap_ttl_node_t *n = &t->nodes[i];
+	uint64_t e = n->expires;
+	unsigned slot;
+	if (e < t->now) {
+		slot = (unsigned)(t->now & (XMAP_TTL_SLOTS - 1));
+	} else {
+		uint64_t d = e - t->now;
+		int lvl = 0;
+		while (lvl < XMAP_TTL_LEVELS - 1 && d >= (uint64_t)1 << (XMAP_TTL_BITS * (lvl + 1))) lvl++;
+		if (d >= (uint64_t)1 << (XMAP_TTL_BITS * XMAP_TTL_LEVELS))
+			e = t->now + ((uint64_t)1 << (XMAP_TTL_BITS * XMAP_TTL_LEVELS)) - 1;
+		slot = (unsigned)(lvl * XMAP_TTL_SLOTS + ((e >> (XMAP_TTL_BITS * lvl)) & (XMAP_TTL_SLOTS - 1)));
+	}
+	n->slot = slot;
+	n->prev = XMAP_TTL_NONE;
+	n->next = t->heads[slot];
+	if (n->next != XMAP_TTL_NONE) t->nodes[n->next].prev = i;
+	t->heads[slot] = i;
+	t->occupied[slot / XMAP_TTL_SLOTS] |= (uint64_t)1 << (slot % XMAP_TTL_SLOTS);
+	t->pending++;
+}
+
+/* Helper: disarm the timer of entry `i' in O(1) (caller must hold mutex) */
+XSTDDEF_INLINE_API void xmap_ttl_unlink_nolock(xmap_ttl_t *t, size_t i) {
+	xmap_ttl_node_t *n = &t->nodes[i];
+	if (n->slot == XMAP_TTL_UNARMED) return;
+	if (n->prev != XMAP_TTL_NONE) t->nodes[n->prev].next = n->next;
+	else t->heads[n->slot] = n->next;
+	if (n->next != XMAP_TTL_NONE) t->nodes[n->next].prev = n->prev;
+	if (t->heads[n->slot] == XMAP_TTL_NONE)
+		t->occupied[n->slot / XMAP_TTL_SLOTS] &= ~((uint64_t)1 << (n->slot % XMAP_TTL_SLOTS));
+	n->slot = XMAP_TTL_UNARMED;
+	t->pending--;
+}
+
+/* Helper: at the start of a level 0 turn, move the current slot of each
+   higher level one level down (caller must hold mutex). A level is only
+   cascaded when the one below it starts a turn too. */
+XSTDDEF_INLINE_API void xmap_ttl_cascade_nolock(xmap_ttl_t *t) {
+	for (int lvl = 1; lvl < XMAP_TTL_LEVELS; ++lvl) {
+		unsigned idx = (unsigned)((t->now >> (XMAP_TTL_BITS * lvl)) & (XMAP_TTL_SLOTS - 1));
+		size_t i = t->heads[lvl * XMAP_TTL_SLOTS + idx];
+		t->heads[lvl * XMAP_TTL_SLOTS + idx] = XMAP_TTL_NONE;
+		t->occupied[lvl] &= ~((uint64_t)1 << idx);
+		while (i != XMAP_TTL_NONE) {
+			size_t next = t->nodes[i].next;
+			t->pending--;
+			xmap_ttl_link_nolock(t, i);
+			i = next;
+		}
+		if (idx) break;
+	}
+}
+
+/* Helper: erase entry `i', whose timer is disarmed, and keep its index
+   for the next insert under a new generation (caller must hold the
+   writer lock). The map tags the slot XMAP_ENTRY_DEAD, so liveness does
+   not depend on the value being non-NULL. */
+XSTDDEF_INLINE_API void xmap_ttl_retire_nolock(xmap_ttl_t *t, size_t i) {
+	xmap_erase_no_shift_nolock(&t->xm, i);
+	t->nodes[i].gen++;
+	t->nodes[i].next = t->spare;
+	t->spare = i;
+}
+
+/* Helper: erase the entries of level 0 slot `idx', due at tick t->now
+   (caller must hold the writer lock). Returns how many were erased. */
+XSTDDEF_INLINE_API size_t xmap_ttl_fire_nolock(xmap_ttl_t *t, unsigned idx) {
+	size_t n = 0, i = t->heads[idx];
+	t->heads[idx] = XMAP_TTL_NONE;
+	t->occupied[0] &= ~((uint64_t)1 << idx);
+	while (i != XMAP_TTL_NONE) {
+		size_t next = t->nodes[i].next;
+		t->nodes[i].slot = XMAP_TTL_UNARMED;
+		t->pending--;
+		if (t->nodes[i].expires > t->now) {
+			xmap_ttl_link_nolock(t, i);
+		} else if (!(t->xm.tags[i] & XMAP_ENTRY_DEAD)) {
+			xmap_ttl_retire_nolock(t, i);
+			n++;
+		}
+		i = next;
+	}
+	return n;
+}
+
+/* Helper: the tick after t->now at which a slot fires or a non-empty
+   slot is cascaded, when level 0 has nothing due in its current turn
+   (caller must hold mutex). Levels with nothing ahead in their turn are
+   skipped whole. */
+XSTDDEF_INLINE_API uint64_t xmap_ttl_next_nolock(xmap_ttl_t *t) {
+	if (t->occupied[0]) return (t->now | (XMAP_TTL_SLOTS - 1)) + 1;
+	for (int lvl = 1; lvl < XMAP_TTL_LEVELS; ++lvl) {
+		int shift = XMAP_TTL_BITS * lvl;
+		uint64_t base = t->now >> shift;
+		unsigned pos = (unsigned)(base & (XMAP_TTL_SLOTS - 1));
+		uint64_t ahead = pos == XMAP_TTL_SLOTS - 1 ? 0 : t->occupied[lvl] >> (pos + 1);
+		if (ahead) return (base + 1 + (uint64_t)__builtin_ctzll(ahead)) << shift;
+		if (t->occupied[lvl]) return ((base | (XMAP_TTL_SLOTS - 1)) + 1) << shift;
+	}
+	return (t->now | (XMAP_TTL_SLOTS - 1)) + 1;
+}
+
+/* Helper: does `id' name a live entry? (caller must hold mutex) */
+XSTDDEF_INLINE_API int xmap_ttl_live_nolock(xmap_ttl_t *t, xmap_ttl_id_t id) {
+	return id.index < t->xm.count && !(t->xm.tags[id.index] & XMAP_ENTRY_DEAD)
+		&& t->nodes[id.index].gen == id.gen;
+}
+
+/* Helper: grow the timer array to `need' nodes (caller must hold mutex) */
+XSTDDEF_INLINE_API int xmap_ttl_reserve_nolock(xmap_ttl_t *t, size_t need) {
+	if (need <= t->capacity) return 1;
+	size_t cap = xmap_grow_capacity(&t->xm, t->capacity, need);
+	xmap_ttl_node_t *tmp = (xmap_ttl_node_t *)realloc(t->nodes, cap * sizeof(xmap_ttl_node_t));
+	if (!tmp) {
+		errno = ENOMEM;
+		return 0;
+	}
+	t->nodes = tmp;
+	t->capacity = cap;
+	return 1;
+}
+
+/* Insert `data' expiring at tick `expires' (thread-safe), in the slot of
+   an expired or erased entry if there is one, else appended. Ownership
+   of `data' passes to the map as for xmap_insert(); NULL is a valid
+   value. Returns the entry's handle, whose index is XMAP_TTL_NONE on
+   failure (errno set). */
+XSTDDEF_INLINE_API xmap_ttl_id_t xmap_ttl_insert(xmap_ttl_t *t, void *data, uint64_t expires) {
+	xmap_ttl_id_t id = { XMAP_TTL_NONE, 0 };
+	xmap_lock(&t->xm);
+	size_t i = t->spare;
+	if (i != XMAP_TTL_NONE) {
+		xmap_cow_nolock(&t->xm, i, i + 1);
+		t->spare = t->nodes[i].next;
+		t->xm.tags[i] = XMAP_ENTRY_VALUE;
+		xmap_store(t->xm.map[i], data);
+		t->xm.dead--;
+	} else {
+		i = t->xm.count;
+		if (!xmap_ttl_reserve_nolock(t, i + 1) || !xmap_insert_nolock(&t->xm, data)) {
+			xmap_unlock(&t->xm);
+			return id;
+		}
+		t->nodes[i].gen = 0;
+	}
+	t->nodes[i].expires = expires;
+	xmap_ttl_link_nolock(t, i);
+	id.index = i;
+	id.gen = t->nodes[i].gen;
+	xmap_unlock(&t->xm);
+	return id;
+}
+
+/* Value of the entry `id' names (thread-safe), NULL once it has expired
+   or been erased */
+XSTDDEF_INLINE_API void* xmap_ttl_get(xmap_ttl_t *t, xmap_ttl_id_t id) {
+	xmap_mutex_lock(&t->xm);
+	void *data = xmap_ttl_live_nolock(t, id) ? t->xm.map[id.index] : NULL;
+	xmap_mutex_unlock(&t->xm);
+	return data;
+}
+
+/* Move the deadline of a live entry to `expires' in O(1) (thread-safe).
+   Returns 1, or 0 if the entry is gone (its index may have been reused). */
+XSTDDEF_INLINE_API int xmap_ttl_touch(xmap_ttl_t *t, xmap_ttl_id_t id, uint64_t expires) {
+	xmap_lock(&t->xm);
+	if (!xmap_ttl_live_nolock(t, id)) {
+		xmap_unlock(&t->xm);
+		return 0;
+	}
+	xmap_ttl_unlink_nolock(t, id.index);
+	t->nodes[id.index].expires = expires;
+	xmap_ttl_link_nolock(t, id.index);
+	xmap_unlock(&t->xm);
+	return 1;
+}
+
+/* Erase an entry before its deadline (thread-safe): disarms the timer,
+   releases the value and frees the index. Returns 1, or 0 if the entry
+   is already gone. */
+XSTDDEF_INLINE_API int xmap_ttl_erase(xmap_ttl_t *t, xmap_ttl_id_t id) {
+	xmap_lock(&t->xm);
+	int live = xmap_ttl_live_nolock(t, id);
+	if (live) {
+		xmap_ttl_unlink_nolock(t, id.index);
+		xmap_ttl_retire_nolock(t, id.index);
+	}
+	xmap_unlock(&t->xm);
+	return live;
+}
+
+/* Advance the clock to tick `now' and erase every entry due at or before
+   it (thread-safe), releasing values as xmap_erase_no_shift() does.
+   Empty slots are skipped with bit scans, so the cost is the expirations
+   plus the cascades of non-empty slots, not a pass over the map.
+   Returns how many entries expired. */
+XSTDDEF_INLINE_API size_t xmap_ttl_expire(xmap_ttl_t *t, uint64_t now) {
+	size_t n = 0;
+	xmap_lock(&t->xm);
+	while (t->now <= now) {
+		if (!t->pending) {
+			t->now = now + 1;
+			break;
+		}
+		unsigned idx = (unsigned)(t->now & (XMAP_TTL_SLOTS - 1));
+		if (!idx) xmap_ttl_cascade_nolock(t);
+		uint64_t bits = t->occupied[0] >> idx;
+		if (!bits) {
+			uint64_t next = xmap_ttl_next_nolock(t);
+			t->now = next < now + 1 ? next : now + 1;
+			continue;
+		}
+		uint64_t tick = t->now + (uint64_t)__builtin_ctzll(bits);
+		if (tick > now) {
+			t->now = now + 1;
+			break;
+		}
+		t->now = tick;
+		n += xmap_ttl_fire_nolock(t, (unsigned)(tick & (XMAP_TTL_SLOTS - 1)));
+		t->now++;
+	}
+	xmap_unlock(&t->xm);
+	return n;
+}
+
+/* Number of entries waiting to expire (thread-safe) */
+XSTDDEF_INLINE_API size_t xmap_ttl_pending(xmap_ttl_t *t) {
+	xmap_mutex_lock(&t->xm);
+	size_t n = t->pending;
+	xmap_mutex_unlock(&t->xm);
+	return n;
+}
+
+/* Destroy: releases every remaining value, the timers and the map. No
+   thread may be using the map. */
+XSTDDEF_INLINE_API void xmap_ttl_destroy(xmap_ttl_t *t) {
+	free(t->nodes);
+	t->nodes = NULL;
+	t->capacity = 0;
+	t->pending = 0;
+	t->spare = XMAP_TTL_NONE;
+	xmap_destroy(&t->xm);
+}
+
 #ifdef __cplusplus
 }
 #endif
 
 #ifdef __cplusplus
 
+/* Unsynchronized iterator over xm->map that skips tombstones. The caller
+   must rule out concurrent writers; use xmap_view<T> otherwise. */
 template<typename T>
 class xmap_iterator {
 public:
-	xmap_iterator(xmap_t *map, size_t idx) : xm(map), index(idx) {}
+	xmap_iterator(xmap_t *map, size_t idx) : xm(map), index(idx) { skip(); }
 	T& operator*() { return *reinterpret_cast<T*>(xm->map[index]); }
-	xmap_iterator& operator++() { ++index; return *this; }
+	xmap_iterator& operator++() { ++index; skip(); return *this; }
 	bool operator!=(const xmap_iterator& other) const { return index != other.index; }
 
 private:
+	void skip() { while (index < xm->count && !xm->map[index]) ++index; }
+
 	xmap_t *xm;
 	size_t index;
 };
@@ -539,10 +3595,51 @@ xmap_iterator<T> xmap_begin(xmap_t* xm) { return xmap_iterator<T>(xm, 0); }
 template<typename T>
 xmap_iterator<T> xmap_end(xmap_t* xm) { return xmap_iterator<T>(xm, xm->count); }
 
+/* RAII snapshot iteration (xmap_view_begin/xmap_view_end): safe against
+   concurrent inserts and erases, and holds the lock only while copying. */
+template<typename T>
+class xmap_view {
+public:
+	class iterator {
+	public:
+		explicit iterator(void **p) : pos(p) {}
+		T& operator*() { return *reinterpret_cast<T*>(*pos); }
+		iterator& operator++() { ++pos; return *this; }
+		bool operator!=(const iterator& other) const { return pos != other.pos; }
+
+	private:
+		void **pos;
+	};
+
+	explicit xmap_view(xmap_t *xm) { ok_ = xmap_view_begin(xm, &v_); }
+	~xmap_view() { xmap_view_end(&v_); }
+	xmap_view(const xmap_view&) = delete;
+	xmap_view& operator=(const xmap_view&) = delete;
+
+	bool ok() const { return ok_ != 0; }
+	size_t size() const { return v_.count; }
+	iterator begin() { return iterator(v_.items); }
+	iterator end() { return iterator(v_.items + v_.count); }
+
+private:
+	xmap_view_t v_;
+	int ok_;
+};
+
 /* C++ convenience wrappers */
 
+/* The std::string overloads copy size() characters without measuring
+   the string again */
 XSTDDEF_INLINE_API void xxmap_strinsert(xmap_t *xm, const std::string& str) {
-	xmap_strinsert(xm, str.c_str());
+	xmap_strninsert(xm, str.data(), str.size());
+}
+
+XSTDDEF_INLINE_API void xxmap_strinsert(xmap_t *xm, const char *str) {
+	xmap_strinsert(xm, str);
+}
+
+XSTDDEF_INLINE_API int xxmap_strinsert(xmap_t *xm, const char *str, size_t len) {
+	return xmap_strninsert(xm, str, len);
 }
 
 XSTDDEF_INLINE_API int xxmap_strinsert_safe(xmap_t *xm, const std::string& str) {
@@ -552,10 +3649,14 @@ XSTDDEF_INLINE_API int xxmap_strinsert_safe(xmap_t *xm, const std::string& str)
 	return 1;
 }
 
+/* Copy of string `i' (thread-safe, inline entries included): the lease
+   copies an inline string under the lock and pins any other */
 XSTDDEF_INLINE_API std::string xxmap_strget(xmap_t *xm, size_t i) {
-	char *p = xmap_strget(xm,i);
-	if (!p) return std::string();
-	return std::string(p);
+	xmap_lease_t l;
+	if (!xmap_lease_str(xm, i, &l)) return std::string();
+	std::string s(static_cast<const char*>(l.str), l.len);
+	xmap_lease_end(&l);
+	return s;
 }
 
 XSTDDEF_INLINE_API int xxmap_wcsinsert_safe(xmap_t *xm, const std::wstring& str) {
@@ -566,14 +3667,61 @@ XSTDDEF_INLINE_API int xxmap_wcsinsert_safe(xmap_t *xm, const std::wstring& str)
 }
 
 XSTDDEF_INLINE_API void xxmap_wcsinsert(xmap_t *xm, const std::wstring& str) {
-	xmap_wcsinsert(xm, str.c_str());
+	xmap_wcsninsert(xm, str.data(), str.size());
+}
+
+XSTDDEF_INLINE_API void xxmap_wcsinsert(xmap_t *xm, const wchar_t *str) {
+	xmap_wcsinsert(xm, str);
+}
+
+XSTDDEF_INLINE_API int xxmap_wcsinsert(xmap_t *xm, const wchar_t *str, size_t len) {
+	return xmap_wcsninsert(xm, str, len);
 }
 
 XSTDDEF_INLINE_API std::wstring xxmap_wcsget(xmap_t *xm, size_t i) {
-	wchar_t *p = xmap_wcsget(xm,i);
-	if (!p) return std::wstring();
-	return std::wstring(p);
+	xmap_lease_t l;
+	if (!xmap_lease_wcs(xm, i, &l)) return std::wstring();
+	std::wstring s(static_cast<const wchar_t*>(l.str), l.len);
+	xmap_lease_end(&l);
+	return s;
+}
+
+#if __cplusplus >= 201703L
+/* RAII string lease (xmap_lease_str/xmap_lease_wcs) for C++17: view()
+   reads the string in place with its cached length, no allocation, until
+   the lease goes out of scope. Header-only: the library builds as C++11. */
+template<class C>
+class xmap_basic_lease {
+public:
+	xmap_basic_lease(xmap_t *xm, size_t i) {
+		ok_ = std::is_same<C, wchar_t>::value ? xmap_lease_wcs(xm, i, &l_) : xmap_lease_str(xm, i, &l_);
+	}
+	~xmap_basic_lease() { xmap_lease_end(&l_); }
+	xmap_basic_lease(const xmap_basic_lease&) = delete;
+	xmap_basic_lease& operator=(const xmap_basic_lease&) = delete;
+
+	bool ok() const { return ok_ != 0; }
+	std::basic_string_view<C> view() const {
+		return ok_ ? std::basic_string_view<C>(static_cast<const C*>(l_.str), l_.len) : std::basic_string_view<C>();
+	}
+	operator std::basic_string_view<C>() const { return view(); }
+
+private:
+	xmap_lease_t l_;
+	int ok_;
+};
+
+typedef xmap_basic_lease<char> xmap_strlease;
+typedef xmap_basic_lease<wchar_t> xmap_wcslease;
+
+inline int xxmap_strinsert(xmap_t *xm, std::string_view str) {
+	return xmap_strninsert(xm, str.data(), str.size());
+}
+
+inline int xxmap_wcsinsert(xmap_t *xm, std::wstring_view str) {
+	return xmap_wcsninsert(xm, str.data(), str.size());
 }
+#endif
 
 template<typename T>
 T* xxmap_get(xmap_t* xm, size_t i) {
@@ -586,6 +3734,162 @@ T xxmap_intget(xmap_t* xm, size_t i) {
 	if (!p) return T();
 	return *reinterpret_cast<T*>(p);
 }
+
+/* Typed map: stores T inline in one contiguous array, with no per-element
+   allocation and no pointer chase on reads. Locking and the growth policy
+   come from an embedded xmap_t. Trivially copyable payloads grow with
+   realloc(); other types are move-constructed into the new block.
+   Failed allocations report errno = ENOMEM rather than throwing. */
+template<class T>
+class xmap {
+public:
+	explicit xmap(unsigned growth = 0) : data_(NULL), count_(0), capacity_(0) {
+		xmap_init(&xm_);
+		if (growth) xmap_set_growth(&xm_, growth);
+	}
+	~xmap() {
+		clear();
+		free(data_);
+		xmap_destroy(&xm_);
+	}
+	xmap(const xmap&) = delete;
+	xmap& operator=(const xmap&) = delete;
+
+	/* Append (thread-safe). Returns the new index, or (size_t)-1 on failure. */
+	size_t push_back(const T& v) { return emplace_back(v); }
+	size_t push_back(T&& v) { return emplace_back(std::move(v)); }
+
+	template<class... Args>
+	size_t emplace_back(Args&&... args) {
+		guard g(&xm_);
+		if (!grow_locked(count_ + 1)) return (size_t)-1;
+		new (data_ + count_) T(std::forward<Args>(args)...);
+		return count_++;
+	}
+
+	/* Copy out / overwrite entry i (thread-safe). False when out of range. */
+	bool get(size_t i, T& out) {
+		guard g(&xm_);
+		if (i >= count_) return false;
+		out = data_[i];
+		return true;
+	}
+
+	bool set(size_t i, T v) {
+		guard g(&xm_);
+		if (i >= count_) return false;
+		data_[i] = std::move(v);
+		return true;
+	}
+
+	/* Erase entry i and shift later entries left (thread-safe) */
+	bool erase(size_t i) {
+		guard g(&xm_);
+		if (i >= count_) return false;
+		for (size_t j = i; j + 1 < count_; ++j) data_[j] = std::move(data_[j + 1]);
+		data_[--count_].~T();
+		return true;
+	}
+
+	/* Capacity management, following xmap_reserve()/xmap_shrink_to_fit() */
+	bool reserve(size_t n) {
+		guard g(&xm_);
+		return n <= capacity_ || relocate_locked(n);
+	}
+
+	bool shrink_to_fit() {
+		guard g(&xm_);
+		if (count_ == capacity_) return true;
+		if (count_ == 0) {
+			free(data_);
+			data_ = NULL;
+			capacity_ = 0;
+			return true;
+		}
+		return relocate_locked(count_);
+	}
+
+	void clear() {
+		guard g(&xm_);
+		for (size_t i = 0; i < count_; ++i) data_[i].~T();
+		count_ = 0;
+	}
+
+	size_t size() {
+		guard g(&xm_);
+		return count_;
+	}
+
+	size_t capacity() {
+		guard g(&xm_);
+		return capacity_;
+	}
+
+	/* Call fn(T&) on every entry in order under the lock (thread-safe) */
+	template<class F>
+	void for_each(F fn) {
+		guard g(&xm_);
+		for (size_t i = 0; i < count_; ++i) fn(data_[i]);
+	}
+
+	/* Unsynchronized access: the caller must rule out concurrent writers,
+	   as with xmap_iterator. Pointers are invalidated by growth. */
+	T& operator[](size_t i) { return data_[i]; }
+	T* begin() { return data_; }
+	T* end() { return data_ + count_; }
+	xmap_t* raw() { return &xm_; }
+
+private:
+	static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+
+	struct guard {
+		xmap_t *xm;
+		explicit guard(xmap_t *m) : xm(m) { xmap_lock(xm); }
+		~guard() { xmap_unlock(xm); }
+	};
+
+	bool grow_locked(size_t mincap) {
+		if (capacity_ >= mincap) return true;
+		return relocate_locked(xmap_grow_capacity(&xm_, capacity_, mincap));
+	}
+
+	/* Move the entries into a block of exactly `newcap' >= count_ slots.
+	   The copy is picked at compile time, so realloc() is never even
+	   instantiated for types that are not trivially copyable. */
+	bool relocate_locked(size_t newcap) {
+		T *tmp = move_locked(newcap, std::is_trivially_copyable<T>());
+		if (!tmp) {
+			errno = ENOMEM;
+			return false;
+		}
+		data_ = tmp;
+		capacity_ = newcap;
+		return true;
+	}
+
+	/* Trivially copyable entries: realloc() moves them bitwise */
+	T *move_locked(size_t newcap, std::true_type) {
+		return static_cast<T*>(realloc(data_, newcap * sizeof(T)));
+	}
+
+	/* Other entries are move-constructed into a fresh block */
+	T *move_locked(size_t newcap, std::false_type) {
+		T *tmp = static_cast<T*>(malloc(newcap * sizeof(T)));
+		if (tmp) {
+			for (size_t i = 0; i < count_; ++i) {
+				new (tmp + i) T(std::move(data_[i]));
+				data_[i].~T();
+			}
+			free(data_);
+		}
+		return tmp;
+	}
+
+	xmap_t xm_;
+	T *data_;
+	size_t count_;
+	size_t capacity_;
+};
 #endif
 
 #endif /* __XMAP_H__ */
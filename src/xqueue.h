@@ -0,0 +1,261 @@
+/**
+ * xqueue.h: Extern Queue Library
+ *
+ * Copyright (C) 2025 MrR736 <MrR736@users.github.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The complete text of the GNU General Public License
+ * can be found in /usr/share/common-licenses/GPL-3 file.
+ */
+
+#ifndef __XQUEUE_H__
+#define __XQUEUE_H__
+
+#include "xstddef.h"
+#include <pthread.h>
+#include <sched.h>
+
+#define XQUEUE_CACHELINE	64
+#define XQUEUE_SPIN	64 /* failed attempts before a blocking call sleeps */
+
+/* One ring slot: `seq' tells whose turn it is. A producer may fill the
+   slot at position p when seq == p; a consumer may empty it when
+   seq == p + 1. */
+typedef struct {
+	size_t seq;
+	void *data;
+} xqueue_cell_t;
+
+/* Bounded multi-producer/multi-consumer FIFO of pointers. Push and pop
+   are lock-free (one CAS each); the mutex and condition variables are
+   only used by blocking calls that have to wait. head and tail sit on
+   their own cache lines so producers and consumers do not share one. */
+typedef struct {
+	xqueue_cell_t *cells;
+	size_t mask; /* capacity - 1, capacity a power of two */
+	char pad0[XQUEUE_CACHELINE];
+	size_t head; /* next position to push */
+	char pad1[XQUEUE_CACHELINE - sizeof(size_t)];
+	size_t tail; /* next position to pop */
+	char pad2[XQUEUE_CACHELINE - sizeof(size_t)];
+	int closed; /* xqueue_close(): pushes fail, pops drain then fail */
+	unsigned waiters; /* threads sleeping (or about to) in a blocking call */
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} xqueue_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initialize a queue holding up to `capacity' pointers, rounded up to a
+   power of two (at least 2). Returns 1 on success, 0 on failure (errno
+   set: EINVAL for a zero or too large capacity, ENOMEM). */
+XSTDDEF_INLINE_API int xqueue_init(xqueue_t *q, size_t capacity) {
+	if (capacity == 0 || capacity > ((size_t)-1 >> 1) / sizeof(xqueue_cell_t)) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t cap = 2;
+	while (cap < capacity) cap <<= 1;
+	q->cells = (xqueue_cell_t *)malloc(cap * sizeof(xqueue_cell_t));
+	if (!q->cells) {
+		errno = ENOMEM;
+		return 0;
+	}
+	for (size_t i = 0; i < cap; ++i) {
+		q->cells[i].seq = i;
+		q->cells[i].data = NULL;
+	}
+	q->mask = cap - 1;
+	q->head = 0;
+	q->tail = 0;
+	q->closed = 0;
+	q->waiters = 0;
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 1;
+}
+
+/* Destroy: frees the ring. Pointers still queued are not released; the
+   caller owns them (drain with xqueue_trypop() first if needed). No
+   thread may be using the queue. */
+XSTDDEF_INLINE_API void xqueue_destroy(xqueue_t *q) {
+	free(q->cells);
+	q->cells = NULL;
+	q->mask = 0;
+	pthread_mutex_destroy(&q->mutex);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+/* Helper: wake threads sleeping in a blocking call (after a push wakes
+   consumers, after a pop producers). The seq_cst fence pairs with the
+   one in xqueue_wait(): either the sleeper sees the new state on its
+   re-check, or we see it in `waiters'. */
+XSTDDEF_INLINE_API void xqueue_wake(xqueue_t *q, pthread_cond_t *cond) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&q->waiters, __ATOMIC_RELAXED)) return;
+	pthread_mutex_lock(&q->mutex);
+	pthread_cond_broadcast(cond);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/* Helper: claim the slot at head and fill it, without waking anyone.
+   Returns 1 on success, 0 if full (errno EAGAIN) or closed (EPIPE). */
+XSTDDEF_INLINE_API int xqueue_enqueue(xqueue_t *q, void *data) {
+	if (__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) {
+		errno = EPIPE;
+		return 0;
+	}
+	size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		xqueue_cell_t *c = &q->cells[pos & q->mask];
+		size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				c->data = data;
+				__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (dif < 0) {
+			errno = EAGAIN; /* the slot still holds an item from one lap ago */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Helper: claim the slot at tail and empty it, without waking anyone.
+   Returns 1 on success, 0 if empty (errno EAGAIN, or EPIPE once closed). */
+XSTDDEF_INLINE_API int xqueue_dequeue(xqueue_t *q, void **out) {
+	size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		xqueue_cell_t *c = &q->cells[pos & q->mask];
+		size_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*out = c->data;
+				/* free the slot for the producer one lap ahead */
+				__atomic_store_n(&c->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (dif < 0) {
+			errno = __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE) ? EPIPE : EAGAIN;
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Non-blocking push (thread-safe, lock-free). Returns 1 on success, 0 if
+   the queue is full (errno EAGAIN) or closed (errno EPIPE). */
+XSTDDEF_INLINE_API int xqueue_trypush(xqueue_t *q, void *data) {
+	if (!xqueue_enqueue(q, data)) return 0;
+	xqueue_wake(q, &q->not_empty);
+	return 1;
+}
+
+/* Non-blocking pop (thread-safe, lock-free). Stores the oldest pointer in
+   *out and returns 1, or returns 0 if the queue is empty (errno EAGAIN,
+   or EPIPE once it is also closed). */
+XSTDDEF_INLINE_API int xqueue_trypop(xqueue_t *q, void **out) {
+	if (!xqueue_dequeue(q, out)) return 0;
+	xqueue_wake(q, &q->not_full);
+	return 1;
+}
+
+/* Helper: one sleeping attempt of a blocking push (push != 0, `arg' is
+   the pointer) or pop (`arg' is the void ** out). Registers as a waiter,
+   re-checks under the mutex and sleeps if that fails with EAGAIN; the
+   re-check closes the lost-wakeup window (see xqueue_wake()). Returns 1
+   if the re-check succeeded, else 0 with errno EAGAIN (try again) or
+   EPIPE. */
+XSTDDEF_INLINE_API int xqueue_wait(xqueue_t *q, int push, void *arg) {
+	pthread_mutex_lock(&q->mutex);
+	__atomic_fetch_add(&q->waiters, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int ok = push ? xqueue_enqueue(q, arg) : xqueue_dequeue(q, (void **)arg);
+	if (!ok && errno == EAGAIN) {
+		pthread_cond_wait(push ? &q->not_full : &q->not_empty, &q->mutex);
+		errno = EAGAIN;
+	}
+	__atomic_fetch_sub(&q->waiters, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&q->mutex);
+	if (ok) xqueue_wake(q, push ? &q->not_empty : &q->not_full);
+	return ok;
+}
+
+/* Blocking push (thread-safe): waits while the queue is full. Spins
+   briefly before sleeping. Returns 1 on success, 0 if the queue is or
+   becomes closed (errno EPIPE). */
+XSTDDEF_INLINE_API int xqueue_push(xqueue_t *q, void *data) {
+	for (unsigned spin = 0;; ++spin) {
+		if (xqueue_trypush(q, data)) return 1;
+		if (errno != EAGAIN) return 0;
+		if (spin < XQUEUE_SPIN) sched_yield();
+		else if (xqueue_wait(q, 1, data)) return 1;
+		else if (errno != EAGAIN) return 0;
+	}
+}
+
+/* Blocking pop (thread-safe): waits while the queue is empty. Returns 1
+   with the oldest pointer in *out, or 0 once the queue is closed and
+   drained (errno EPIPE). */
+XSTDDEF_INLINE_API int xqueue_pop(xqueue_t *q, void **out) {
+	for (unsigned spin = 0;; ++spin) {
+		if (xqueue_trypop(q, out)) return 1;
+		if (errno != EAGAIN) return 0;
+		if (spin < XQUEUE_SPIN) sched_yield();
+		else if (xqueue_wait(q, 0, out)) return 1;
+		else if (errno != EAGAIN) return 0;
+	}
+}
+
+/* Close the queue (thread-safe): later pushes fail with EPIPE, pops
+   return what is left and then fail with EPIPE. Wakes every blocked
+   thread. */
+XSTDDEF_INLINE_API void xqueue_close(xqueue_t *q) {
+	pthread_mutex_lock(&q->mutex);
+	__atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/* Number of queued pointers (thread-safe). Only a snapshot while other
+   threads push or pop. */
+XSTDDEF_INLINE_API size_t xqueue_size(xqueue_t *q) {
+	size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	return (head > tail) ? head - tail : 0;
+}
+
+/* Capacity of the ring (thread-safe) */
+XSTDDEF_INLINE_API size_t xqueue_capacity(xqueue_t *q) {
+	return q->mask + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XQUEUE_H__ */
@@ -1,8 +1,27 @@
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cwchar>
+#include <pthread.h>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 #include "xmap.h"
 
+// Checks print "Passed" or "Failed"; failures also set the exit status
+static int failures = 0;
+
+static const char *failed(const char *verdict = "Failed") {
+	failures++;
+	return verdict;
+}
+
 void test_xmap_basic_operations() {
 	xmap_t xm;
 	xmap_init(&xm);
@@ -46,6 +65,1200 @@ void test_xmap_basic_operations() {
 	xmap_destroy(&xm);
 }
 
+void test_xmap_keyed_lookup() {
+	xmap_t xm;
+	xmap_init(&xm);
+
+	const int num_keys = 100000;
+	char key[32];
+	for (int i = 0; i < num_keys; i++) {
+		snprintf(key, sizeof(key), "sym%d", i);
+		int *value = (int *)malloc(sizeof(int));
+		*value = i;
+		xmap_put(&xm, key, value);
+	}
+
+	int found = 0;
+	for (int i = 0; i < num_keys; i++) {
+		snprintf(key, sizeof(key), "sym%d", i);
+		int *value = (int *)xmap_find(&xm, key);
+		if (value && *value == i) found++;
+	}
+	std::cout << "Keyed lookup: " << (found == num_keys ? "Passed" : failed()) << "\n";
+
+	// Remove every other key, then check the survivors
+	for (int i = 0; i < num_keys; i += 2) {
+		snprintf(key, sizeof(key), "sym%d", i);
+		xmap_remove(&xm, key);
+	}
+	int *odd = (int *)xmap_find(&xm, "sym1");
+	std::cout << "Keyed remove: "
+			  << (!xmap_find(&xm, "sym0") && odd && *odd == 1
+				  && xmap_keycount(&xm) == (size_t)num_keys / 2 ? "Passed" : failed()) << "\n";
+
+	// Wide-string and integer keys live in the same table
+	xmap_wcsput(&xm, L"wide", strdup("wide value"));
+	xmap_intput(&xm, 42, strdup("int value"));
+	const char *w = (const char *)xmap_wcsfind(&xm, L"wide");
+	const char *n = (const char *)xmap_intfind(&xm, 42);
+	std::cout << "Wide/int keys: "
+			  << (w && !strcmp(w, "wide value") && n && !strcmp(n, "int value")
+				  && !xmap_intfind(&xm, 43) ? "Passed" : failed()) << "\n";
+
+	xmap_destroy(&xm);
+}
+
+void test_xmap_compaction() {
+	xmap_t xm;
+	xmap_init(&xm);
+
+	char buf[32];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "s%d", i);
+		xmap_strinsert(&xm, buf);
+		xmap_insert(&xm, malloc(16));
+		xmap_wcsinsert(&xm, L"w");
+	}
+
+	// O(1) removals: tombstone every even string and every generic slot
+	for (size_t i = 0; i < 1000; i += 2)
+		xmap_strerase_no_shift(&xm, i);
+	for (size_t i = 1; i < xm.count; i += 3)
+		xmap_erase_no_shift(&xm, i);
+
+	std::cout << "Tombstones before compact: " << xmap_dead(&xm) << "\n";
+	size_t dropped = xmap_compact(&xm);
+
+	char *first = xmap_strget(&xm, 0);
+	char *last = xmap_strget(&xm, xm.cstr - 1);
+	std::cout << "Compaction: "
+			  << (dropped == 1500 && xm.count == 1500 && xm.cstr == 500
+				  && xm.cwstr == 1000 && xmap_dead(&xm) == 0
+				  && first && !strcmp(first, "s1") && last && !strcmp(last, "s999")
+				  && xmap_wcsget(&xm, 999) ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+	// NULL is a legal value: only tagged tombstones are dropped
+	xmap_init(&xm);
+	xmap_insert(&xm, NULL);
+	xmap_strinsert(&xm, "a");
+	xmap_insert(&xm, NULL);
+	xmap_strinsert(&xm, "b");
+	xmap_strerase_no_shift(&xm, 0);
+	xmap_erase_no_shift(&xm, 2); /* a NULL value is not a tombstone to make */
+	int ok = xmap_dead(&xm) == 1;
+	dropped = xmap_compact(&xm);
+	std::cout << "Compaction keeps NULL values: "
+			  << (ok && dropped == 1 && xm.count == 3 && !xmap_get(&xm, 0) && !xmap_get(&xm, 1)
+				  && xm.cstr == 1 && !strcmp(xmap_strget(&xm, 0), "b") && xmap_dead(&xm) == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+}
+
+struct reader_arg {
+	xmap_t *xm;
+	size_t reads;
+	size_t bad;
+};
+
+static void *reader_thread(void *p) {
+	reader_arg *ra = (reader_arg *)p;
+	char expect[32];
+	unsigned seed = 12345;
+	for (size_t r = 0; r < ra->reads; r++) {
+		seed = seed * 1103515245u + 12345u;
+		size_t i = (seed >> 8) % 100000;
+		char *s = xmap_strget(ra->xm, i);
+		if (!s) continue; /* not inserted yet */
+		snprintf(expect, sizeof(expect), "v%zu", i);
+		if (strcmp(s, expect) != 0) ra->bad++;
+	}
+	return NULL;
+}
+
+static void *writer_thread(void *p) {
+	xmap_t *xm = (xmap_t *)p;
+	char buf[32];
+	for (size_t i = xm->cstr; i < 100000; i++) {
+		snprintf(buf, sizeof(buf), "v%zu", i);
+		xmap_strinsert(xm, buf);
+	}
+	return NULL;
+}
+
+static double run_readers(xmap_t *xm, int nthreads, size_t reads, int with_writer, size_t *bad) {
+	pthread_t th[8], wr;
+	reader_arg args[8];
+	auto t0 = std::chrono::steady_clock::now();
+	if (with_writer) pthread_create(&wr, NULL, writer_thread, xm);
+	for (int t = 0; t < nthreads; t++) {
+		args[t].xm = xm;
+		args[t].reads = reads;
+		args[t].bad = 0;
+		pthread_create(&th[t], NULL, reader_thread, &args[t]);
+	}
+	for (int t = 0; t < nthreads; t++) {
+		pthread_join(th[t], NULL);
+		*bad += args[t].bad;
+	}
+	if (with_writer) pthread_join(wr, NULL);
+	std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+	return (double)(reads * nthreads) / dt.count();
+}
+
+void test_xmap_readmostly() {
+	size_t bad = 0;
+
+	// Readers racing a writer that keeps growing the arrays
+	xmap_t xm;
+	xmap_init_flags(&xm, XMAP_READMOSTLY);
+	run_readers(&xm, 4, 200000, 1, &bad);
+	std::cout << "Lock-free reads during growth: "
+			  << (bad == 0 && xm.cstr == 100000 ? "Passed" : failed()) << "\n";
+
+	// Read scaling, mutex vs. seqlock
+	xmap_t locked;
+	xmap_init(&locked);
+	writer_thread(&locked);
+	for (int threads = 1; threads <= 4; threads *= 4) {
+		double m = run_readers(&locked, threads, 500000, 0, &bad);
+		double r = run_readers(&xm, threads, 500000, 0, &bad);
+		std::cout << threads << " reader thread(s): mutex " << (size_t)m
+				  << " reads/s, readmostly " << (size_t)r << " reads/s\n";
+	}
+
+	xmap_destroy(&locked);
+	xmap_destroy(&xm);
+}
+
+static void *producer_thread(void *p) {
+	xmap_sharded_t *xs = (xmap_sharded_t *)p;
+	for (int i = 0; i < 50000; i++) {
+		int *v = (int *)malloc(sizeof(int));
+		*v = 1;
+		xmap_sharded_insert(xs, v);
+	}
+	return NULL;
+}
+
+static int sum_entry(void *data, void *arg) {
+	*(long *)arg += *(int *)data;
+	return 0;
+}
+
+void test_xmap_sharded() {
+	xmap_sharded_t xs;
+	xmap_sharded_init(&xs, 8, 0);
+
+	pthread_t th[4];
+	for (int t = 0; t < 4; t++) pthread_create(&th[t], NULL, producer_thread, &xs);
+	for (int t = 0; t < 4; t++) pthread_join(th[t], NULL);
+
+	long sum = 0;
+	xmap_sharded_foreach(&xs, sum_entry, &sum);
+	std::cout << "Sharded inserts: "
+			  << (xmap_sharded_count(&xs) == 200000 && sum == 200000 ? "Passed" : failed()) << "\n";
+
+	char key[32];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		xmap_sharded_put(&xs, key, strdup(key));
+	}
+	xmap_sharded_remove(&xs, "k7");
+	const char *k500 = (const char *)xmap_sharded_find(&xs, "k500");
+	std::cout << "Sharded keys: "
+			  << (xmap_sharded_keycount(&xs) == 999 && !xmap_sharded_find(&xs, "k7")
+				  && k500 && !strcmp(k500, "k500") ? "Passed" : failed()) << "\n";
+
+	xmap_sharded_destroy(&xs);
+}
+
+static double fill_and_destroy(unsigned flags, int n, int *ok) {
+	xmap_t xm;
+	xmap_init_flags(&xm, flags);
+	char buf[32];
+	auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "String %d", i);
+		xmap_strinsert(&xm, buf);
+	}
+	xmap_wcsinsert(&xm, L"wide");
+	*ok = xm.cstr == (size_t)n && !strcmp(xmap_strget(&xm, n - 1), buf)
+		&& !wcscmp(xmap_wcsget(&xm, 0), L"wide");
+	xmap_destroy(&xm);
+	std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+	return dt.count();
+}
+
+void test_xmap_arena() {
+	int ok_heap = 0, ok_arena = 0;
+	double heap = fill_and_destroy(0, 1000000, &ok_heap);
+	double arena = fill_and_destroy(XMAP_ARENA, 1000000, &ok_arena);
+	std::cout << "1M strings insert+destroy: malloc " << heap << "s, arena " << arena << "s\n";
+
+	// Arena strings mixed with heap pointers: erase must only free the latter
+	xmap_t xm;
+	xmap_init_flags(&xm, XMAP_ARENA);
+	xmap_strinsert(&xm, "a");
+	xmap_insert(&xm, malloc(32));
+	xmap_strinsert(&xm, "b");
+	xmap_erase(&xm, 0);
+	xmap_erase(&xm, 0);
+	xmap_strerase_no_shift(&xm, 0);
+	xmap_strinsert(&xm, "c");
+	// Ownership lives in the slot tag, so release never searches the chunks
+	std::cout << "Arena storage: "
+			  << (ok_heap && ok_arena && xm.count == 2 && !strcmp(xmap_strget(&xm, 1), "c")
+				  && (xm.tags[1] & XMAP_ENTRY_SHARED)
+				  ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+}
+
+void test_xmap_intern() {
+	xmap_t xm;
+	xmap_init_flags(&xm, XMAP_INTERN);
+
+	char buf[32];
+	for (int i = 0; i < 100000; i++) {
+		snprintf(buf, sizeof(buf), "tag%d", i % 100);
+		xmap_strinsert(&xm, buf);
+	}
+	xmap_wcsinsert(&xm, L"wide");
+	xmap_wcsinsert(&xm, L"wide");
+
+	// Identical strings share one copy: equality is a pointer compare
+	const char *h = xmap_strintern(&xm, "tag42");
+	std::cout << "Interned inserts: "
+			  << (xm.cstr == 100000 && xmap_interncount(&xm) == 101
+				  && xmap_strget(&xm, 42) == h && xmap_strget(&xm, 142) == h
+				  && xmap_wcsget(&xm, 0) == xmap_wcsget(&xm, 1) ? "Passed" : failed()) << "\n";
+
+	// Erasing a positional entry must not release the shared copy
+	xmap_strerase(&xm, 42);
+	xmap_strerase_no_shift(&xm, 141);
+	std::cout << "Interned erase: "
+			  << (!strcmp(h, "tag42") && xmap_strintern(&xm, "tag42") == h
+				  && xmap_strintern(&xm, "fresh") != h ? "Passed" : failed()) << "\n";
+
+	xmap_destroy(&xm);
+}
+
+void test_xmap_batch() {
+	const int N = 1000000;
+	std::vector<std::string> rows(N);
+	std::vector<const char *> ptrs(N);
+	for (int i = 0; i < N; i++) {
+		rows[i] = "row" + std::to_string(i);
+		ptrs[i] = rows[i].c_str();
+	}
+	ptrs[7] = NULL;  // NULL entries are skipped
+
+	xmap_t a, b;
+	xmap_init(&a);
+	xmap_init(&b);
+	auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < N; i++) xmap_strinsert(&a, ptrs[i]);
+	auto t1 = std::chrono::steady_clock::now();
+	size_t n = xmap_strinsert_many(&b, ptrs.data(), N);
+	auto t2 = std::chrono::steady_clock::now();
+	double one = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	double many = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	std::cout << "One-by-one " << one << " ms, batch " << many << " ms\n";
+	std::cout << "Batch string insert: "
+			  << (n == (size_t)N - 1 && b.count == a.count && b.cstr == a.cstr
+				  && !strcmp(xmap_strget(&b, 7), "row8")
+				  && !strcmp(xmap_strget(&b, N - 2), ptrs[N - 1]) ? "Passed" : failed()) << "\n";
+
+	void *out[4];
+	size_t got = xmap_get_many(&b, N - 3, out, 4);
+	std::cout << "Batch get: "
+			  << (got == 2 && !strcmp((char *)out[1], ptrs[N - 1])
+				  && xmap_get_many(&b, N, out, 4) == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&a);
+	xmap_destroy(&b);
+
+	// Raw pointers and wide strings, including an arena-backed map
+	xmap_t c;
+	xmap_init_flags(&c, XMAP_ARENA);
+	void *raw[3] = { strdup("x"), strdup("y"), strdup("z") };
+	const wchar_t *wide[2] = { L"alpha", L"beta" };
+	std::cout << "Batch raw/wide insert: "
+			  << (xmap_insert_many(&c, raw, 3) == 3 && xmap_wcsinsert_many(&c, wide, 2) == 2
+				  && c.count == 5 && c.cwstr == 2 && !wcscmp(xmap_wcsget(&c, 1), L"beta")
+				  && xmap_get(&c, 2) == raw[2] ? "Passed" : failed()) << "\n";
+	xmap_destroy(&c);
+}
+
+void test_xmap_capacity() {
+	xmap_t xm;
+	xmap_init(&xm);
+
+	// Pre-sizing avoids every growth step during warm-up
+	int ok = xmap_reserve(&xm, 100000, 100000, 0);
+	void **before = xm.map;
+	for (int i = 0; i < 100000; i++) xmap_strinsert(&xm, "v");
+	std::cout << "Reserve: "
+			  << (ok && xm.capacity == 100000 && xm.cstr_capacity == 100000
+				  && xm.map == before ? "Passed" : failed()) << "\n";
+
+	// Custom growth factor (1.5x) and rejection of non-growing factors
+	xmap_t g;
+	xmap_init(&g);
+	std::cout << "Growth factor: "
+			  << (!xmap_set_growth(&g, 100) && xmap_set_growth(&g, 150) ? "" : failed("Failed "));
+	for (int i = 0; i < 7; i++) xmap_insert(&g, NULL);
+	std::cout << (g.capacity == 9 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&g);
+
+	// Mass deletion followed by shrink gives memory back
+	for (int i = 0; i < 100000; i += 2) xmap_strerase_no_shift(&xm, i);
+	xmap_compact(&xm);
+	char key[16];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		xmap_put(&xm, key, NULL);
+	}
+	for (int i = 10; i < 1000; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		xmap_remove(&xm, key);
+	}
+	ok = xmap_shrink_to_fit(&xm);
+	std::cout << "Shrink to fit: "
+			  << (ok && xm.capacity == 50000 && xm.cstr_capacity == 50000 && xm.hash.capacity == 16
+				  && !strcmp(xmap_strget(&xm, 49999), "v") && xmap_keycount(&xm) == 10 ? "Passed" : failed()) << "\n";
+
+	while (xm.count) xmap_erase(&xm, xm.count - 1);
+	std::cout << "Shrink empty map: "
+			  << (xmap_shrink_to_fit(&xm) && xm.map == NULL && xm.capacity == 0 ? "Passed" : failed()) << "\n";
+	xmap_insert(&xm, strdup("again"));
+	std::cout << "Reuse after shrink: " << (!strcmp((char *)xmap_get(&xm, 0), "again") ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+}
+
+struct pool_stats { int allocs, frees, dtors; };
+
+static void *pool_alloc(size_t size, void *ctx) {
+	((pool_stats *)ctx)->allocs++;
+	return malloc(size);
+}
+
+static void pool_free(void *ptr, void *ctx) {
+	((pool_stats *)ctx)->frees++;
+	free(ptr);
+}
+
+static void count_dtor(void *data, void *ctx) {
+	((pool_stats *)ctx)->dtors++;
+	(void)data;
+}
+
+void test_xmap_ownership() {
+	// Values from a caller-owned pool: destructor instead of free()
+	static int pool[8];
+	pool_stats st = { 0, 0, 0 };
+	xmap_allocator_t a = { pool_alloc, pool_free, &st };
+	xmap_t xm;
+	xmap_init_alloc(&xm, 0, &a, count_dtor, &st);
+	for (int i = 0; i < 8; i++) xmap_insert(&xm, &pool[i]);
+	xmap_strinsert(&xm, "copied");
+	xmap_put(&xm, "key", &pool[0]);
+	xmap_put(&xm, "key", &pool[1]);   // replace: destructor on the old value
+	xmap_erase(&xm, 0);
+	xmap_erase_no_shift(&xm, 1);
+	xmap_erase(&xm, 7);               // the string slot: back to the allocator
+	int mid = (st.dtors == 3 && st.allocs == 2 && st.frees == 1);
+	xmap_destroy(&xm);
+	std::cout << "Destructor and allocator: "
+			  << (mid && st.dtors == 3 + 6 + 1 && st.frees == 2 ? "Passed" : failed()) << "\n";
+
+	// Non-owning map: values are never released
+	xmap_t borrowed;
+	xmap_init_flags(&borrowed, XMAP_NONOWNING);
+	for (int i = 0; i < 8; i++) xmap_insert(&borrowed, &pool[i]);
+	xmap_intput(&borrowed, 1, &pool[2]);
+	xmap_strinsert(&borrowed, "still owned");
+	xmap_erase(&borrowed, 3);
+	xmap_intremove(&borrowed, 1);
+	std::cout << "Non-owning: "
+			  << (borrowed.count == 8 && !strcmp(xmap_strget(&borrowed, 0), "still owned") ? "Passed" : failed()) << "\n";
+	xmap_destroy(&borrowed);
+}
+
+static void *typed_pusher(void *p) {
+	xmap<int> *m = (xmap<int> *)p;
+	for (int i = 0; i < 10000; i++) m->push_back(i);
+	return NULL;
+}
+
+void test_xmap_typed() {
+	// POD payload: contiguous, no per-element allocation
+	xmap<int> ints;
+	ints.reserve(4);
+	for (int i = 0; i < 100000; i++) ints.push_back(i);
+	long long sum = 0;
+	for (int v : ints) sum += v;
+	int second = -1;
+	std::cout << "Typed POD map: "
+			  << (ints.size() == 100000 && sum == 4999950000LL && &ints[1] == &ints[0] + 1
+				  && ints.get(2, second) && second == 2 && !ints.get(100000, second) ? "Passed" : failed()) << "\n";
+
+	pthread_t t[4];
+	xmap<int> shared;
+	for (int i = 0; i < 4; i++) pthread_create(&t[i], NULL, typed_pusher, &shared);
+	for (int i = 0; i < 4; i++) pthread_join(t[i], NULL);
+	std::cout << "Typed concurrent push: " << (shared.size() == 40000 ? "Passed" : failed()) << "\n";
+
+	// Non-trivial and move-only payloads survive growth and erase
+	xmap<std::string> strs;
+	for (int i = 0; i < 1000; i++) strs.push_back("s" + std::to_string(i));
+	strs.erase(0);
+	strs.set(1, std::string(64, 'x'));
+	std::string out;
+	xmap<std::unique_ptr<int>> owned(150);
+	for (int i = 0; i < 100; i++) owned.emplace_back(new int(i));
+	owned.erase(10);
+	owned.shrink_to_fit();
+	std::cout << "Typed move-aware map: "
+			  << (strs.get(0, out) && out == "s1" && strs.size() == 999 && strs[1].size() == 64
+				  && owned.size() == 99 && owned.capacity() == 99 && *owned[10] == 11 ? "Passed" : failed()) << "\n";
+}
+
+static void *churn_thread(void *p) {
+	xmap_t *xm = (xmap_t *)p;
+	for (int i = 0; i < 20000; i++) {
+		xmap_strinsert(xm, "churn");
+		xmap_strerase(xm, 0);
+	}
+	return NULL;
+}
+
+void test_xmap_view() {
+	xmap_t xm;
+	xmap_init(&xm);
+	for (int i = 0; i < 1000; i++) {
+		int *p = (int *)malloc(sizeof(int));
+		*p = i;
+		xmap_insert(&xm, p);
+	}
+	for (int i = 0; i < 1000; i += 10) xmap_erase_no_shift(&xm, i);
+
+	// The unsynchronized iterator now skips tombstones
+	long long sum = 0;
+	for (auto it = xmap_begin<int>(&xm); it != xmap_end<int>(&xm); ++it) sum += *it;
+
+	// A view stays readable while a writer erases everything it captured
+	xmap_view_t v;
+	int ok = xmap_view_begin(&xm, &v);
+	xmap_compact(&xm);
+	while (xm.count) xmap_erase(&xm, 0);
+	long long vsum = 0;
+	for (size_t i = 0; i < v.count; i++) vsum += *(int *)v.items[i];
+	std::cout << "View skips tombstones: "
+			  << (ok && v.count == 900 && sum == 499500 - 49500 && vsum == sum ? "Passed" : failed()) << "\n";
+	xmap_view_end(&v);
+
+	// C++ views over a map that another thread keeps churning
+	xmap_t hot;
+	xmap_init(&hot);
+	for (int i = 0; i < 100; i++) xmap_strinsert(&hot, "stable");
+	pthread_t t;
+	pthread_create(&t, NULL, churn_thread, &hot);
+	size_t bad = 0, seen = 0;
+	for (int round = 0; round < 200; round++) {
+		xmap_view<char> view(&hot);
+		for (char &c : view) {
+			seen++;
+			if (c != 's' && c != 'c') bad++;
+		}
+	}
+	pthread_join(t, NULL);
+	std::cout << "View under concurrent erase: "
+			  << (bad == 0 && seen >= 200 * 100 && hot.deferred == NULL ? "Passed" : failed()) << "\n";
+	xmap_destroy(&hot);
+
+	// Inline strings are copied: growth reallocates and erases shift the cells
+	xmap_t inl;
+	xmap_init_flags(&inl, XMAP_INLINE);
+	char buf[16];
+	for (int i = 0; i < 100; i++) {
+		snprintf(buf, sizeof(buf), "s%d", i);
+		xmap_strinsert(&inl, buf);
+	}
+	xmap_insert(&inl, strdup("a heap string longer than a cell"));
+	ok = xmap_view_begin(&inl, &v);
+	for (int i = 0; i < 10000; i++) xmap_strinsert(&inl, "grow");
+	while (inl.count) xmap_erase(&inl, 0);
+	xmap_shrink_to_fit(&inl);
+	for (size_t i = 0; ok && i < 100; i++) {
+		snprintf(buf, sizeof(buf), "s%zu", i);
+		ok = !strcmp((const char *)v.items[i], buf);
+	}
+	std::cout << "View copies inline strings: "
+			  << (ok && v.count == 101 && !strcmp((const char *)v.items[100], "a heap string longer than a cell")
+				  ? "Passed" : failed()) << "\n";
+	xmap_view_end(&v);
+	xmap_strinsert(&inl, "kept");
+	xmap_wcsinsert(&inl, L"wide");
+	std::string kept = xxmap_strget(&inl, 0);
+	std::wstring wide = xxmap_wcsget(&inl, 0);
+	for (int i = 0; i < 10000; i++) xmap_strinsert(&inl, "grow");
+	std::cout << "xxmap_strget copies inline strings: "
+			  << (kept == "kept" && wide == L"wide" && xxmap_strget(&inl, 1) == "grow" ? "Passed" : failed()) << "\n";
+	xmap_destroy(&inl);
+	xmap_destroy(&xm);
+}
+
+static void count_entry(void *data, void *arg) {
+	__atomic_fetch_add((long long *)arg, *(int *)data, __ATOMIC_RELAXED);
+}
+
+static void sum_into(void *data, void *acc, void *arg) {
+	*(long long *)acc += *(int *)data;
+	(void)arg;
+}
+
+static void sum_combine(void *result, const void *partial, void *arg) {
+	*(long long *)result += *(const long long *)partial;
+	(void)arg;
+}
+
+void test_xmap_parallel() {
+	const int N = 200000;
+	xmap_t xm;
+	xmap_init(&xm);
+	for (int i = 0; i < N; i++) {
+		int *p = (int *)malloc(sizeof(int));
+		*p = i;
+		xmap_insert(&xm, p);
+	}
+	xmap_erase_no_shift(&xm, 5);   // tombstones are skipped
+
+	long long expect = (long long)N * (N - 1) / 2 - 5;
+	long long total = 0;
+	size_t n = xmap_parallel_foreach(&xm, 4, count_entry, &total);
+	std::cout << "Parallel foreach: " << (n == (size_t)N - 1 && total == expect ? "Passed" : failed()) << "\n";
+
+	long long sum = 0;
+	n = xmap_parallel_reduce(&xm, 0, &sum, sizeof(sum), sum_into, sum_combine, NULL);
+	std::cout << "Parallel reduce: " << (n == (size_t)N - 1 && sum == expect ? "Passed" : failed()) << "\n";
+
+	xmap_t empty;
+	xmap_init(&empty);
+	sum = 0;
+	std::cout << "Parallel reduce on empty map: "
+			  << (xmap_parallel_reduce(&empty, 8, &sum, sizeof(sum), sum_into, sum_combine, NULL) == 0 && sum == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&empty);
+	xmap_destroy(&xm);
+}
+
+void test_xmap_image() {
+	const char *path = "test_xmap_image.bin";
+	xmap_t xm;
+	xmap_init(&xm);
+	char buf[32];
+	for (int i = 0; i < 10000; i++) {
+		snprintf(buf, sizeof(buf), "line%d", i);
+		xmap_strinsert(&xm, buf);
+	}
+	xmap_wcsinsert(&xm, L"wide");
+	xmap_insert(&xm, strdup("raw"));   // not a string entry: not saved
+	xmap_strerase_no_shift(&xm, 3);     // tombstone: kept as a placeholder
+	xmap_wcsinsert(&xm, L"gone");
+	xmap_wcserase_no_shift(&xm, 1);
+	int saved = xmap_save(&xm, path);
+	xmap_destroy(&xm);
+
+	xmap_t img;
+	int loaded = xmap_load(&img, path, 0);
+	std::cout << "Save/load image: "
+			  << (saved && loaded && img.count == 10002 && img.cstr == 10000 && img.cwstr == 2
+				  && !strcmp(xmap_strget(&img, 0), "line0") && !strcmp(xmap_strget(&img, 4), "line4")
+				  && !wcscmp(xmap_wcsget(&img, 0), L"wide") ? "Passed" : failed()) << "\n";
+	std::cout << "Tombstones keep string indices: "
+			  << (!xmap_strget(&img, 3) && !xmap_wcsget(&img, 1) && xmap_dead(&img) == 2
+				  && xmap_compact(&img) == 2 && !strcmp(xmap_strget(&img, 3), "line4") && img.cwstr == 1 ? "Passed" : failed()) << "\n";
+
+	// The loaded map stays writable; image strings are never freed
+	xmap_strerase(&img, 0);
+	xmap_strinsert(&img, "fresh");
+	std::cout << "Writable image map: "
+			  << (!strcmp(xmap_strget(&img, img.cstr - 1), "fresh") && !strcmp(xmap_strget(&img, 0), "line1") ? "Passed" : failed()) << "\n";
+	xmap_destroy(&img);
+
+	// Truncated images are rejected
+	FILE *f = fopen(path, "r+b");
+	char hdr[48];
+	size_t got = fread(hdr, 1, sizeof(hdr), f);
+	fclose(f);
+	f = fopen(path, "wb");
+	fwrite(hdr, 1, got, f);
+	fclose(f);
+	xmap_t bad;
+	std::cout << "Corrupt image rejected: " << (!xmap_load(&bad, path, 0) && errno == EINVAL && bad.count == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&bad);
+	remove(path);
+}
+
+static int collect_ordered(const char *str, size_t i, void *arg) {
+	std::vector<std::string> *out = (std::vector<std::string> *)arg;
+	out->push_back(str);
+	(void)i;
+	return out->size() == 3;
+}
+
+void test_xmap_ordered() {
+	xmap_t xm;
+	xmap_init(&xm);
+	const char *words[] = { "pear", "apple", "apricot", "banana", "apex", "cherry", "app" };
+	for (const char *w : words) xmap_strinsert(&xm, w);
+
+	size_t first = 0;
+	size_t n = xmap_strprefix(&xm, "ap", &first);
+	std::cout << "Prefix query: "
+			  << (n == 4 && first == 0 && !strcmp(xmap_strget(&xm, xmap_strrank(&xm, 0)), "apex")
+				  && !strcmp(xmap_strget(&xm, xmap_strrank(&xm, 3)), "apricot") ? "Passed" : failed()) << "\n";
+
+	// Appends are merged into the existing index; erases rebuild it
+	xmap_strinsert(&xm, "aardvark");
+	xmap_strinsert(&xm, "zebra");
+	xmap_strerase(&xm, 0);   // "pear"
+	std::vector<std::string> seen;
+	xmap_strscan(&xm, "b", collect_ordered, &seen);
+	size_t lb = xmap_strlower_bound(&xm, "b");
+	std::cout << "Ordered scan: "
+			  << (seen.size() == 3 && seen[0] == "banana" && seen[1] == "cherry" && seen[2] == "zebra"
+				  && lb == 5 && xmap_strrank(&xm, 8) == (size_t)-1 ? "Passed" : failed()) << "\n";
+
+	// Large map: lower_bound agrees with a sorted copy
+	xmap_t big;
+	xmap_init(&big);
+	std::vector<std::string> all;
+	char buf[32];
+	for (int i = 0; i < 50000; i++) {
+		snprintf(buf, sizeof(buf), "k%07d", (i * 7919) % 50000);
+		xmap_strinsert(&big, buf);
+		all.push_back(buf);
+		if (i == 25000) xmap_strlower_bound(&big, "");   // index half, merge the rest
+	}
+	xmap_wcsinsert(&big, L"beta");
+	xmap_wcsinsert(&big, L"alpha");
+	std::sort(all.begin(), all.end());
+	int ok = 1;
+	for (int r = 0; r < 50000; r += 997)
+		if (all[r] != xmap_strget(&big, xmap_strrank(&big, r))) ok = 0;
+	std::cout << "Incremental merge: "
+			  << (ok && xmap_strprefix(&big, "k00001", NULL) == 100
+				  && !wcscmp(xmap_wcsget(&big, xmap_wcsrank(&big, 0)), L"alpha") ? "Passed" : failed()) << "\n";
+	xmap_destroy(&big);
+	xmap_destroy(&xm);
+}
+
+void test_xmap_tags() {
+	xmap_t xm;
+	xmap_init(&xm);
+	xmap_strinsert(&xm, "alpha");          // map 0, str 0
+	xmap_insert(&xm, strdup("value"));     // map 1
+	xmap_wcsinsert(&xm, L"wide");          // map 2, wstr 0
+	const char *batch[] = { "be", NULL, "gamma" };
+	xmap_strinsert_many(&xm, batch, 3);    // map 3-4, str 1-2
+	std::cout << "Entry types and lengths: "
+			  << (xmap_entry_type(&xm, 0) == XMAP_ENTRY_STR && xmap_entry_type(&xm, 1) == XMAP_ENTRY_VALUE
+				  && xmap_entry_type(&xm, 2) == XMAP_ENTRY_WCS && xmap_entry_type(&xm, 5) == -1
+				  && xmap_strlen(&xm, 0) == 5 && xmap_strlen(&xm, 1) == 2 && xmap_strlen(&xm, 2) == 5
+				  && xmap_wcslen(&xm, 0) == 4 && xmap_strlen(&xm, 3) == (size_t)-1 ? "Passed" : failed()) << "\n";
+
+	// Erasing a value renumbers the string lists past it
+	xmap_erase(&xm, 1);
+	xmap_strerase(&xm, 1);
+	std::cout << "Erase keeps tags aligned: "
+			  << (xm.count == 3 && xm.cstr == 2 && xmap_entry_type(&xm, 1) == XMAP_ENTRY_WCS
+				  && !wcscmp(xmap_wcsget(&xm, 0), L"wide") && !strcmp(xmap_strget(&xm, 1), "gamma")
+				  && xmap_strlen(&xm, 1) == 5 ? "Passed" : failed()) << "\n";
+
+	xmap_strerase_no_shift(&xm, 0);
+	xmap_compact(&xm);
+	std::cout << "Compaction moves tags: "
+			  << (xm.count == 2 && xmap_entry_type(&xm, 0) == XMAP_ENTRY_WCS && xmap_entry_type(&xm, 1) == XMAP_ENTRY_STR
+				  && !strcmp(xmap_strget(&xm, 0), "gamma") && xmap_strlen(&xm, 0) == 5 ? "Passed" : failed()) << "\n";
+
+	// Loaded images measure lengths lazily
+	const char *path = "test_xmap_tags.bin";
+	int saved = xmap_save(&xm, path);
+	xmap_destroy(&xm);
+	xmap_t img;
+	int loaded = xmap_load(&img, path, 0);
+	std::cout << "Image entry lengths: "
+			  << (saved && loaded && xmap_entry_type(&img, 0) == XMAP_ENTRY_WCS
+				  && xmap_wcslen(&img, 0) == 4 && xmap_strlen(&img, 0) == 5 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&img);
+	remove(path);
+}
+
+void test_xmap_inline() {
+	pool_stats st = { 0, 0, 0 };
+	xmap_allocator_t a = { pool_alloc, pool_free, &st };
+	xmap_t xm;
+	xmap_init_alloc(&xm, XMAP_INLINE, &a, NULL, NULL);
+	char buf[64];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "s%d", i);
+		xmap_strinsert(&xm, buf);
+	}
+	xmap_strinsert(&xm, "a string that is too long for an inline cell");
+	xmap_wcsinsert(&xm, L"w");
+	const char *batch[] = { "short", "another string too long to be inlined" };
+	xmap_strinsert_many(&xm, batch, 2);
+	int ok = 1;
+	for (int i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "s%d", i);
+		if (strcmp(xmap_strget(&xm, i), buf) != 0) ok = 0;
+	}
+	std::cout << "Short strings stored inline: "
+			  << (ok && st.allocs == 2 && (xm.tags[0] & XMAP_ENTRY_INLINE) && !(xm.tags[1000] & XMAP_ENTRY_INLINE)
+				  && xmap_strget(&xm, 0) == xm.cells[0].str && !wcscmp(xmap_wcsget(&xm, 0), L"w")
+				  && !strcmp(xmap_strget(&xm, 1001), "short") && xmap_strlen(&xm, 1002) == 37 ? "Passed" : failed()) << "\n";
+
+	// Shifting erases and compaction move the cells with their slots
+	xmap_erase(&xm, 0);
+	xmap_strerase(&xm, 10);
+	xmap_strerase_no_shift(&xm, 20);
+	xmap_compact(&xm);
+	std::cout << "Cells follow their slots: "
+			  << (!strcmp(xmap_strget(&xm, 0), "s1") && !strcmp(xmap_strget(&xm, 10), "s12")
+				  && !strcmp(xmap_strget(&xm, 19), "s21") && !strcmp(xmap_strget(&xm, 998), "short")
+				  && xmap_strget(&xm, 19) == xm.cells[19].str && !wcscmp(xmap_wcsget(&xm, 0), L"w") ? "Passed" : failed()) << "\n";
+	xmap_shrink_to_fit(&xm);
+	std::cout << "Cells survive shrink: " << (!strcmp(xmap_strget(&xm, 500), "s503") ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+	std::cout << "Only long strings allocated: " << (st.allocs == 2 && st.frees == 2 ? "Passed" : failed()) << "\n";
+
+	xmap_init_flags(&xm, XMAP_INLINE | XMAP_READMOSTLY);
+	std::cout << "Inline off for read-mostly maps: " << (!(xm.flags & XMAP_INLINE) ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+}
+
+static void *stats_insert(void *arg) {
+	xmap_insert((xmap_t *)arg, malloc(1));
+	return NULL;
+}
+
+void test_xmap_stats() {
+	xmap_t xm;
+	xmap_init_flags(&xm, XMAP_STATS);
+	for (int i = 0; i < 100; i++) xmap_strinsert(&xm, "x");
+	xmap_stats_t st;
+	int ok = xmap_stats(&xm, &st);
+	std::cout << "Inserts counted: "
+			  << (ok && st.locks >= 100 && st.contended == 0 && st.reallocs > 0 ? "Passed" : failed()) << "\n";
+
+	// Erasing the first of 100 slots shifts the other 99
+	xmap_stats_reset(&xm);
+	xmap_strerase(&xm, 0);
+	xmap_erase(&xm, 98);
+	xmap_stats(&xm, &st);
+	std::cout << "Shift distance counted: " << (st.erases == 2 && st.shifted == 99 ? "Passed" : failed()) << "\n";
+
+	// A writer blocked behind a held lock counts as contended
+	xmap_stats_reset(&xm);
+	xmap_lock(&xm);
+	pthread_t t;
+	pthread_create(&t, NULL, stats_insert, &xm);
+	struct timespec ts = { 0, 20 * 1000000L };
+	nanosleep(&ts, NULL);
+	xmap_unlock(&xm);
+	pthread_join(t, NULL);
+	xmap_stats(&xm, &st);
+	// The lock, the insert, and the xmap_stats() call itself
+	std::cout << "Contention counted: "
+			  << (st.locks == 3 && st.contended == 1 && st.wait_ns >= 10 * 1000000ULL ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+	xmap_init(&xm);
+	std::cout << "Stats need XMAP_STATS: " << (!xmap_stats(&xm, &st) && errno == EINVAL && st.locks == 0 ? "Passed" : failed()) << "\n";
+	xmap_insert(&xm, malloc(1));
+	std::cout << "Plain maps count nothing: " << (xm.stats.locks == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+}
+
+void test_xmap_single() {
+	xmap_t xm;
+	xmap_init_flags(&xm, XMAP_SINGLE | XMAP_READMOSTLY);
+	std::cout << "Single-threaded map is not read-mostly: " << (!(xm.flags & XMAP_READMOSTLY) ? "Passed" : failed()) << "\n";
+
+	// Every call below would deadlock on the held mutex if it locked
+	pthread_mutex_lock(&xm.mutex);
+	for (int i = 0; i < 100; i++) xmap_strinsert(&xm, "s");
+	xmap_insert(&xm, malloc(4));
+	xmap_put(&xm, "key", malloc(4));
+	xmap_strerase(&xm, 0);
+	xmap_erase_no_shift(&xm, 1);
+	xmap_compact(&xm);
+	xmap_shrink_to_fit(&xm);
+	xmap_lock(&xm);
+	xmap_unlock(&xm);
+	int ok = xm.count == 99 && xm.cstr == 98 && !strcmp(xmap_strget(&xm, 0), "s")
+		&& xmap_get(&xm, 98) && xmap_find(&xm, "key");
+	pthread_mutex_unlock(&xm.mutex);
+	std::cout << "Operations skip the mutex: " << (ok ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+	// With XMAP_STATS the skipped acquisitions are counted like real ones
+	xmap_t shared;
+	xmap_stats_t single_st, shared_st;
+	xmap_init_flags(&xm, XMAP_SINGLE | XMAP_STATS);
+	xmap_init_flags(&shared, XMAP_STATS);
+	for (int i = 0; i < 10; i++) {
+		xmap_strinsert(&xm, "s");
+		xmap_strinsert(&shared, "s");
+	}
+	xmap_strerase(&xm, 0);
+	xmap_strerase(&shared, 0);
+	xmap_stats(&xm, &single_st);
+	xmap_stats(&shared, &shared_st);
+	std::cout << "Single-threaded stats count locks: "
+			  << (single_st.locks == shared_st.locks && single_st.locks >= 12 && single_st.contended == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&shared);
+	xmap_destroy(&xm);
+}
+
+void test_xmap_zero_copy() {
+	pool_stats st = { 0, 0, 0 };
+	xmap_allocator_t a = { pool_alloc, pool_free, &st };
+	xmap_t xm;
+	xmap_init_alloc(&xm, 0, &a, NULL, NULL);
+
+	// Length-aware inserts copy a slice; adopted buffers are kept as is
+	xmap_strninsert(&xm, "hello world", 5);
+	xmap_wcsninsert(&xm, L"wide string", 4);
+	char *buf = (char *)pool_alloc(32, &st);
+	strcpy(buf, "adopted buffer");
+	int adopted = xmap_stradopt(&xm, buf, 14);
+	std::cout << "Length-aware and adopting inserts: "
+			  << (!strcmp(xmap_strget(&xm, 0), "hello") && xmap_strlen(&xm, 0) == 5 && !wcscmp(xmap_wcsget(&xm, 0), L"wide")
+				  && adopted && xmap_strget(&xm, 1) == buf && xmap_strlen(&xm, 1) == 14 && st.allocs == 3 ? "Passed" : failed()) << "\n";
+
+	// A lease pins the string across an erase until it ends
+	xmap_lease_t l;
+	int ok = xmap_lease_str(&xm, 1, &l) && l.str == buf && l.len == 14;
+	xmap_strerase(&xm, 1);
+	int pinned = st.frees == 0 && !strcmp((const char *)l.str, "adopted buffer");
+	xmap_lease_end(&l);
+	std::cout << "Lease pins erased string: " << (ok && pinned && st.frees == 1 ? "Passed" : failed()) << "\n";
+	ok = !xmap_lease_str(&xm, 5, &l) && errno == ENOENT;
+	xmap_lease_end(&l);
+	std::cout << "Lease of missing string fails: " << (ok ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+	// Interned slices are terminated before hashing; inline leases copy
+	xmap_init_flags(&xm, XMAP_INTERN);
+	xmap_strinsert(&xm, "abc");
+	xmap_strninsert(&xm, "abcdef", 3);
+	std::cout << "Interned slice shares copy: " << (xmap_strget(&xm, 0) == xmap_strget(&xm, 1) ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+	// Arena maps copy adopted buffers into the arena and release them at once
+	st.allocs = st.frees = 0;
+	xmap_init_alloc(&xm, XMAP_ARENA, &a, NULL, NULL);
+	buf = (char *)pool_alloc(32, &st);
+	strcpy(buf, "adopted buffer");
+	wchar_t *wbuf = (wchar_t *)pool_alloc(8 * sizeof(wchar_t), &st);
+	wcscpy(wbuf, L"adopted");
+	adopted = xmap_stradopt(&xm, buf, 14) && xmap_wcsadopt(&xm, wbuf, 7);
+	ok = adopted && st.frees == 2 && !strcmp(xmap_strget(&xm, 0), "adopted buffer")
+		&& !wcscmp(xmap_wcsget(&xm, 0), L"adopted") && (xm.tags[0] & XMAP_ENTRY_SHARED);
+	xmap_destroy(&xm);
+	std::cout << "Arena adopt copies and releases: " << (ok && st.allocs == st.frees ? "Passed" : failed()) << "\n";
+	xmap_init_flags(&xm, XMAP_INLINE);
+	xmap_strninsert(&xm, "tiny!", 4);
+	ok = xmap_lease_str(&xm, 0, &l) && l.str == l.buf.str && !l.xm && !strcmp(l.buf.str, "tiny");
+	xmap_lease_end(&l);
+	std::cout << "Inline lease copies cell: " << (ok ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+#if __cplusplus >= 201703L
+	xmap_init(&xm);
+	std::string_view src = "xx-slice-xx";
+	xxmap_strinsert(&xm, src.substr(3, 5));
+	xxmap_strinsert(&xm, "literal");
+	xxmap_strinsert(&xm, std::string("string"));
+	xxmap_wcsinsert(&xm, std::wstring_view(L"wide view"));
+	{
+		xmap_strlease s0(&xm, 0), s2(&xm, 2), missing(&xm, 9);
+		xmap_wcslease w0(&xm, 0);
+		std::string_view v = s0;
+		std::cout << "string_view leases: "
+				  << (v == "slice" && s2.view() == "string" && w0.view() == L"wide view" && !missing.ok()
+					  && missing.view().empty() && xm.views == 3 ? "Passed" : failed()) << "\n";
+	}
+	std::cout << "Leases end with scope: " << (xm.views == 0 ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+#endif
+}
+
+void test_xmap_mem() {
+	pool_stats st = { 0, 0, 0 };
+	xmap_allocator_t a = { pool_alloc, pool_free, &st };
+	xmap_t xm;
+	xmap_init_alloc(&xm, 0, &a, NULL, NULL);
+	const char bin[] = { 'a', 0, 'b', 0, 'c' };
+	xmap_strinsert(&xm, "text");
+	size_t i = xmap_meminsert(&xm, bin, sizeof(bin));
+	size_t e = xmap_meminsert(&xm, NULL, 0);
+	size_t len = 0, elen = 1;
+	const char *p = (const char *)xmap_memget(&xm, i, &len);
+	const char *ep = (const char *)xmap_memget(&xm, e, &elen);
+	std::cout << "Binary entry keeps embedded NULs: "
+			  << (i == 1 && p && len == sizeof(bin) && !memcmp(p, bin, sizeof(bin)) && p[len] == 0
+				  && xmap_entry_type(&xm, i) == XMAP_ENTRY_MEM && ep && elen == 0 && *ep == 0 ? "Passed" : failed()) << "\n";
+	std::cout << "memget rejects other entries: "
+			  << (!xmap_memget(&xm, 0, &len) && !xmap_memget(&xm, 9, &len) && xm.cstr == 1 ? "Passed" : failed()) << "\n";
+	size_t bad = xmap_meminsert(&xm, NULL, 3);
+	std::cout << "NULL data with length rejected: " << (bad == (size_t)-1 && errno == EINVAL ? "Passed" : failed()) << "\n";
+
+	// Erases release binary copies and leave the string list intact
+	xmap_erase(&xm, i);
+	xmap_erase_no_shift(&xm, e - 1);
+	std::cout << "Binary erase frees copy: "
+			  << (st.frees == 2 && xm.count == 2 && !strcmp(xmap_strget(&xm, 0), "text") ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+	std::cout << "Binary entries freed on destroy: " << (st.allocs == st.frees ? "Passed" : failed()) << "\n";
+
+	xmap_init_flags(&xm, XMAP_INLINE);
+	i = xmap_meminsert(&xm, bin, sizeof(bin));
+	p = (const char *)xmap_memget(&xm, i, &len);
+	std::cout << "Short binary entry inline: "
+			  << (p == xm.cells[i].str && len == sizeof(bin) && !memcmp(p, bin, len) ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+}
+
+void test_xmap_cache() {
+	pool_stats st = { 0, 0, 0 };
+	xmap_allocator_t a = { pool_alloc, pool_free, &st };
+	xmap_cache_t c;
+	std::cout << "Cache needs a budget: " << (!xmap_cache_init(&c, 0, 0, 0) && errno == EINVAL ? "Passed" : failed()) << "\n";
+
+	// Entry budget: the key hit since the last sweep survives
+	xmap_cache_init_alloc(&c, 3, 0, XMAP_NONOWNING, &a, count_dtor, &st);
+	static int v[5];
+	xmap_cache_put(&c, "a", &v[0], 1);
+	xmap_cache_put(&c, "b", &v[1], 1);
+	xmap_cache_put(&c, "c", &v[2], 1);
+	xmap_cache_put(&c, "a", &v[0], 1); /* same value again: kept, not released */
+	xmap_cache_put(&c, "d", &v[3], 1); /* all referenced: one full sweep, then "a" goes */
+	xmap_cache_get(&c, "b");
+	xmap_cache_put(&c, "e", &v[4], 1); /* "b" was hit since the sweep, "c" was not */
+	int resident = !!xmap_cache_get(&c, "b") + !!xmap_cache_get(&c, "d") + !!xmap_cache_get(&c, "e");
+	std::cout << "Entry budget evicts: "
+			  << (xmap_cache_count(&c) == 3 && resident == 3 && !xmap_cache_get(&c, "a") && !xmap_cache_get(&c, "c")
+				  && c.stats.evictions == 2 && st.dtors == 2 ? "Passed" : failed()) << "\n";
+
+	xmap_cache_stats_t cs;
+	xmap_cache_stats(&c, &cs);
+	int before = (int)cs.misses;
+	xmap_cache_get(&c, "zzz");
+	xmap_cache_stats(&c, &cs);
+	std::cout << "Hit/miss counters: " << (cs.hits == 4 && (int)cs.misses == before + 1 ? "Passed" : failed()) << "\n";
+	std::cout << "Remove releases value: "
+			  << (xmap_cache_remove(&c, "e") && !xmap_cache_remove(&c, "e") && !xmap_cache_get(&c, "e")
+				  && st.dtors == 3 && xmap_cache_count(&c) == 2 ? "Passed" : failed()) << "\n";
+	xmap_cache_destroy(&c);
+	std::cout << "Cache destroy releases all: " << (st.dtors == 5 && st.allocs == st.frees ? "Passed" : failed()) << "\n";
+
+	// Byte budget with owned values and integer keys
+	xmap_cache_init(&c, 0, 100, 0);
+	for (uintptr_t k = 0; k < 10; ++k) xmap_cache_intput(&c, k, malloc(30), 30);
+	int big = !xmap_cache_intput(&c, 99, &v[0], 101) && errno == EINVAL;
+	std::cout << "Byte budget evicts: "
+			  << (xmap_cache_bytes(&c) == 90 && xmap_cache_count(&c) == 3 && xmap_cache_intget(&c, 9) && !xmap_cache_intget(&c, 0)
+				  && big ? "Passed" : failed()) << "\n";
+	void *grown = malloc(80);
+	std::cout << "Replace re-charges bytes: "
+			  << (xmap_cache_intput(&c, 9, grown, 80) && xmap_cache_intget(&c, 9) == grown && xmap_cache_bytes(&c) <= 100 ? "Passed" : failed()) << "\n";
+
+	// Many keys through a small cache: index fix-ups after swap removal
+	int ok = 1;
+	for (uintptr_t k = 100; k < 2000; ++k) {
+		ok &= xmap_cache_intput(&c, k, malloc(10), 10);
+		ok &= xmap_cache_intget(&c, k) != NULL;
+	}
+	for (size_t i = 0; i < c.count; ++i)
+		ok &= xmap_cache_intget(&c, c.entries[i].ikey) == c.entries[i].value;
+	std::cout << "Churn keeps index consistent: " << (ok && xmap_cache_bytes(&c) <= 100 ? "Passed" : failed()) << "\n";
+	xmap_cache_destroy(&c);
+}
+
+void test_xmap_ttl() {
+	pool_stats st = { 0, 0, 0 };
+	xmap_ttl_t t;
+	xmap_ttl_init_alloc(&t, 100, XMAP_NONOWNING, NULL, count_dtor, &st);
+	static int v[4];
+	xmap_ttl_id_t a = xmap_ttl_insert(&t, &v[0], 105);
+	xmap_ttl_id_t b = xmap_ttl_insert(&t, &v[1], 100 + 5000); /* level 2 */
+	xmap_ttl_id_t c = xmap_ttl_insert(&t, &v[2], 50); /* already due */
+	xmap_ttl_id_t d = xmap_ttl_insert(&t, &v[3], 100 + ((uint64_t)1 << 30)); /* past the last level */
+	size_t n0 = xmap_ttl_expire(&t, 104);
+	std::cout << "Due entries expire: "
+			  << (n0 == 1 && !xmap_ttl_get(&t, c) && xmap_ttl_get(&t, a) && st.dtors == 1 ? "Passed" : failed()) << "\n";
+	std::cout << "Touch extends deadline: "
+			  << (xmap_ttl_touch(&t, a, 200) && xmap_ttl_expire(&t, 199) == 0 && xmap_ttl_get(&t, a)
+				  && xmap_ttl_expire(&t, 200) == 1 && !xmap_ttl_get(&t, a) && !xmap_ttl_touch(&t, a, 300) ? "Passed" : failed()) << "\n";
+	std::cout << "Cascaded entry expires on time: "
+			  << (xmap_ttl_expire(&t, 5099) == 0 && xmap_ttl_expire(&t, 5100) == 1 && !xmap_ttl_get(&t, b) ? "Passed" : failed()) << "\n";
+	std::cout << "Far deadline survives wheel turns: "
+			  << (xmap_ttl_expire(&t, (uint64_t)1 << 29) == 0 && xmap_ttl_pending(&t) == 1
+				  && xmap_ttl_expire(&t, 99 + ((uint64_t)1 << 30)) == 0 && xmap_ttl_expire(&t, 100 + ((uint64_t)1 << 30)) == 1
+				  && !xmap_ttl_get(&t, d) && xmap_ttl_pending(&t) == 0 ? "Passed" : failed()) << "\n";
+	xmap_ttl_destroy(&t);
+
+	// Random deadlines, touches and erases against a brute-force check
+	xmap_ttl_init(&t, 0, XMAP_NONOWNING);
+	const size_t N = 4000;
+	std::vector<uint64_t> due(N);
+	std::vector<int> live(N, 1);
+	std::vector<xmap_ttl_id_t> ids(N);
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	for (size_t i = 0; i < N; ++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		due[i] = x % 300000;
+		ids[i] = xmap_ttl_insert(&t, (void *)(uintptr_t)(i + 1), due[i]);
+	}
+	int ok = 1;
+	size_t expired = 0, erased = 0;
+	for (uint64_t now = 0; now < 310000; now += 1 + (uint64_t)(x % 997)) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		size_t k = (size_t)(x % N);
+		if (live[k] && due[k] > now && (x & 1)) {
+			due[k] = now + (x >> 8) % 5000;
+			ok &= xmap_ttl_touch(&t, ids[k], due[k]);
+		} else if (live[k] && due[k] > now && (x & 2)) {
+			ok &= xmap_ttl_erase(&t, ids[k]);
+			live[k] = 0;
+			erased++;
+		}
+		expired += xmap_ttl_expire(&t, now);
+		for (size_t i = 0; i < N; ++i) {
+			if (live[i] && due[i] <= now) live[i] = 0;
+			ok &= !!xmap_ttl_get(&t, ids[i]) == live[i];
+		}
+	}
+	std::cout << "Wheel matches brute force: "
+			  << (ok && expired + erased == N && xmap_ttl_pending(&t) == 0 ? "Passed" : failed()) << "\n";
+	xmap_ttl_destroy(&t);
+
+	// Churn: a steady live set reuses expired indices, so capacity stays put
+	xmap_ttl_init_alloc(&t, 0, XMAP_NONOWNING, NULL, count_dtor, &st);
+	st.dtors = 0;
+	ok = 1;
+	for (uint64_t now = 0; now < 100000; ++now) {
+		xmap_ttl_id_t id = xmap_ttl_insert(&t, &v[now & 3], now + 100);
+		ok &= id.index < 128 && xmap_ttl_get(&t, id) == &v[now & 3];
+		xmap_ttl_expire(&t, now);
+	}
+	std::cout << "Churn reuses expired slots: "
+			  << (ok && t.xm.count <= 128 && t.xm.capacity <= 128 && t.capacity <= 128
+				  && xmap_ttl_pending(&t) == 100 && st.dtors == 100000 - 100 ? "Passed" : failed()) << "\n";
+	xmap_ttl_destroy(&t);
+
+	// A handle to an expired entry does not reach the entry reusing its index
+	xmap_ttl_init(&t, 0, XMAP_NONOWNING);
+	xmap_ttl_id_t old = xmap_ttl_insert(&t, &v[0], 5);
+	xmap_ttl_expire(&t, 5);
+	xmap_ttl_id_t fresh = xmap_ttl_insert(&t, &v[1], 50);
+	ok = fresh.index == old.index && fresh.gen != old.gen
+		&& !xmap_ttl_get(&t, old) && !xmap_ttl_touch(&t, old, 1000) && !xmap_ttl_erase(&t, old)
+		&& xmap_ttl_get(&t, fresh) == &v[1] && xmap_ttl_pending(&t) == 1;
+	std::cout << "Stale handles are rejected: " << (ok ? "Passed" : failed()) << "\n";
+
+	// NULL values expire and free their index like any other
+	for (uint64_t now = 100; now < 1100; ++now) {
+		xmap_ttl_insert(&t, NULL, now + 10);
+		xmap_ttl_expire(&t, now);
+	}
+	xmap_ttl_id_t n = xmap_ttl_insert(&t, NULL, 5000);
+	ok = t.xm.count <= 16 && xmap_ttl_erase(&t, n) && !xmap_ttl_erase(&t, n) && xmap_ttl_pending(&t) == 10;
+	std::cout << "NULL values are retired: " << (ok ? "Passed" : failed()) << "\n";
+	xmap_ttl_destroy(&t);
+}
+
+static void *snapshot_writer(void *arg) {
+	xmap_t *xm = (xmap_t *)arg;
+	for (size_t k = 0; k < 3000; ++k) {
+		xmap_erase_no_shift(xm, (k * 7919) % 5000);
+		xmap_insert(xm, (void *)(uintptr_t)(100000 + k));
+		if (k % 500 == 0) xmap_erase(xm, k);
+	}
+	xmap_compact(xm);
+	return NULL;
+}
+
+void test_xmap_snapshot() {
+	pool_stats st = { 0, 0, 0 };
+	xmap_t xm;
+	xmap_init_alloc(&xm, XMAP_NONOWNING, NULL, count_dtor, &st);
+	const size_t N = 3 * XMAP_PAGE_SLOTS;
+	for (size_t i = 0; i < N; ++i) xmap_insert(&xm, (void *)(uintptr_t)(i + 1));
+	xmap_snapshot_t s, s2;
+	xmap_snapshot(&xm, &s);
+	std::cout << "Snapshot copies nothing: "
+			  << (!s.pages[0] && !s.pages[1] && !s.pages[2] && xmap_snapshot_count(&s) == N ? "Passed" : failed()) << "\n";
+
+	// Writers copy only the page they touch; the old value outlives the erase
+	xmap_erase_no_shift(&xm, 5);
+	std::cout << "Writer copies one page: "
+			  << (s.pages[0] && !s.pages[1] && !s.pages[2] && xmap_snapshot_get(&s, 5) == (void *)6
+				  && !xmap_get(&xm, 5) && st.dtors == 0 ? "Passed" : failed()) << "\n";
+
+	// A page written after two snapshots is copied once and shared
+	xmap_snapshot(&xm, &s2);
+	xmap_erase(&xm, XMAP_PAGE_SLOTS + 1); /* shifts pages 1 and 2 */
+	xmap_insert(&xm, (void *)1234);
+	int ok = s.pages[1] == s2.pages[1] && s.pages[2] == s2.pages[2] && s.pages[1]->refs == 2 && s.pages[0] != s2.pages[0];
+	for (size_t i = 0; i < N; ++i) {
+		ok &= xmap_snapshot_get(&s, i) == (void *)(uintptr_t)(i + 1);
+		ok &= xmap_snapshot_get(&s2, i) == (i == 5 ? NULL : (void *)(uintptr_t)(i + 1));
+	}
+	std::cout << "Snapshots share pages: " << (ok && !xmap_snapshot_get(&s, N) ? "Passed" : failed()) << "\n";
+	xmap_snapshot_release(&s);
+	std::cout << "Releases wait for last snapshot: " << (st.dtors == 0 ? "Passed" : failed()) << "\n";
+	xmap_snapshot_release(&s2);
+	std::cout << "Last snapshot runs releases: " << (st.dtors == 2 && !xm.snapshots && !xm.views ? "Passed" : failed()) << "\n";
+	xmap_destroy(&xm);
+
+	// Inline and binary entries keep their bytes after shifts and compaction
+	xmap_init_flags(&xm, XMAP_INLINE);
+	xmap_strinsert(&xm, "short");
+	xmap_strinsert(&xm, "a string too long for an inline cell");
+	xmap_meminsert(&xm, "b\0n", 3);
+	xmap_wcsinsert(&xm, L"wide");
+	xmap_snapshot(&xm, &s);
+	xmap_erase(&xm, 0);
+	xmap_strerase_no_shift(&xm, 0);
+	xmap_compact(&xm);
+	xmap_strinsert(&xm, "later");
+	const char *p = (const char *)xmap_snapshot_get(&s, 0);
+	std::cout << "Snapshot entries keep bytes: "
+			  << (p && !strcmp(p, "short") && !strcmp((const char *)xmap_snapshot_get(&s, 1), "a string too long for an inline cell")
+				  && xmap_snapshot_type(&s, 2) == XMAP_ENTRY_MEM && xmap_snapshot_len(&s, 2) == 3
+				  && !memcmp(xmap_snapshot_get(&s, 2), "b\0n", 3) && !wcscmp((const wchar_t *)xmap_snapshot_get(&s, 3), L"wide")
+				  && xmap_snapshot_len(&s, 1) == 36 && xmap_snapshot_type(&s, 4) == -1 && xm.count == 3 ? "Passed" : failed()) << "\n";
+	xmap_snapshot_release(&s);
+	xmap_destroy(&xm);
+
+	// A reader walks a snapshot while a writer mutates the map
+	xmap_init_flags(&xm, XMAP_NONOWNING);
+	for (size_t i = 0; i < 5000; ++i) xmap_insert(&xm, (void *)(uintptr_t)(i + 1));
+	xmap_snapshot(&xm, &s);
+	pthread_t wr;
+	pthread_create(&wr, NULL, snapshot_writer, &xm);
+	ok = 1;
+	for (int pass = 0; pass < 20; ++pass)
+		for (size_t i = 0; i < 5000; ++i) ok &= xmap_snapshot_get(&s, i) == (void *)(uintptr_t)(i + 1);
+	pthread_join(wr, NULL);
+	for (size_t i = 0; i < 5000; ++i) ok &= xmap_snapshot_get(&s, i) == (void *)(uintptr_t)(i + 1);
+	std::cout << "Snapshot stable under writer: " << (ok && !s.error ? "Passed" : failed()) << "\n";
+	xmap_snapshot_release(&s);
+	xmap_destroy(&xm);
+}
+
 void test_memory_allocation_failure() {
 	xmap_t xm;
 	xmap_init(&xm);
@@ -83,8 +1296,77 @@ int main() {
 	std::cout << "Running basic xmap tests...\n";
 	test_xmap_basic_operations();
 
+	std::cout << "\nRunning keyed lookup tests...\n";
+	test_xmap_keyed_lookup();
+
+	std::cout << "\nRunning compaction tests...\n";
+	test_xmap_compaction();
+
+	std::cout << "\nRunning read-mostly concurrency tests...\n";
+	test_xmap_readmostly();
+
+	std::cout << "\nRunning sharded map tests...\n";
+	test_xmap_sharded();
+
+	std::cout << "\nRunning arena storage tests...\n";
+	test_xmap_arena();
+
+	std::cout << "\nRunning string interning tests...\n";
+	test_xmap_intern();
+
+	std::cout << "\nRunning batch insert/get tests...\n";
+	test_xmap_batch();
+
+	std::cout << "\nRunning reserve/shrink tests...\n";
+	test_xmap_capacity();
+
+	std::cout << "\nRunning ownership callback tests...\n";
+	test_xmap_ownership();
+
+	std::cout << "\nRunning typed map tests...\n";
+	test_xmap_typed();
+
+	std::cout << "\nRunning snapshot view tests...\n";
+	test_xmap_view();
+
+	std::cout << "\nRunning parallel pass tests...\n";
+	test_xmap_parallel();
+
+	std::cout << "\nRunning save/load image tests...\n";
+	test_xmap_image();
+
+	std::cout << "\nRunning ordered index tests...\n";
+	test_xmap_ordered();
+
+	std::cout << "\nRunning entry tag tests...\n";
+	test_xmap_tags();
+
+	std::cout << "\nRunning inline string tests...\n";
+	test_xmap_inline();
+
+	std::cout << "\nRunning stats tests...\n";
+	test_xmap_stats();
+
+	std::cout << "\nRunning single-threaded map tests...\n";
+	test_xmap_single();
+
+	std::cout << "\nRunning zero-copy string tests...\n";
+	test_xmap_zero_copy();
+
+	std::cout << "\nRunning binary entry tests...\n";
+	test_xmap_mem();
+
+	std::cout << "\nRunning cache tests...\n";
+	test_xmap_cache();
+
+	std::cout << "\nRunning expiring map tests...\n";
+	test_xmap_ttl();
+
+	std::cout << "\nRunning copy-on-write snapshot tests...\n";
+	test_xmap_snapshot();
+
 	std::cout << "\nRunning memory allocation failure test...\n";
 	test_memory_allocation_failure();
 
-	return 0;
+	return failures != 0;
 }
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include "xqueue.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define PER_PRODUCER 100000
+
+typedef struct {
+	xqueue_t *q;
+	size_t base;
+	unsigned long long sum;
+	size_t count;
+} worker_t;
+
+static void *producer(void *arg) {
+	worker_t *w = (worker_t *)arg;
+	for (size_t i = 1; i <= PER_PRODUCER; i++)
+		xqueue_push(w->q, (void *)(uintptr_t)(w->base + i));
+	return NULL;
+}
+
+static void *consumer(void *arg) {
+	worker_t *w = (worker_t *)arg;
+	void *data;
+	while (xqueue_pop(w->q, &data)) {
+		w->sum += (uintptr_t)data;
+		w->count++;
+	}
+	return NULL;
+}
+
+int main() {
+	xqueue_t q;
+
+	// 1. Non-blocking calls: FIFO order, full and empty
+	xqueue_init(&q, 3);
+	printf("Capacity rounded up: %s\n", xqueue_capacity(&q) == 4 ? "Passed" : "Failed");
+	int ok = 1;
+	for (uintptr_t i = 1; i <= 4; i++) ok &= xqueue_trypush(&q, (void *)i);
+	int full = !xqueue_trypush(&q, (void *)5) && errno == EAGAIN;
+	printf("Push until full: %s\n", ok && full && xqueue_size(&q) == 4 ? "Passed" : "Failed");
+	void *data = NULL;
+	ok = 1;
+	for (uintptr_t i = 1; i <= 4; i++) ok &= xqueue_trypop(&q, &data) && (uintptr_t)data == i;
+	int empty = !xqueue_trypop(&q, &data) && errno == EAGAIN;
+	printf("Pop in FIFO order: %s\n", ok && empty && xqueue_size(&q) == 0 ? "Passed" : "Failed");
+
+	// 2. Wrap around the ring many times
+	ok = 1;
+	for (uintptr_t i = 0; i < 1000; i++) {
+		ok &= xqueue_trypush(&q, (void *)i);
+		ok &= xqueue_trypop(&q, &data) && (uintptr_t)data == i;
+	}
+	printf("Ring wrap-around: %s\n", ok ? "Passed" : "Failed");
+	xqueue_destroy(&q);
+
+	// 3. Blocking calls, several producers and consumers on a small ring
+	xqueue_init(&q, 64);
+	pthread_t pt[PRODUCERS], ct[CONSUMERS];
+	worker_t pw[PRODUCERS], cw[CONSUMERS];
+	for (int i = 0; i < CONSUMERS; i++) {
+		cw[i].q = &q;
+		cw[i].sum = 0;
+		cw[i].count = 0;
+		pthread_create(&ct[i], NULL, consumer, &cw[i]);
+	}
+	for (int i = 0; i < PRODUCERS; i++) {
+		pw[i].q = &q;
+		pw[i].base = (size_t)i * PER_PRODUCER;
+		pthread_create(&pt[i], NULL, producer, &pw[i]);
+	}
+	for (int i = 0; i < PRODUCERS; i++) pthread_join(pt[i], NULL);
+	xqueue_close(&q);
+	unsigned long long sum = 0;
+	size_t count = 0;
+	for (int i = 0; i < CONSUMERS; i++) {
+		pthread_join(ct[i], NULL);
+		sum += cw[i].sum;
+		count += cw[i].count;
+	}
+	unsigned long long n = (unsigned long long)PRODUCERS * PER_PRODUCER;
+	printf("MPMC every item once: %s\n", count == n && sum == n * (n + 1) / 2 ? "Passed" : "Failed");
+
+	// 4. A closed queue refuses pushes and reports EPIPE once drained
+	int closed = !xqueue_push(&q, (void *)1) && errno == EPIPE
+		&& !xqueue_pop(&q, &data) && errno == EPIPE;
+	printf("Closed queue: %s\n", closed ? "Passed" : "Failed");
+	xqueue_destroy(&q);
+
+	printf("Zero capacity rejected: %s\n", !xqueue_init(&q, 0) && errno == EINVAL ? "Passed" : "Failed");
+	return 0;
+}